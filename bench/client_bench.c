@@ -0,0 +1,1160 @@
+#include "../include/client_server.h"
+#include "../include/connection.h"
+#include <sys/wait.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <errno.h>
+
+/* Loopback benchmark suite and load generator for the client library, run through the bench target. It consists of:
+ * (i) a full game session lifecycle, with a stub game server in this process and N simulated clients, each in a process
+ *     of its own (as separate front-ends would be), all over loopback: NEW_GAME, P2P mesh set up, P2P_READY, START_GAME,
+ *     a storm of LINES_CLEARED across the mesh, and lastly FINISHED_GAME; then the same lifecycle for a farm of bots,
+ *     i.e. several game sessions of N clients each, all within this process and served by a single I/O engine;
+ *     lastly the latency of delivering a line between two clients, over the P2P connections and as datagrams (with
+ *     and without emulated loss), and the SCORE_UPDATE messages sent to the server as the score of a client changes
+ *     (in CHILL sessions, without any other client, as well as in RISING_TIDE sessions);
+ * (ii) micro-benchmarks of send_msg, recv_msg and enqueue_server_msg over a loopback connection, reporting throughput,
+ *      latency percentiles and heap allocations per message, and the effect of the socket profile on the latency of
+ *      small messages;
+ * (iii) micro-benchmarks of the game state getters, both uncontended and contended by a thread updating the counters
+ *       as the P2P event loop does;
+ * (iv) a micro-benchmark of the NEW_GAME parser, followed by a fuzz run checking that malformed messages are rejected
+ *      (rather than misread, or overflowing the table of clients).
+ *
+ * Usage: client_bench [n_clients] [n_lines] [n_msgs] [base_port] [io]
+ *
+ * where io selects how the simulated clients run their networking: "threads" (the front-end threads, by default), or
+ * the library-managed I/O engine with the "epoll" or "uring" backend (see io_engine_create); the bot farm always runs
+ * on the I/O engine (with the epoll backend, unless "uring" is selected).
+ */
+
+#define BENCH_DEFAULT_CLIENTS 4
+#define BENCH_DEFAULT_LINES 1000 // lines cleared by each client during the storm
+#define BENCH_DEFAULT_MSGS 200000 // messages sent in each micro-benchmark
+#define BENCH_DEFAULT_PORT 18080
+#define BENCH_TIMEOUT_MS 10000
+#define BENCH_GETTER_OPS 10000000
+#define BENCH_PROFILE_TRIPS 50 // round trips per socket profile (few, since each may take a delayed ACK without a profile)
+#define BENCH_PARSE_OPS 1000000
+#define BENCH_FUZZ_CASES 200000
+#define BENCH_PARSE_PLAYERS 8 // clients listed in the NEW_GAME message parsed by the parser micro-benchmark
+#define BENCH_FARM_GAMES 8 // game sessions run side by side by the bot farm
+#define BENCH_FARM_PORT_STRIDE 100 // spacing of the base ports of the game sessions of the bot farm
+#define BENCH_DELIVERY_LINES 500 // lines sent one at a time (each awaited before the next) by the line delivery benchmark
+#define BENCH_DELIVERY_LOSS 50 // datagrams dropped (in thousandths) by the lossy run of the line delivery benchmark
+#define BENCH_DELIVERY_GAP_US 20 // interval at which lines are sent, without awaiting delivery, by the runs with many in flight
+#define BENCH_SCORE_MS 1000 // duration of the run in which the score of a client changes continually
+#define BENCH_SCORE_PERIOD_US 100 // interval at which the score is changed in that run
+#define BENCH_READER_TIMEOUT_MS 100 // time out of enqueue_server_msg in the thread reading from the server in that run
+
+// I/O engine backend used by the simulated clients (see enum IoBackend), or -1 if they run the front-end threads
+static int bench_io_backend = -1;
+
+// Number of heap allocations made by the process (see the malloc family wrappers below)
+static atomic_ullong n_allocs;
+
+/* The malloc family is wrapped such that heap allocations (including those made within the library, which resolves
+ * these symbols to the executable's definitions) may be counted; the actual allocation is delegated to glibc.
+ */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size){
+    atomic_fetch_add_explicit(&n_allocs, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size){
+    atomic_fetch_add_explicit(&n_allocs, 1, memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size){
+    atomic_fetch_add_explicit(&n_allocs, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+// Opens a socket listening on the loopback interface at the given port (0 for any free port); returns the fd, or -1
+static int bench_listen(int port){
+    int fd = socket(SDOMAIN, TYPE, 0);
+    if(fd < 0){
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
+    struct sockaddr_in addrIn = {.sin_family = SDOMAIN, .sin_addr.s_addr = inet_addr(IP_LOCALHOST), .sin_port = htons(port)};
+    if(bind(fd, (struct sockaddr*) &addrIn, sizeof(addrIn)) < 0 || listen(fd, 64) < 0){
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Opens a connection over loopback, setting *a and *b to its two ends; returns 0 on success, -1 on failure
+static int bench_socket_pair(client_ctx* ctx, int* a, int* b){
+    int listen_fd = bench_listen(0);
+    struct sockaddr_in addrIn;
+    socklen_t addr_len = sizeof(addrIn);
+
+    if(listen_fd < 0 || getsockname(listen_fd, (struct sockaddr*) &addrIn, &addr_len) < 0){
+        return -1;
+    }
+
+    char ip[INET_ADDRSTRLEN] = IP_LOCALHOST;
+    *a = client_connect(ctx, ip, ntohs(addrIn.sin_port));
+    *b = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+
+    return *a >= 0 && *b >= 0 ? 0 : -1;
+}
+
+// Prints a summary of a latency histogram (in microseconds) under the given label
+static void bench_print_latency(const char* label, net_histogram* hist){
+    net_latency_stats stats;
+    net_histogram_read(hist, &stats);
+
+    printf("  %-34s p50 %8.2f us   p99 %8.2f us   max %8.2f us   (n = %llu)\n", label, stats.p50_ns / 1e3,
+           stats.p99_ns / 1e3, stats.max_ns / 1e3, stats.count);
+}
+
+/* ------------------------- GAME SESSION LIFECYCLE ------------------------- */
+
+// Results reported by each simulated client to the benchmark (through a pipe)
+typedef struct{
+    int ok;
+    long long mesh_setup_ms;
+    long long start_wait_ms;
+    long long storm_ns; // from START_GAME until all lines cleared by the other clients have been received
+    int lines_received;
+    unsigned long long lines_msgs_out; // LINES_CLEARED messages sent, i.e. after coalescing
+    int max_rtt_us; // largest round-trip time to another client, as measured by the heartbeats
+    net_latency_stats lines_send_latency;
+}client_report;
+
+/* Body of a simulated client: joins the game session of the stub server, sets up the P2P mesh, clears n_lines lines
+ * (one at a time) and waits to receive those cleared by every other client, before ending the game and reporting.
+ */
+static void bench_client(int n_clients, int n_lines, int port, int report_fd){
+    client_report report = {0};
+    pthread_t accept_thread;
+    int joined = 0;
+
+    set_net_stats_enabled(1);
+    client_ctx* ctx = client_create();
+    io_engine* engine = NULL;
+    if(ctx != NULL){
+        set_base_port(ctx, port);
+    }
+    if(ctx == NULL || client_init(ctx, IP_LOCALHOST) < 0 || (bench_io_backend >= 0 &&
+       ((engine = io_engine_create(bench_io_backend, 1)) == NULL || io_engine_attach(engine, ctx) < 0))){
+        write(report_fd, &report, sizeof(report));
+        _exit(EXIT_FAILURE);
+    }
+
+    // handle server messages until the game is started, setting up the P2P mesh on receipt of NEW_GAME
+    long long deadline_ns = net_stats_now_ns() + BENCH_TIMEOUT_MS * 1000000LL;
+    int started = 0;
+    while(!started && net_stats_now_ns() < deadline_ns){
+        if(bench_io_backend >= 0){ // messages are enqueued by the I/O engine, which notifies us through the event fd
+            struct pollfd event_poll = {.fd = get_event_fd(ctx), .events = POLLIN};
+            poll(&event_poll, 1, BENCH_TIMEOUT_MS);
+            take_events(ctx);
+        }else if(enqueue_server_msg(ctx).msg_type == INVALID){
+            break;
+        }
+
+        msg recvMsg = dequeue_server_msg(ctx);
+        if(recvMsg.msg_type == INVALID){
+            break;
+        }else if(recvMsg.msg_type == NEW_GAME){
+            if(handle_new_game_msg(ctx, recvMsg) < 0){
+                msg_release(ctx, &recvMsg);
+                break;
+            }
+            joined = 1;
+            if(bench_io_backend < 0){ // otherwise the I/O engine sets up the mesh itself
+                pthread_create(&accept_thread, NULL, accept_peer_connections, ctx);
+                service_peer_connections(ctx); // returns once P2P_READY has been sent
+            }
+        }else if(recvMsg.msg_type == START_GAME){
+            started = 1;
+        }
+        msg_release(ctx, &recvMsg);
+    }
+
+    long long storm_start_ns = net_stats_now_ns();
+    if(started){
+        for(int i = 0; i < n_lines; i++){
+            send_cleared_lines(ctx, 1);
+        }
+
+        int expected = (n_clients - 1) * n_lines;
+        deadline_ns = storm_start_ns + BENCH_TIMEOUT_MS * 1000000LL;
+        while(report.lines_received < expected && net_stats_now_ns() < deadline_ns){
+            int n = get_lines_to_add(ctx);
+            if(n > 0){
+                report.lines_received += n;
+            }else{
+                usleep(20);
+            }
+        }
+
+        report.ok = report.lines_received == expected;
+    }
+    report.storm_ns = net_stats_now_ns() - storm_start_ns;
+
+    // wait for the heartbeats to have measured the round-trip time to every other client
+    deadline_ns = net_stats_now_ns() + 3 * HEARTBEAT_INTERVAL_MS * 1000000LL;
+    int measured = 0;
+    while(started && !measured && net_stats_now_ns() < deadline_ns){
+        measured = 1;
+        report.max_rtt_us = 0;
+        for(int i = 0; i < get_game_session(ctx)->n_players; i++){
+            peer_link_info info;
+            if(get_peer_link_info(ctx, i, &info) == 0 && info.state == CONNECTED){
+                measured &= info.rtt_us > 0;
+                if(info.rtt_us > report.max_rtt_us){ report.max_rtt_us = info.rtt_us;}
+            }
+        }
+        usleep(1000);
+    }
+
+    net_stats stats;
+    get_net_stats(ctx, &stats);
+    report.mesh_setup_ms = stats.mesh_setup_ms;
+    report.start_wait_ms = stats.start_wait_ms;
+    report.lines_msgs_out = stats.peers.msgs_out[LINES_CLEARED];
+    report.lines_send_latency = stats.lines_send_latency;
+
+    if(joined){
+        end_game(ctx);
+        if(bench_io_backend < 0){
+            pthread_join(accept_thread, NULL);
+        }
+    }
+    io_engine_destroy(engine);
+    client_destroy(ctx);
+
+    write(report_fd, &report, sizeof(report));
+    _exit(report.ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// Waits for a message of the given type on each of the n sockets (ignoring any others); returns 0 on success, -1 otherwise
+static int bench_await_all(int* fds, int n, int msg_type){
+    for(int i = 0; i < n; i++){
+        struct pollfd pfd = {.fd = fds[i], .events = POLLIN};
+        msg recvMsg = {.msg_type = EMPTY};
+
+        while(recvMsg.msg_type != msg_type){
+            if(!conn_has_msg(fds[i]) && poll(&pfd, 1, BENCH_TIMEOUT_MS) <= 0){
+                return -1;
+            }
+
+            recvMsg = recv_msg(fds[i]);
+            if(recvMsg.msg_type == INVALID){
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Sends each of the n_clients clients connected on fds a NEW_GAME message (of the given game type) listing them all,
+// giving client i the slot i + 1
+static void bench_send_new_game(int* fds, int n_clients, int game_type){
+    char new_game[MSG_MAX_LEN];
+    int len = snprintf(new_game, sizeof(new_game), "%d::0::10::0::1234::%%d", game_type);
+    for(int i = 0; i < n_clients; i++){
+        len += snprintf(new_game + len, sizeof(new_game) - len, "::%s", IP_LOCALHOST);
+    }
+
+    for(int i = 0; i < n_clients; i++){
+        char data[MSG_MAX_LEN];
+        msg new_game_msg = {.msg_type = NEW_GAME, .msg = data};
+        snprintf(data, sizeof(data), new_game, i + 1);
+        send_msg(new_game_msg, fds[i]);
+    }
+}
+
+/* Runs a full game session between n_clients simulated clients, acting as the (stub) game server listening on port,
+ * and reports the results. Returns 0 if every client received every line cleared by the others, -1 otherwise.
+ */
+static int bench_lifecycle(int n_clients, int n_lines, int port){
+    int listen_fd = bench_listen(port), report_pipe[2];
+    if(listen_fd < 0 || pipe(report_pipe) < 0){
+        perror("Failed to set up the stub game server");
+        return -1;
+    }
+
+    for(int i = 0; i < n_clients; i++){
+        if(fork() == 0){
+            close(listen_fd); close(report_pipe[0]);
+            bench_client(n_clients, n_lines, port, report_pipe[1]);
+        }
+    }
+    close(report_pipe[1]);
+
+    // accept every client, and send each a NEW_GAME message listing all clients
+    int fds[n_clients];
+    for(int i = 0; i < n_clients; i++){
+        fds[i] = accept(listen_fd, NULL, NULL);
+    }
+
+    long long new_game_ns = net_stats_now_ns();
+    bench_send_new_game(fds, n_clients, RISING_TIDE);
+
+    // wait for the whole mesh to be set up, then start the game and wait for every client to finish
+    int ret = bench_await_all(fds, n_clients, P2P_READY);
+    long long mesh_ns = net_stats_now_ns() - new_game_ns;
+    if(ret == 0){
+        for(int i = 0; i < n_clients; i++){
+            conn_send(fds[i], START_GAME, "", 0);
+        }
+        ret = bench_await_all(fds, n_clients, FINISHED_GAME);
+    }
+
+    // collect the reports of the clients
+    client_report reports[n_clients];
+    int n_reports = 0, n_ok = 0;
+    long long max_storm_ns = 0;
+    unsigned long long total_lines = 0, total_msgs = 0;
+    while(n_reports < n_clients && read(report_pipe[0], reports + n_reports, sizeof(client_report)) == sizeof(client_report)){
+        n_ok += reports[n_reports].ok;
+        total_lines += reports[n_reports].lines_received;
+        total_msgs += reports[n_reports].lines_msgs_out;
+        if(reports[n_reports].storm_ns > max_storm_ns){ max_storm_ns = reports[n_reports].storm_ns;}
+        n_reports++;
+    }
+    while(wait(NULL) > 0);
+
+    printf("Game session lifecycle (%d clients, %d lines cleared each, %s)\n", n_clients, n_lines,
+           bench_io_backend == IO_BACKEND_EPOLL ? "I/O engine, epoll" : bench_io_backend == IO_BACKEND_URING ? "I/O engine, io_uring" : "front-end threads");
+    printf("  %-34s %8.2f ms (as seen by the server)\n", "NEW_GAME -> all P2P_READY", mesh_ns / 1e6);
+    for(int i = 0; i < n_reports; i++){
+        printf("  client %-27d mesh %lld ms, start wait %lld ms, lines p50 %.2f us / p99 %.2f us, rtt %d us, %s\n", i,
+               reports[i].mesh_setup_ms, reports[i].start_wait_ms, reports[i].lines_send_latency.p50_ns / 1e3,
+               reports[i].lines_send_latency.p99_ns / 1e3, reports[i].max_rtt_us, reports[i].ok ? "ok" : "FAILED");
+    }
+    printf("  %-34s %8.0f lines/s (%llu lines in %llu LINES_CLEARED messages)\n", "LINES_CLEARED storm",
+           max_storm_ns > 0 ? total_lines / (max_storm_ns / 1e9) : 0.0, total_lines, total_msgs);
+
+    for(int i = 0; i < n_clients; i++){ close(fds[i]);}
+    close(listen_fd); close(report_pipe[0]);
+
+    return ret == 0 && n_ok == n_clients ? 0 : -1;
+}
+
+/* ------------------------- BOT FARM ------------------------- */
+
+// Bots of the farm, run by a single front-end thread (see bench_farm_frontend), in game sessions of n_clients bots each
+typedef struct{
+    client_ctx** bots;
+    int n_games;
+    int n_clients;
+    int n_lines;
+    int n_ok; // bots which received every line cleared by the others in their game session
+}bench_farm;
+
+/* Front-end of the bot farm: a single thread which waits on the event fds of all the bots, handles the messages of each
+ * (as bench_client does), and clears n_lines lines for each bot once its game has started. Each game session is ended
+ * once all of its bots have received every line cleared by the others.
+ */
+static void* bench_farm_frontend(void* arg){
+    bench_farm* farm = arg;
+    int n_bots = farm->n_games * farm->n_clients, expected = (farm->n_clients - 1) * farm->n_lines;
+    struct pollfd event_polls[n_bots];
+    int started[n_bots], received[n_bots], game_done[farm->n_games], n_games_done = 0;
+
+    for(int b = 0; b < n_bots; b++){
+        event_polls[b] = (struct pollfd) {.fd = get_event_fd(farm->bots[b]), .events = POLLIN};
+        started[b] = received[b] = 0;
+    }
+    memset(game_done, 0, sizeof(game_done));
+
+    long long deadline_ns = net_stats_now_ns() + 2 * BENCH_TIMEOUT_MS * 1000000LL;
+    while(n_games_done < farm->n_games && net_stats_now_ns() < deadline_ns){
+        poll(event_polls, n_bots, 1); // lines added are also picked up by polling the getter, as a game loop would
+
+        for(int b = 0; b < n_bots; b++){
+            client_ctx* bot = farm->bots[b];
+            if(event_polls[b].revents & POLLIN){
+                take_events(bot);
+            }
+
+            msg recvMsg;
+            while((recvMsg = dequeue_server_msg(bot)).msg_type != EMPTY && recvMsg.msg_type != INVALID){
+                if(recvMsg.msg_type == NEW_GAME){
+                    handle_new_game_msg(bot, recvMsg); // the I/O engine then sets up the mesh itself
+                }else if(recvMsg.msg_type == START_GAME && !started[b]){
+                    started[b] = 1;
+                    for(int i = 0; i < farm->n_lines; i++){
+                        send_cleared_lines(bot, 1);
+                    }
+                }
+                msg_release(bot, &recvMsg);
+            }
+
+            int n = started[b] ? get_lines_to_add(bot) : 0;
+            if(n > 0){
+                received[b] += n;
+            }
+        }
+
+        // end every game session in which all bots have received every line cleared by the others
+        for(int g = 0; g < farm->n_games; g++){
+            int n_complete = 0;
+            for(int i = 0; i < farm->n_clients; i++){
+                n_complete += received[g * farm->n_clients + i] >= expected;
+            }
+
+            if(!game_done[g] && n_complete == farm->n_clients){
+                for(int i = 0; i < farm->n_clients; i++){
+                    end_game(farm->bots[g * farm->n_clients + i]);
+                }
+                game_done[g] = 1;
+                n_games_done++;
+                farm->n_ok += farm->n_clients;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* Runs BENCH_FARM_GAMES game sessions of n_clients bots each side by side within this process: every bot is a client
+ * instance of its own, all attached to a single I/O engine and driven by a single front-end thread, while the stub game
+ * server (one per game session, at a base port of its own) runs in this thread. Returns 0 if every bot received every
+ * line cleared by the others in its game session, -1 otherwise.
+ */
+static int bench_bot_farm(int n_clients, int n_lines, int port){
+    int n_games = BENCH_FARM_GAMES, n_bots = n_games * n_clients;
+    int backend = bench_io_backend == IO_BACKEND_URING ? IO_BACKEND_URING : IO_BACKEND_EPOLL;
+    int listen_fds[n_games], fds[n_bots], n_attached = 0;
+    client_ctx* bots[n_bots];
+    bench_farm farm = {.bots = bots, .n_games = n_games, .n_clients = n_clients, .n_lines = n_lines};
+
+    unsigned long long allocs = atomic_load(&n_allocs);
+    io_engine* engine = io_engine_create(backend, n_bots);
+    for(int g = 0; g < n_games; g++){
+        listen_fds[g] = bench_listen(port + (g + 1) * BENCH_FARM_PORT_STRIDE);
+    }
+
+    // create the bots, each connecting to the stub server of its game session and attaching to the engine
+    for(int b = 0; b < n_bots && engine != NULL; b++){
+        int g = b / n_clients;
+        if(listen_fds[g] < 0 || (bots[b] = client_create()) == NULL){
+            break;
+        }
+
+        set_base_port(bots[b], port + (g + 1) * BENCH_FARM_PORT_STRIDE);
+        if(client_init(bots[b], IP_LOCALHOST) < 0 || (fds[b] = accept(listen_fds[g], NULL, NULL)) < 0 ||
+           io_engine_attach(engine, bots[b]) < 0){
+            client_destroy(bots[b]);
+            break;
+        }
+        n_attached++;
+    }
+    unsigned long long setup_allocs = atomic_load(&n_allocs) - allocs;
+
+    int ret = -1;
+    long long mesh_ns = 0, storm_ns = 0;
+    if(n_attached == n_bots){
+        pthread_t frontend;
+        pthread_create(&frontend, NULL, bench_farm_frontend, &farm);
+
+        long long new_game_ns = net_stats_now_ns();
+        for(int g = 0; g < n_games; g++){
+            bench_send_new_game(fds + g * n_clients, n_clients, RISING_TIDE);
+        }
+
+        ret = bench_await_all(fds, n_bots, P2P_READY);
+        mesh_ns = net_stats_now_ns() - new_game_ns;
+        if(ret == 0){
+            long long start_ns = net_stats_now_ns();
+            for(int b = 0; b < n_bots; b++){
+                conn_send(fds[b], START_GAME, "", 0);
+            }
+            ret = bench_await_all(fds, n_bots, FINISHED_GAME);
+            storm_ns = net_stats_now_ns() - start_ns;
+        }
+        pthread_join(frontend, NULL);
+    }else{
+        fprintf(stderr, "Failed to set up the bot farm (%d of %d bots attached)\n", n_attached, n_bots);
+    }
+
+    io_engine_destroy(engine);
+    for(int b = 0; b < n_attached; b++){
+        client_destroy(bots[b]);
+        close(fds[b]);
+    }
+    for(int g = 0; g < n_games; g++){
+        if(listen_fds[g] >= 0){ close(listen_fds[g]);}
+    }
+
+    unsigned long long total_lines = (unsigned long long) n_bots * (n_clients - 1) * n_lines;
+    printf("Bot farm (%d game sessions of %d clients, 1 process, 1 front-end thread, I/O engine with %s)\n", n_games,
+           n_clients, backend == IO_BACKEND_URING ? "io_uring" : "epoll");
+    printf("  %-34s %8.2f allocs/bot\n", "set up (create + init + attach)", (double) setup_allocs / n_bots);
+    printf("  %-34s %8.2f ms (as seen by the server)\n", "NEW_GAME -> all P2P_READY", mesh_ns / 1e6);
+    printf("  %-34s %8.0f lines/s (%llu lines, %d / %d bots ok)\n", "LINES_CLEARED storm",
+           storm_ns > 0 ? total_lines / (storm_ns / 1e9) : 0.0, total_lines, farm.n_ok, n_bots);
+
+    return ret == 0 && farm.n_ok == n_bots ? 0 : -1;
+}
+
+/* ------------------------- LINE DELIVERY ------------------------- */
+
+/* Reads the messages sent by a client to the stub game server until its FINISHED_GAME, counting the SCORE_UPDATE
+ * messages among them into n_updates. Returns the score carried by the last of them, or -1 if none (or on failure).
+ */
+static int bench_await_final_score(int fd, int* n_updates){
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    msg recvMsg = {.msg_type = EMPTY};
+    int score = -1;
+
+    for(*n_updates = 0; recvMsg.msg_type != FINISHED_GAME;){
+        if(!conn_has_msg(fd) && poll(&pfd, 1, BENCH_TIMEOUT_MS) <= 0){
+            return -1;
+        }
+
+        recvMsg = recv_msg(fd);
+        if(recvMsg.msg_type == INVALID){
+            return -1;
+        }else if(recvMsg.msg_type == SCORE_UPDATE){
+            score = msg_get_int(recvMsg);
+            (*n_updates)++;
+        }
+    }
+
+    return score;
+}
+
+/* Measures the latency with which a line cleared by one client is added to the board of another, sending one line at a
+ * time (and awaiting its delivery before the next): two clients within this process, attached to an I/O engine, join a
+ * game session of the stub game server listening on port, with the given P2P transport (see set_peer_transport) and
+ * fraction of datagrams dropped on purpose (see set_peer_datagram_loss). If in_flight is set, the lines are instead sent
+ * every BENCH_DELIVERY_GAP_US without awaiting delivery (such that many messages are awaiting acknowledgement while some
+ * are retransmitted), and the time until all of them were added is measured. Returns 0 if every line was delivered.
+ */
+static int bench_delivery(int port, int transport, int loss_permille, int in_flight, const char* label){
+    int listen_fd = bench_listen(port), fds[2], n_ready = 0, n_delivered = 0, n_joined = 0;
+    client_ctx* bots[2] = {client_create(), client_create()};
+    io_engine* engine = io_engine_create(IO_BACKEND_EPOLL, 2);
+    static net_histogram latency; // zero-initialised
+    net_histogram_reset(&latency);
+    set_net_stats_enabled(1);
+
+    for(int b = 0; b < 2 && listen_fd >= 0 && engine != NULL && bots[b] != NULL; b++){
+        set_base_port(bots[b], port);
+        set_peer_transport(bots[b], transport);
+        set_peer_datagram_loss(bots[b], loss_permille);
+        if(client_init(bots[b], IP_LOCALHOST) < 0 || (fds[b] = accept(listen_fd, NULL, NULL)) < 0 ||
+           io_engine_attach(engine, bots[b]) < 0){
+            break;
+        }
+        n_ready++;
+    }
+
+    if(n_ready == 2){
+        bench_send_new_game(fds, 2, RISING_TIDE);
+        long long deadline_ns = net_stats_now_ns() + BENCH_TIMEOUT_MS * 1000000LL;
+        while(n_joined < 2 && net_stats_now_ns() < deadline_ns){
+            for(int b = 0; b < 2; b++){
+                msg recvMsg = dequeue_server_msg(bots[b]);
+                if(recvMsg.msg_type == NEW_GAME){
+                    n_joined += handle_new_game_msg(bots[b], recvMsg) == 0;
+                }
+                msg_release(bots[b], &recvMsg);
+            }
+            usleep(100);
+        }
+
+        // wait for the mesh, and then (if sent as datagrams) for the datagrams to be found to get through both ways
+        peer_link_info info = {0};
+        if(n_joined == 2 && bench_await_all(fds, 2, P2P_READY) == 0){
+            while(transport == PEER_TRANSPORT_DATAGRAM && !info.datagram && net_stats_now_ns() < deadline_ns){
+                get_peer_link_info(bots[0], 0, &info);
+                usleep(100);
+            }
+
+            long long first_sent_ns = net_stats_now_ns();
+            for(int i = 0; in_flight && (n_delivered < BENCH_DELIVERY_LINES || i < BENCH_DELIVERY_LINES) &&
+                           net_stats_now_ns() - first_sent_ns < BENCH_TIMEOUT_MS * 1000000LL; i++){
+                if(i < BENCH_DELIVERY_LINES){
+                    send_cleared_lines(bots[0], 1);
+                    usleep(BENCH_DELIVERY_GAP_US);
+                }
+                int n_lines = get_lines_to_add(bots[1]);
+                n_delivered += n_lines > 0 ? n_lines : 0;
+            }
+            if(in_flight){
+                net_histogram_record(&latency, net_stats_now_ns() - first_sent_ns);
+            }
+
+            for(int i = 0; !in_flight && i < BENCH_DELIVERY_LINES; i++){
+                long long sent_ns = net_stats_now_ns();
+                int n_lines = 0;
+                send_cleared_lines(bots[0], 1);
+                while((n_lines = get_lines_to_add(bots[1])) <= 0 && net_stats_now_ns() - sent_ns < BENCH_TIMEOUT_MS * 1000000LL);
+                if(n_lines > 0){
+                    net_histogram_record(&latency, net_stats_now_ns() - sent_ns);
+                    n_delivered++;
+                }
+            }
+        }
+    }
+
+    net_stats stats = {0};
+    if(n_ready == 2){
+        get_net_stats(bots[0], &stats);
+        for(int b = 0; b < 2; b++){ end_game(bots[b]);}
+    }
+    io_engine_destroy(engine);
+    for(int b = 0; b < 2; b++){
+        client_destroy(bots[b]);
+        if(b < n_ready){ close(fds[b]);}
+    }
+    if(listen_fd >= 0){ close(listen_fd);}
+    set_net_stats_enabled(0);
+
+    char row[64];
+    snprintf(row, sizeof(row), "%s (%llu resent)", label, stats.peer_retransmits);
+    if(in_flight){
+        net_latency_stats total;
+        net_histogram_read(&latency, &total);
+        printf("  %-34s %8.2f ms until all added (%d / %d lines)\n", row, total.max_ns / 1e6, n_delivered,
+               BENCH_DELIVERY_LINES);
+    }else{
+        bench_print_latency(row, &latency);
+    }
+
+    return n_delivered == BENCH_DELIVERY_LINES ? 0 : -1;
+}
+
+/* ------------------------- SCORE UPDATES ------------------------- */
+
+// Threaded function reading messages from the server into the queue of the client instance arg (as a front-end would)
+// until bench_score_reader_stop is set, such that the score is published meanwhile (see set_score)
+static atomic_int bench_score_reader_stop;
+static void* bench_score_reader(void* arg){
+    while(!atomic_load(&bench_score_reader_stop)){
+        enqueue_server_msg(arg);
+    }
+
+    return NULL;
+}
+
+/* Changes the score of a client every BENCH_SCORE_PERIOD_US for BENCH_SCORE_MS (far more often than it is to be
+ * published, e.g. on every piece dropped), in a game session of the given type with no other client, joined from the
+ * stub game server listening on port. The client reads from the server in a thread of its own (enqueue_server_msg) or,
+ * if backend is not negative, is attached to an I/O engine with that backend. Reports the SCORE_UPDATE messages which
+ * reach the server; returns 0 if the score was published while the game was in progress (at most once per interval),
+ * and the final score reached the server.
+ */
+static int bench_score_updates(int port, int game_type, int backend, const char* label){
+    int listen_fd = bench_listen(port), fd = -1, n_scores = 0, n_updates = 0, final_score = -1, joined = 0;
+    client_ctx* ctx = client_create();
+    io_engine* engine = NULL;
+    pthread_t reader;
+    int reading = 0;
+
+    if(listen_fd >= 0 && ctx != NULL){
+        set_base_port(ctx, port);
+        set_server_msg_timeout(ctx, BENCH_READER_TIMEOUT_MS); // such that the reader thread is stopped promptly
+        if(client_init(ctx, IP_LOCALHOST) >= 0 && (fd = accept(listen_fd, NULL, NULL)) >= 0){
+            if(backend >= 0){
+                engine = io_engine_create(backend, 1);
+                reading = engine != NULL && io_engine_attach(engine, ctx) == 0;
+            }else{
+                atomic_store(&bench_score_reader_stop, 0);
+                reading = pthread_create(&reader, NULL, bench_score_reader, ctx) == 0;
+            }
+        }
+    }
+
+    if(reading){
+        bench_send_new_game(&fd, 1, game_type);
+        for(long long deadline_ns = net_stats_now_ns() + BENCH_TIMEOUT_MS * 1000000LL; !joined && net_stats_now_ns() < deadline_ns;){
+            msg recvMsg = dequeue_server_msg(ctx);
+            if(recvMsg.msg_type == NEW_GAME){
+                joined = handle_new_game_msg(ctx, recvMsg) == 0;
+            }
+            msg_release(ctx, &recvMsg);
+            usleep(100);
+        }
+
+        if(joined){
+            for(long long end_ns = net_stats_now_ns() + BENCH_SCORE_MS * 1000000LL; net_stats_now_ns() < end_ns;){
+                set_score(ctx, ++n_scores);
+                usleep(BENCH_SCORE_PERIOD_US);
+            }
+            end_game(ctx);
+            final_score = bench_await_final_score(fd, &n_updates);
+        }
+
+        if(engine == NULL){
+            atomic_store(&bench_score_reader_stop, 1);
+            pthread_join(reader, NULL);
+        }
+    }
+
+    io_engine_destroy(engine);
+    client_destroy(ctx);
+    if(fd >= 0){ close(fd);}
+    if(listen_fd >= 0){ close(listen_fd);}
+
+    // one update per interval elapsed (give or take one), and the final one sent by end_game
+    int max_updates = BENCH_SCORE_MS / SCORE_UPDATE_INTERVAL_MS + 2;
+    printf("  %-34s %d set_score calls in %d ms -> %d SCORE_UPDATE, final score %d / %d\n", label, n_scores,
+           BENCH_SCORE_MS, n_updates, final_score, n_scores);
+
+    return final_score == n_scores && n_updates >= 2 && n_updates <= max_updates ? 0 : -1;
+}
+
+/* ------------------------- MESSAGE MICRO-BENCHMARKS ------------------------- */
+
+typedef struct{
+    int fd;
+    int n_msgs;
+}bench_peer_args;
+
+// Sends n_msgs CHAT messages on the socket
+static void* bench_sender(void* arg){
+    bench_peer_args* args = arg;
+    msg chat_msg = {.msg_type = CHAT, .msg = "the quick brown fox jumps over the lazy dog"};
+
+    for(int i = 0; i < args->n_msgs; i++){
+        send_msg(chat_msg, args->fd);
+    }
+
+    return NULL;
+}
+
+// Sends n_msgs CHAT messages on the socket, followed by a START_GAME message
+static void* bench_flood_sender(void* arg){
+    bench_peer_args* args = arg;
+
+    bench_sender(args);
+    conn_send(args->fd, START_GAME, "", 0);
+
+    return NULL;
+}
+
+// Echoes n_msgs messages received on the socket back to the sender
+static void* bench_echo(void* arg){
+    bench_peer_args* args = arg;
+
+    for(int i = 0; i < args->n_msgs; i++){
+        msg recvMsg = recv_msg(args->fd);
+        if(recvMsg.msg_type == INVALID || send_msg(recvMsg, args->fd) < 0){
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+// Replies to every pair of messages received on the socket with a single message, n_msgs times
+static void* bench_pair_echo(void* arg){
+    bench_peer_args* args = arg;
+
+    for(int i = 0; i < args->n_msgs; i++){
+        msg recvMsg = recv_msg(args->fd);
+        if(recvMsg.msg_type == INVALID || recv_msg(args->fd).msg_type == INVALID || send_msg(recvMsg, args->fd) < 0){
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+// Prints the throughput and allocations per message of a micro-benchmark of n_msgs messages
+static void bench_print_throughput(const char* label, int n_msgs, long long elapsed_ns, unsigned long long allocs){
+    printf("  %-34s %10.0f msgs/s   %6.3f allocs/msg\n", label, n_msgs / (elapsed_ns / 1e9), (double) allocs / n_msgs);
+}
+
+/* Checks that binary frames whose payload is not laid out as described in protocol.h are rejected by recv_msg (rather
+ * than read out of bounds), i.e. integer types with a payload other than 4 bytes and strings not null-terminated, while
+ * well-formed frames are still accepted. Each frame is written to a fresh Unix domain socket pair.
+ */
+static void bench_malformed_frames(void){
+    static const unsigned char malformed[][6] = {
+        {LINES_CLEARED, 0}, {LINES_CLEARED, 2, 1, 0}, {PEER_PING, 3, 1, 0, 0}, {CHAT, 3, 'a', 'b', 'c'}, {NEW_GAME, 2, '1', ':'}
+    };
+    static const size_t malformed_lens[] = {2, 4, 5, 5, 4};
+    static const unsigned char valid_int[] = {LINES_CLEARED, 4, 3, 0, 0, 0}, valid_chat[] = {CHAT, 3, 'h', 'i', '\0'};
+    int n_malformed = sizeof(malformed_lens) / sizeof(malformed_lens[0]), n_rejected = 0, valid_ok = 1;
+
+    for(int i = 0; i < n_malformed + 2; i++){
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0){
+            return;
+        }
+
+        const unsigned char* frame = i < n_malformed ? malformed[i] : i == n_malformed ? valid_int : valid_chat;
+        size_t len = i < n_malformed ? malformed_lens[i] : i == n_malformed ? sizeof(valid_int) : sizeof(valid_chat);
+        if(write(fds[0], frame, len) == (ssize_t) len){
+            shutdown(fds[0], SHUT_WR); // such that a frame still awaiting bytes fails rather than blocks
+            msg recvMsg = recv_msg(fds[1]);
+            if(i < n_malformed){
+                n_rejected += recvMsg.msg_type == INVALID;
+            }else if(i == n_malformed){
+                valid_ok &= recvMsg.msg_type == LINES_CLEARED && msg_get_int(recvMsg) == 3;
+            }else{
+                valid_ok &= recvMsg.msg_type == CHAT && strcmp(recvMsg.msg, "hi") == 0;
+            }
+        }
+        conn_release(fds[1]); // the rejected frame is left in the receive buffer of the descriptor, to be reused
+        close(fds[0]); close(fds[1]);
+    }
+
+    printf("  %-34s %d / %d rejected, well-formed frames %s\n", "malformed binary frames", n_rejected, n_malformed,
+           valid_ok ? "accepted" : "NOT ACCEPTED");
+}
+
+/* Micro-benchmarks of send_msg and recv_msg over loopback TCP, or a Unix domain socket if local is set (as between
+ * clients on the same host, see set_local_transport): one-way throughput, and round-trip latency
+ */
+static void bench_send_recv(client_ctx* ctx, int n_msgs, int local){
+    int a, b, fds[2];
+    if(local ? socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0 : bench_socket_pair(ctx, &a, &b) < 0){
+        perror("Failed to open a loopback connection");
+        return;
+    }
+    if(local){
+        a = fds[0]; b = fds[1];
+    }
+
+    printf("send_msg / recv_msg (%s)\n", local ? "Unix domain socket" : "loopback TCP");
+
+    // throughput: a thread sends while we receive
+    pthread_t thread;
+    bench_peer_args args = {.fd = a, .n_msgs = n_msgs};
+    unsigned long long allocs = atomic_load(&n_allocs);
+    long long start_ns = net_stats_now_ns();
+
+    pthread_create(&thread, NULL, bench_sender, &args);
+    for(int i = 0; i < n_msgs; i++){
+        if(recv_msg(b).msg_type == INVALID){
+            break;
+        }
+    }
+    long long elapsed_ns = net_stats_now_ns() - start_ns;
+    pthread_join(thread, NULL);
+
+    bench_print_throughput("one-way throughput", n_msgs, elapsed_ns, atomic_load(&n_allocs) - allocs);
+
+    // latency: round trips through a thread echoing every message back
+    int n_trips = n_msgs / 10 > 0 ? n_msgs / 10 : 1;
+    static net_histogram rtt;
+    net_histogram_reset(&rtt);
+    args.fd = b; args.n_msgs = n_trips;
+    msg ping_msg = {.msg_type = CHAT, .msg = "ping"};
+
+    pthread_create(&thread, NULL, bench_echo, &args);
+    for(int i = 0; i < n_trips; i++){
+        long long sent_ns = net_stats_now_ns();
+        if(send_msg(ping_msg, a) < 0 || recv_msg(a).msg_type == INVALID){
+            break;
+        }
+        net_histogram_record(&rtt, net_stats_now_ns() - sent_ns);
+    }
+    pthread_join(thread, NULL);
+
+    bench_print_latency("round trip", &rtt);
+
+    close(a); close(b);
+
+    if(local){ // (framing is independent of the transport)
+        bench_malformed_frames();
+    }
+}
+
+/* Micro-benchmark of the socket profile (see set_socket_profile): round trips in which two small messages are sent back
+ * to back (as with a LINES_CLEARED message following another), and a single reply is awaited. Without TCP_NODELAY, the
+ * second message is held back by Nagle's algorithm until the first is acknowledged, which the receiver delays.
+ */
+static void bench_socket_profiles(client_ctx* ctx){
+    socket_profile profiles[3] = {{0}, socket_default_profile(), socket_default_profile()};
+    const char* labels[3] = {"no options", "default (TCP_NODELAY)", "default + TCP_QUICKACK"};
+    profiles[2].quick_ack = 1;
+
+    printf("Socket profile (2 small messages, 1 reply)\n");
+    for(int p = 0; p < 3; p++){
+        int a, b;
+        set_socket_profile(ctx, profiles[p]);
+        if(bench_socket_pair(ctx, &a, &b) < 0){
+            perror("Failed to open a loopback connection");
+            break;
+        }
+        socket_apply_profile(b, profiles + p); // client_connect only applies the profile to our end
+        conn_set_quick_ack(b, profiles[p].quick_ack);
+
+        static net_histogram rtt;
+        net_histogram_reset(&rtt);
+        pthread_t thread;
+        bench_peer_args args = {.fd = b, .n_msgs = BENCH_PROFILE_TRIPS};
+        msg lines_msg = {.msg_type = LINES_CLEARED, .msg = "1"};
+
+        pthread_create(&thread, NULL, bench_pair_echo, &args);
+        for(int i = 0; i < BENCH_PROFILE_TRIPS; i++){
+            long long sent_ns = net_stats_now_ns();
+            if(send_msg(lines_msg, a) < 0 || send_msg(lines_msg, a) < 0 || recv_msg(a).msg_type == INVALID){
+                break;
+            }
+            net_histogram_record(&rtt, net_stats_now_ns() - sent_ns);
+        }
+        pthread_join(thread, NULL);
+
+        bench_print_latency(labels[p], &rtt);
+        close(a); close(b);
+    }
+
+    set_socket_profile(ctx, socket_default_profile());
+}
+
+/* Micro-benchmark of enqueue_server_msg (followed by dequeue_server_msg and msg_release, as a front-end would), with
+ * messages streamed by a stub server listening on port, followed by a flood of CHAT messages ending in a START_GAME
+ * (enqueued without dequeuing any, as by a front-end busy elsewhere) which must not be held back by the CHAT messages.
+ * Expects client_init not to have been called yet on the instance.
+ */
+static void bench_enqueue(client_ctx* ctx, int n_msgs, int port){
+    int listen_fd = bench_listen(port);
+    set_base_port(ctx, port);
+    if(listen_fd < 0 || client_init(ctx, IP_LOCALHOST) < 0){
+        perror("Failed to connect to the stub game server");
+        return;
+    }
+
+    int fd = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+
+    pthread_t thread;
+    bench_peer_args args = {.fd = fd, .n_msgs = n_msgs};
+    unsigned long long allocs = atomic_load(&n_allocs);
+    long long start_ns = net_stats_now_ns();
+
+    pthread_create(&thread, NULL, bench_sender, &args);
+    for(int i = 0; i < n_msgs;){
+        msg recvMsg = enqueue_server_msg(ctx);
+        if(recvMsg.msg_type == INVALID){
+            break;
+        }else if(recvMsg.msg_type == EMPTY){
+            continue;
+        }
+
+        recvMsg = dequeue_server_msg(ctx);
+        msg_release(ctx, &recvMsg);
+        i++;
+    }
+    long long elapsed_ns = net_stats_now_ns() - start_ns;
+    pthread_join(thread, NULL);
+
+    printf("enqueue_server_msg (loopback)\n");
+    bench_print_throughput("enqueue + dequeue + release", n_msgs, elapsed_ns, atomic_load(&n_allocs) - allocs);
+
+    start_ns = net_stats_now_ns();
+    pthread_create(&thread, NULL, bench_flood_sender, &args);
+    msg recvMsg = {.msg_type = EMPTY};
+    while(recvMsg.msg_type != START_GAME && recvMsg.msg_type != INVALID){
+        recvMsg = enqueue_server_msg(ctx);
+    }
+    elapsed_ns = net_stats_now_ns() - start_ns;
+    pthread_join(thread, NULL);
+
+    recvMsg = dequeue_server_msg(ctx);
+    int first_type = recvMsg.msg_type, n_chats = 0;
+    do{
+        msg_release(ctx, &recvMsg);
+        recvMsg = dequeue_server_msg(ctx);
+        n_chats += recvMsg.msg_type == CHAT;
+    }while(recvMsg.msg_type != EMPTY);
+
+    printf("  %-34s %8.2f ms, %s dequeued first, %d CHAT kept (%d dropped)\n", "START_GAME behind CHAT flood",
+           elapsed_ns / 1e6, first_type == START_GAME ? "START_GAME" : "FAILED,", n_chats, n_msgs - n_chats);
+
+    close(fd);
+}
+
+/* ------------------------- GETTER MICRO-BENCHMARKS ------------------------- */
+
+static atomic_int contender_running;
+
+// Updates the game state counters of the client instance arg as the P2P event loop and the front-end would, until told
+// to stop
+static void* bench_contender(void* arg){
+    while(atomic_load_explicit(&contender_running, memory_order_relaxed)){
+        atomic_fetch_add(&get_game_session(arg)->n_lines_to_add, 1);
+        set_score(arg, 1);
+    }
+
+    return NULL;
+}
+
+// Times BENCH_GETTER_OPS calls of each getter, printing the mean latency per call
+static void bench_time_getters(client_ctx* ctx, const char* label){
+    long long start_ns = net_stats_now_ns();
+    for(int i = 0; i < BENCH_GETTER_OPS; i++){
+        get_score(ctx);
+    }
+    long long score_ns = net_stats_now_ns() - start_ns;
+
+    start_ns = net_stats_now_ns();
+    for(int i = 0; i < BENCH_GETTER_OPS; i++){
+        get_lines_to_add(ctx);
+    }
+    long long lines_ns = net_stats_now_ns() - start_ns;
+
+    printf("  %-34s get_score %6.2f ns/op   get_lines_to_add %6.2f ns/op\n", label,
+           (double) score_ns / BENCH_GETTER_OPS, (double) lines_ns / BENCH_GETTER_OPS);
+}
+
+static void bench_getters(client_ctx* ctx){
+    atomic_store(&get_game_session(ctx)->game_in_progress, 1); // the getters only report while in a game session
+
+    printf("Game state getters\n");
+    bench_time_getters(ctx, "uncontended");
+
+    pthread_t thread;
+    atomic_store(&contender_running, 1);
+    pthread_create(&thread, NULL, bench_contender, ctx);
+    bench_time_getters(ctx, "contended (1 updating thread)");
+    atomic_store(&contender_running, 0);
+    pthread_join(thread, NULL);
+
+    atomic_store(&get_game_session(ctx)->game_in_progress, 0);
+}
+
+/* ------------------------- NEW_GAME PARSER ------------------------- */
+
+// Malformed NEW_GAME messages, each of which must be rejected by parse_new_game_msg
+static const char* bench_malformed_msgs[] = {
+    "", "0", "0::0::10::0::1234", "0::0::10::0::1234::1", "0::0::10::0::1234::1::", "0::0::10::0:1234::1::127.0.0.1",
+    "0:::0::10::0::1234::1::127.0.0.1", "0::0::10::0::1234::1::127.0.0.1::", "0::0::10::0::1234::1::127.0.0.1::::127.0.0.2",
+    "x::0::10::0::1234::1::127.0.0.1", "0::0::10::0::99999999999::1::127.0.0.1", "0::0::10::0::1234::0::127.0.0.1",
+    "7::0::10::0::1234::1::127.0.0.1", "0::0::10::0::1234::1::127.0.0.1:8080", "0::0::10::0::1234::1::1270.0.0.1",
+    "0::0::10::0::1234::1::255.255.255.2555", "0::0::10::0::1234::1::127.0.0.1::localhost", "0::-::10::0::1234::1::127.0.0.1"
+};
+
+// Returns 1 if the game session decoded by a successful call to parse_new_game_msg is consistent, else 0
+static int bench_session_consistent(client_ctx* ctx){
+    game_session* session = get_game_session(ctx);
+    struct in_addr addr;
+    for(int i = 0; i < session->n_players; i++){
+        if(i >= session->peers.capacity || session->peers.slot[i] == session->slot ||
+           inet_pton(AF_INET, session->peers.ip[i], &addr) != 1){
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Times parse_new_game_msg on a NEW_GAME message listing BENCH_PARSE_PLAYERS clients, then checks that each message in
+ * bench_malformed_msgs is rejected, and lastly parses randomly mutated copies of the message, checking that every message
+ * accepted decodes into a consistent game session.
+ */
+static void bench_parser(client_ctx* ctx){
+    set_session_capacity(ctx, N_SESSION_PLAYERS); // if the table of clients is not yet allocated
+
+    char valid[MSG_MAX_LEN], data[MSG_MAX_LEN];
+    int len = snprintf(valid, sizeof(valid), "%d::0::10::0::1234::3", RISING_TIDE);
+    for(int i = 0; i < BENCH_PARSE_PLAYERS; i++){
+        len += snprintf(valid + len, sizeof(valid) - len, "::192.168.%d.%d", i, 100 + i);
+    }
+
+    msg new_game_msg = {.msg_type = NEW_GAME, .msg = valid};
+    unsigned long long allocs = atomic_load(&n_allocs);
+    long long start_ns = net_stats_now_ns();
+    for(int i = 0; i < BENCH_PARSE_OPS; i++){
+        parse_new_game_msg(ctx, new_game_msg);
+    }
+    long long elapsed_ns = net_stats_now_ns() - start_ns;
+
+    printf("NEW_GAME parser\n");
+    printf("  %-34s %8.2f ns/msg   %6.3f allocs/msg   (%d clients, %s)\n", "parse_new_game_msg",
+           (double) elapsed_ns / BENCH_PARSE_OPS, (double) (atomic_load(&n_allocs) - allocs) / BENCH_PARSE_OPS,
+           BENCH_PARSE_PLAYERS, parse_new_game_msg(ctx, new_game_msg) == 0 && bench_session_consistent(ctx) ? "ok" : "FAILED");
+
+    int n_malformed = sizeof(bench_malformed_msgs) / sizeof(bench_malformed_msgs[0]), n_rejected = 0;
+    for(int i = 0; i < n_malformed; i++){
+        new_game_msg.msg = strcpy(data, bench_malformed_msgs[i]);
+        n_rejected += parse_new_game_msg(ctx, new_game_msg) < 0 && get_game_session(ctx)->n_players == 0;
+    }
+    printf("  %-34s %d / %d rejected\n", "malformed messages", n_rejected, n_malformed);
+
+    // fuzz: overwrite a few random bytes of the message with characters likely to confuse the parser (or truncate it)
+    static const char fuzz_chars[] = "0123456789.:-x";
+    unsigned int seed = 0x5eed;
+    int n_accepted = 0, n_inconsistent = 0;
+    for(int i = 0; i < BENCH_FUZZ_CASES; i++){
+        memcpy(data, valid, len + 1);
+        for(int n_mutations = 1 + rand_r(&seed) % 4; n_mutations > 0; n_mutations--){
+            int pos = rand_r(&seed) % len, c = rand_r(&seed) % sizeof(fuzz_chars); // c = sizeof(..) - 1 truncates
+            data[pos] = fuzz_chars[c];
+        }
+
+        new_game_msg.msg = data;
+        if(parse_new_game_msg(ctx, new_game_msg) == 0){
+            n_accepted++;
+            n_inconsistent += !bench_session_consistent(ctx);
+        }
+    }
+    printf("  %-34s %d cases, %d accepted, %d inconsistent\n", "fuzzed messages", BENCH_FUZZ_CASES, n_accepted, n_inconsistent);
+}
+
+int main(int argc, char* argv[]){
+    int n_clients = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_CLIENTS;
+    int n_lines = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_LINES;
+    int n_msgs = argc > 3 ? atoi(argv[3]) : BENCH_DEFAULT_MSGS;
+    int port = argc > 4 ? atoi(argv[4]) : BENCH_DEFAULT_PORT;
+    const char* io = argc > 5 ? argv[5] : "threads";
+    bench_io_backend = strcmp(io, "epoll") == 0 ? IO_BACKEND_EPOLL : strcmp(io, "uring") == 0 ? IO_BACKEND_URING : -1;
+
+    if(n_clients < 2 || n_clients >= BENCH_FARM_PORT_STRIDE || n_lines < 1 || n_msgs < 1 ||
+       (bench_io_backend < 0 && strcmp(io, "threads") != 0)){
+        fprintf(stderr, "Usage: %s [n_clients >= 2] [n_lines >= 1] [n_msgs >= 1] [base_port] [threads | epoll | uring]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // the lifecycle is run first, since the simulated clients are forked (and need not inherit any other state)
+    int ret = bench_lifecycle(n_clients, n_lines, port);
+    ret |= bench_bot_farm(n_clients, n_lines, port);
+
+    printf("Line delivery (2 clients, one line at a time, I/O engine with epoll)\n");
+    int delivery_port = port + (BENCH_FARM_GAMES + 1) * BENCH_FARM_PORT_STRIDE;
+    ret |= bench_delivery(delivery_port, PEER_TRANSPORT_STREAM, 0, 0, "P2P connection");
+    ret |= bench_delivery(delivery_port + BENCH_FARM_PORT_STRIDE, PEER_TRANSPORT_DATAGRAM, 0, 0, "datagrams");
+    ret |= bench_delivery(delivery_port + 2 * BENCH_FARM_PORT_STRIDE, PEER_TRANSPORT_DATAGRAM, BENCH_DELIVERY_LOSS, 0,
+                          "datagrams, 5% loss");
+    printf("Line delivery (2 clients, a line every %d us with many in flight, I/O engine with epoll)\n",
+           BENCH_DELIVERY_GAP_US);
+    ret |= bench_delivery(delivery_port + 3 * BENCH_FARM_PORT_STRIDE, PEER_TRANSPORT_DATAGRAM, BENCH_DELIVERY_LOSS, 1,
+                          "datagrams, 5% loss");
+
+    printf("Score updates (1 client, score changed every %d us, at most 1 SCORE_UPDATE per %d ms)\n",
+           BENCH_SCORE_PERIOD_US, SCORE_UPDATE_INTERVAL_MS);
+    int score_port = delivery_port + 4 * BENCH_FARM_PORT_STRIDE;
+    ret |= bench_score_updates(score_port, CHILL, -1, "CHILL, reader thread");
+    ret |= bench_score_updates(score_port + BENCH_FARM_PORT_STRIDE, CHILL, IO_BACKEND_EPOLL, "CHILL, I/O engine");
+    ret |= bench_score_updates(score_port + 2 * BENCH_FARM_PORT_STRIDE, RISING_TIDE, IO_BACKEND_EPOLL,
+                               "RISING_TIDE, I/O engine");
+
+    client_ctx* ctx = client_create();
+    if(ctx == NULL){
+        return EXIT_FAILURE;
+    }
+    bench_send_recv(ctx, n_msgs, 0);
+    bench_send_recv(ctx, n_msgs, 1);
+    bench_socket_profiles(ctx);
+    bench_enqueue(ctx, n_msgs, port);
+    bench_getters(ctx);
+    bench_parser(ctx);
+    client_destroy(ctx);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
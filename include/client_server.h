@@ -7,42 +7,85 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <netdb.h>
-#include <math.h>
 #include <time.h>
+#include <stdatomic.h>
+#include "protocol.h"
+#include "peer_connect.h"
+#include "socket_profile.h"
+#include "net_stats.h"
 
 #ifndef CPS2008_TETRIS_CLIENT_CLIENT_H
 #define CPS2008_TETRIS_CLIENT_CLIENT_H
 
 // NETWORKING CONFIG
-#define PORT 8080
+#define PORT 8080 // default base port (see set_base_port)
 #define SDOMAIN AF_INET // or AF_INET6, correspondingly using netinet/in.h
 #define IP_LOCALHOST "127.0.0.1" //"192.168.68.127"
 #define TYPE SOCK_STREAM
-#define MSG_LEN_DIGITS 4
-#define HEADER_SIZE (MSG_LEN_DIGITS + 6) // '<msg_len>::<msg_type>::\0' where msg_len is of size MSG_LEN_DIGITS chars and msg_type is 1 char
-#define MSG_BUFFER_SIZE 40
+#define LOCAL_P2P_NAME "cps2008_tetris_p2p:%d" // abstract Unix domain socket on which local P2P connections are accepted, by port
+#define MSG_BUFFER_SIZE 40 // default capacity of the FIFO queue of (session control) messages received from the server
+#define CHAT_BUFFER_SIZE 16 // default capacity of the queue of CHAT messages received from the server (see set_server_chat_capacity)
+#define MSG_POOL_SPARE 8 // pooled buffers beyond the queue capacities, for messages dequeued but not yet released
+#define SERVER_MSG_TIMEOUT_MS 5000 // default time for which enqueue_server_msg waits for data (see set_server_msg_timeout)
 
 // GAME SESSION CONFIGS
-#define N_SESSION_PLAYERS 8
+#define SESSION_CACHE_LINE 64 // alignment of the game state counters, such that each is on a cache line of its own
+#define N_SESSION_PLAYERS 8 // default capacity of the table of clients in a game session (see set_session_capacity)
+#define HEARTBEAT_INTERVAL_MS 100 // default interval at which clients in a game session are pinged (see set_peer_heartbeat)
+#define HEARTBEAT_MAX_MISSED 3 // default number of intervals without hearing from a client after which it is deemed dead
+#define SCORE_UPDATE_INTERVAL_MS 250 // default minimum interval between live SCORE_UPDATE messages (see set_score_update_interval)
+#define DGRAM_LINGER_MS 250 // time for which end_game waits for the messages sent as datagrams to be acknowledged
 
 // STRUCTS
+/* Table of the other clients (players) in a game session, laid out as a struct of arrays within a single allocation, i.e.
+ * the entry of the client at index i is made up of field[i] of each array. Sweeps across the clients over some field
+ * (e.g. the state) hence touch contiguous memory, rather than chasing a separately allocated struct per client. The
+ * capacity is set through set_session_capacity, and is grown as required by the clients listed in a NEW_GAME message.
+ */
 typedef struct{
-    char ip[INET_ADDRSTRLEN];
-    int port;
-    int client_fd;
-    int server_fd;
+    int capacity; // number of entries for which the arrays are allocated
+    char (*ip)[INET_ADDRSTRLEN];
+    int* port;
+    int* client_fd;
+    int* server_fd;
+    int* state;
+    int* peer_caps; // capabilities advertised by the client in its PEER_HELLO (see enum PeerCapability)
+    int* slot; // session slot (port block offset) of the client, by which it identifies itself in the P2P handshake
+    int* link_flags; // directions of the P2P connection confirmed by the handshake (see enum LinkFlag)
+    int* link_failure; // reason for which the P2P connection failed, if it did (see enum LinkFailure)
+    int* dial_pending; // set if we must (still) connect to the client, having initially left it to connect to us
+    int* local; // set if the client is on this host, and hence connected to over a Unix domain socket (see set_local_transport)
+    int* rtt_us; // smoothed round-trip time of the connection, from PEER_PING/PEER_PONG (0 until measured)
+    int* rtt_var_us; // smoothed mean deviation of the round-trip time, i.e. its jitter
+    long long* last_heard_ms; // monotonic time at which a message was last received from the client (see set_peer_heartbeat)
+    atomic_int* pending_lines; // cleared lines not yet sent to the client (see send_cleared_lines)
+    struct dgram_link* dgram; // link over which in-game messages are sent to the client as datagrams (see set_peer_transport)
+    void* block; // the single allocation holding all of the above arrays, as well as the mutex of each client
+}peer_table;
+
+typedef struct{
+    int slot;
     int state;
-}ingame_client;
+    int link_flags;
+    int link_failure;
+    int rtt_us; // smoothed round-trip time (0 if not yet measured, e.g. if the client does not support heartbeats)
+    int rtt_var_us; // jitter, i.e. smoothed mean deviation of the round-trip time
+    int datagram; // set if in-game messages are sent to the client as datagrams (see set_peer_transport)
+}peer_link_info;
 
 typedef struct{
-    ingame_client* players[N_SESSION_PLAYERS];
+    peer_table peers; // the other clients in the game session, of which there are n_players
     time_t start_time;
     int p2p_fd;
-    int score;
-    int game_in_progress;
-    int n_lines_to_add;
-    int total_lines_cleared;
-    int game_type;
+    int slot; // session slot (port block offset) of this client
+    int p2p_ready; // set once P2P_READY has been sent to the server, i.e. once the P2P mesh has been set up
+    // game state counters, accessed without locking (each on a cache line of its own, such that the front-end reading
+    // and writing the score never contends with the P2P event loop adding lines to n_lines_to_add, and vice versa)
+    _Alignas(SESSION_CACHE_LINE) atomic_int score;
+    _Alignas(SESSION_CACHE_LINE) atomic_int game_in_progress;
+    _Alignas(SESSION_CACHE_LINE) atomic_int n_lines_to_add;
+    _Alignas(SESSION_CACHE_LINE) atomic_int total_lines_cleared;
+    _Alignas(SESSION_CACHE_LINE) int game_type;
     int n_players;
     int n_baselines;
     int n_winlines;
@@ -50,46 +93,79 @@ typedef struct{
     int seed;
 }game_session;
 
-typedef struct{
-    int msg_type;
-    char* msg;
-}msg;
+/* Opaque handle to a client instance, i.e. one client of the game server, created by client_create and passed to every
+ * library function. Instances share no state, such that any number of them (e.g. simulated clients) may run within one
+ * process, each with its own threads, or attached to a shared I/O engine (see io_engine_create).
+ */
+typedef struct client_ctx client_ctx;
+
+// Opaque handle to a library-managed I/O engine, running a single event loop for any number of client instances
+typedef struct io_engine io_engine;
 
 // FUNC DEFNS
-int end_game();
-int get_score();
-int get_lines_to_add();
-int client_init(char* ip);
-int client_connect(char ip[INET_ADDRSTRLEN], int port);
-int signalGameTermination();
+client_ctx* client_create();
+void client_destroy(client_ctx* ctx);
+int end_game(client_ctx* ctx);
+int get_score(client_ctx* ctx);
+int get_lines_to_add(client_ctx* ctx);
+int get_server_fd(client_ctx* ctx);
+game_session* get_game_session(client_ctx* ctx);
+int client_init(client_ctx* ctx, char* ip);
+int set_session_capacity(client_ctx* ctx, int capacity);
+int client_connect(client_ctx* ctx, char ip[INET_ADDRSTRLEN], int port);
+int signalGameTermination(client_ctx* ctx);
 int send_msg(msg sendMsg, int socket_fd);
-msg dequeue_server_msg();
+msg dequeue_server_msg(client_ctx* ctx);
 msg recv_msg(int socket_fd);
-msg enqueue_server_msg(int socket_fd);
-void* accept_peer_connections(void* arg);
-void* service_peer_connections(void* arg);
-void set_score(int score);
-void send_cleared_lines(int n_cleared_lines);
-void handle_new_game_msg(msg recvMsg);
+msg enqueue_server_msg(client_ctx* ctx);
+void msg_release(client_ctx* ctx, msg* releaseMsg);
+void* accept_peer_connections(void* ctx);
+void* service_peer_connections(void* ctx);
+void set_score(client_ctx* ctx, int score);
+void send_cleared_lines(client_ctx* ctx, int n_cleared_lines);
+void set_base_port(client_ctx* ctx, int port);
+void set_server_msg_capacity(client_ctx* ctx, int capacity);
+void set_server_chat_capacity(client_ctx* ctx, int capacity);
+void set_server_msg_timeout(client_ctx* ctx, int timeout_ms);
+void set_binary_protocol(client_ctx* ctx, int enabled);
+void set_single_peer_socket(client_ctx* ctx, int enabled);
+void set_peer_connect_options(client_ctx* ctx, connect_options opts);
+void set_socket_profile(client_ctx* ctx, socket_profile profile);
+void set_local_transport(client_ctx* ctx, int mode);
+void set_peer_heartbeat(client_ctx* ctx, int interval_ms, int max_missed);
+void set_score_update_interval(client_ctx* ctx, int interval_ms);
+void set_peer_transport(client_ctx* ctx, int transport);
+void set_peer_datagram_loss(client_ctx* ctx, int loss_permille);
+void set_peer_connected_callback(client_ctx* ctx, void (*callback)(int player_idx, int connected, void* arg), void* arg);
+void set_event_callback(client_ctx* ctx, void (*callback)(int event, void* arg), void* arg);
+int get_event_fd(client_ctx* ctx);
+int take_events(client_ctx* ctx);
+void negotiate_peer_format(client_ctx* ctx, int i);
+int get_peer_link_info(client_ctx* ctx, int player_idx, peer_link_info* info);
+int is_mesh_complete(client_ctx* ctx);
+io_engine* io_engine_create(int backend, int max_clients);
+int io_engine_attach(io_engine* engine, client_ctx* ctx);
+void io_engine_destroy(io_engine* engine);
+int get_net_stats(client_ctx* ctx, net_stats* stats);
+void reset_net_stats(client_ctx* ctx);
+int handle_new_game_msg(client_ctx* ctx, msg recvMsg);
+int parse_new_game_msg(client_ctx* ctx, msg recvMsg);
 void red();
 void reset();
 void yellow();
 void mrerror(char* err_msg);
 void smrerror(char* err_msg);
 
-// GLOBALS
-msg recv_server_msgs[MSG_BUFFER_SIZE];
-int n_server_msgs = 0;
-pthread_mutex_t threadMutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t gameMutex;
-pthread_mutex_t clientMutexes[N_SESSION_PLAYERS];
-
-int server_fd;
-game_session gameSession;
-
-enum MsgType {INVALID = -2, EMPTY = -1, CHAT = 0, SCORE_UPDATE = 1, NEW_GAME = 2, FINISHED_GAME = 3, P2P_READY = 4,
-              CLIENTS_CONNECTED = 5, START_GAME = 6, LINES_CLEARED = 7};
 enum GameType {RISING_TIDE = 0, FAST_TRACK = 1, BOOMER = 2, CHILL = 3};
 enum State {WAITING = 0, CONNECTED = 1, FINISHED = 2, DISCONNECTED = 3};
+// Events of which the front-end is notified (see get_event_fd, take_events and set_event_callback), as a bitmask
+enum ClientEvent {EVENT_SERVER_MSG = 1, EVENT_LINES_INCOMING = 2, EVENT_PEER_STATE = 4, EVENT_GAME_STARTED = 8,
+                  EVENT_GAME_FINISHED = 16};
+enum LocalTransport {LOCAL_TRANSPORT_NONE = 0, LOCAL_TRANSPORT_LOOPBACK = 1, LOCAL_TRANSPORT_SAME_IP = 2};
+enum PeerTransport {PEER_TRANSPORT_STREAM = 0, PEER_TRANSPORT_DATAGRAM = 1};
+enum IoBackend {IO_BACKEND_EPOLL = 0, IO_BACKEND_URING = 1};
+enum LinkFlag {LINK_OUTBOUND = 1, LINK_INBOUND = 2, LINK_BOTH = 3};
+enum LinkFailure {LINK_NO_FAILURE = 0, LINK_CONNECT_FAILED = 1, LINK_HANDSHAKE_TIMEOUT = 2, LINK_PEER_CLOSED = 3,
+                  LINK_PROTOCOL_ERROR = 4, LINK_HEARTBEAT_TIMEOUT = 5, LINK_SESSION_ENDED = 6};
 
 #endif //CPS2008_TETRIS_CLIENT_CLIENT_H
@@ -0,0 +1,55 @@
+#include <stddef.h>
+#include "protocol.h"
+#include "reactor.h"
+#include "net_stats.h"
+#include "uring.h"
+
+#ifndef CPS2008_TETRIS_CLIENT_CONNECTION_H
+#define CPS2008_TETRIS_CLIENT_CONNECTION_H
+
+#define CONN_CHUNK_SIZE 256 // number of connection entries allocated at a time
+#define CONN_MAX_CHUNKS 4096 // hence supporting file descriptors up to CONN_CHUNK_SIZE * CONN_MAX_CHUNKS - 1
+#define CONN_RECV_BUFFER_SIZE 4096 // initial size of the per-socket receive buffer
+#define CONN_SEND_BUFFER_SIZE 256 // initial size of the per-socket send buffer
+
+/* Per-socket state, indexed by file descriptor. In particular, each socket has a receive buffer into which we read as
+ * many bytes as are available with a single call to recv, such that multiple framed messages may then be decoded without
+ * further system calls. Bytes in [start, end) have been received but not yet decoded.
+ *
+ * Messages may also be queued in a send buffer (see conn_queue_int) and then written out together by conn_flush, without
+ * ever blocking; bytes in [out_start, out_end) have been queued but not yet sent.
+ *
+ * A socket is expected to be read by at most one thread at a time, and likewise for its send buffer.
+ */
+typedef struct{
+    char* buffer;
+    size_t capacity;
+    size_t start;
+    size_t end;
+    char* out_buffer;
+    size_t out_capacity;
+    size_t out_start;
+    size_t out_end;
+    int format; // format in which messages are sent on this socket (MSG_FORMAT_ASCII or MSG_FORMAT_BINARY)
+    int quick_ack; // set if TCP_QUICKACK is to be re-armed after every read (see conn_set_quick_ack)
+    reactor_source source; // registration of the socket with a reactor, if any
+    net_counters counters; // instrumentation of the socket (see net_stats.h), only updated while enabled
+}connection;
+
+// FUNC DEFNS
+int conn_read_msg(int socket_fd, msg* recvMsg);
+int conn_poll_msg(int socket_fd, msg* recvMsg);
+int conn_has_msg(int socket_fd);
+int conn_send(int socket_fd, int msg_type, const char* data, size_t data_len);
+int conn_send_int(int socket_fd, int msg_type, int value);
+int conn_queue_int(int socket_fd, int msg_type, int value);
+int conn_flush(int socket_fd, int wait);
+int conn_flush_batch(uring* u, const int* fds, int n_fds, int* results);
+int conn_has_queued(int socket_fd);
+int msg_get_int(msg recvMsg);
+void conn_release(int socket_fd);
+void conn_set_format(int socket_fd, int format);
+void conn_set_quick_ack(int socket_fd, int enabled);
+connection* conn_get(int socket_fd);
+
+#endif //CPS2008_TETRIS_CLIENT_CONNECTION_H
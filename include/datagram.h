@@ -0,0 +1,86 @@
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include "protocol.h"
+
+#ifndef CPS2008_TETRIS_CLIENT_DATAGRAM_H
+#define CPS2008_TETRIS_CLIENT_DATAGRAM_H
+
+#define DGRAM_MAGIC 0xD7 // first byte of every datagram, such that stray datagrams are discarded
+#define DGRAM_HEADER_SIZE 20
+#define DGRAM_MAX_SIZE 64 // header and a single binary frame carrying an integer (see protocol.h)
+#define DGRAM_WINDOW 32 // span of sequence numbers which may be in flight to a peer (at most the bits of ack_bits)
+#define DGRAM_INITIAL_RTO_MS 20 // retransmission timeout until the round-trip time has been measured
+#define DGRAM_MIN_RTO_MS 5
+#define DGRAM_MAX_RTO_MS 200 // bound on the (exponentially backed off) retransmission timeout
+#define DGRAM_PROBE_MS 10 // initial interval at which a peer is probed until datagrams get through both ways (backed off)
+
+// STRUCTS
+// Message sent to a peer but not yet acknowledged (free if seq is 0)
+typedef struct{
+    unsigned int seq;
+    int msg_type;
+    int value;
+    int retransmits;
+    long long sent_ns; // time at which the message was first sent
+    long long due_ns; // time at which the message is to be retransmitted, unless acknowledged by then
+}dgram_pending;
+
+/* State of the reliable datagram link with one peer. Every message carries a sequence number, and every datagram
+ * (whether carrying a message or not) acknowledges the highest sequence number received from the peer along with a
+ * bitmap of the DGRAM_WINDOW before it, such that acknowledgements ride on later datagrams and a single datagram
+ * acknowledges any number of messages. Messages are retransmitted until acknowledged, and delivered as soon as they
+ * arrive (duplicates being suppressed), i.e. in no particular order: a lost message delays no other message.
+ */
+typedef struct dgram_link{
+    struct sockaddr_in addr; // address of the datagram socket of the peer
+    unsigned int next_seq; // sequence number of the next message sent (from 1)
+    unsigned int recv_seq; // highest sequence number received from the peer (0 if none)
+    unsigned int recv_bits; // bit k set if recv_seq - 1 - k has also been received
+    int heard; // set once a datagram has been received from the peer
+    int confirmed; // set once the peer has heard from us, i.e. once datagrams get through in both directions
+    int ack_pending; // set if the peer is owed an acknowledgement (see dgram_send_ack)
+    int n_pending; // messages not yet acknowledged
+    int srtt_us; // smoothed round-trip time (0 until measured), from which the retransmission timeout is derived
+    int rtt_var_us;
+    int probe_ms; // current interval between probes, while not confirmed
+    long long probe_due_ns;
+    dgram_pending pending[DGRAM_WINDOW];
+}dgram_link;
+
+/* Socket on which datagrams are exchanged with every peer in a game session, identified to them by our session slot.
+ * Datagrams from other game sessions (e.g. late retransmissions) are told apart by the session tag, and discarded.
+ */
+typedef struct{
+    int fd;
+    int slot;
+    unsigned int session;
+    int loss_permille; // datagrams dropped on purpose when sent, to emulate a lossy network (see dgram_set_loss)
+    unsigned int loss_seed;
+    atomic_ullong retransmits;
+}dgram_endpoint;
+
+// Datagram received from a peer, as decoded by dgram_recv; msg (of type EMPTY if none) points into buffer
+typedef struct{
+    int slot;
+    int flags;
+    unsigned int seq;
+    unsigned int ack;
+    unsigned int ack_bits;
+    msg msg;
+    char buffer[DGRAM_MAX_SIZE];
+}dgram_packet;
+
+// FUNC DEFNS
+int dgram_open(dgram_endpoint* ep, int port);
+void dgram_drain(dgram_endpoint* ep);
+void dgram_set_loss(dgram_endpoint* ep, int loss_permille);
+void dgram_link_reset(dgram_link* link, const char* ip, int port);
+int dgram_send_int(dgram_endpoint* ep, dgram_link* link, int msg_type, int value);
+int dgram_send_ack(dgram_endpoint* ep, dgram_link* link);
+int dgram_recv(dgram_endpoint* ep, dgram_packet* packet);
+int dgram_handle(dgram_link* link, const dgram_packet* packet);
+int dgram_service(dgram_endpoint* ep, dgram_link* link, long long now_ns);
+
+enum DgramFlag {DGRAM_DATA = 1, DGRAM_HEARD = 2, DGRAM_PROBE = 4};
+
+#endif //CPS2008_TETRIS_CLIENT_DATAGRAM_H
@@ -0,0 +1,27 @@
+#include <stddef.h>
+#include "ring_queue.h"
+
+#ifndef CPS2008_TETRIS_CLIENT_MSG_POOL_H
+#define CPS2008_TETRIS_CLIENT_MSG_POOL_H
+
+#define MSG_POOL_BUFFER_SIZE 256 // size of each pooled buffer; larger data parts are allocated on the heap instead
+
+/* Pool of fixed-size buffers for the data parts of messages which outlive the receive buffer (e.g. those kept in the
+ * server message queue), carved out of a single slab allocated up front. Free buffers are kept in a lock-free queue,
+ * such that buffers may be released from any thread, while being acquired by a single thread. Once initialised, no
+ * heap allocation is made unless the pool runs dry, or a data part does not fit in a pooled buffer.
+ */
+typedef struct{
+    char* slab;
+    size_t n_buffers;
+    size_t buffer_size;
+    ring_queue free_buffers; // pointers to the buffers not currently acquired
+}msg_pool;
+
+// FUNC DEFNS
+int msg_pool_init(msg_pool* pool, size_t n_buffers, size_t buffer_size);
+char* msg_pool_acquire(msg_pool* pool, size_t len, int* msg_alloc);
+void msg_pool_release(msg_pool* pool, char* buffer, int msg_alloc);
+void msg_pool_destroy(msg_pool* pool);
+
+#endif //CPS2008_TETRIS_CLIENT_MSG_POOL_H
@@ -0,0 +1,90 @@
+#include <stdatomic.h>
+#include <stddef.h>
+
+#ifndef CPS2008_TETRIS_CLIENT_NET_STATS_H
+#define CPS2008_TETRIS_CLIENT_NET_STATS_H
+
+#define STATS_N_MSG_TYPES 12 // message types counted individually (CHAT up to PEER_PONG, see enum MsgType)
+#define STATS_HIST_SUB_BITS 3 // each power of 2 is split into 2^STATS_HIST_SUB_BITS buckets, i.e. 12.5% precision
+#define STATS_HIST_BUCKETS 320 // enough for values up to 2^41 ns (i.e. over half an hour)
+
+// STRUCTS
+// Live counters of a socket, updated (without locking) as messages are sent and received
+typedef struct{
+    atomic_ullong bytes_in;
+    atomic_ullong bytes_out;
+    atomic_ullong recv_calls;
+    atomic_ullong send_calls;
+    atomic_ullong msgs_in[STATS_N_MSG_TYPES];
+    atomic_ullong msgs_out[STATS_N_MSG_TYPES];
+}net_counters;
+
+/* Live latency histogram with log-linear (HDR-style) buckets: values below 2^STATS_HIST_SUB_BITS have a bucket each,
+ * and every higher power of 2 is split into 2^STATS_HIST_SUB_BITS equal buckets, such that the relative error of any
+ * percentile is bounded irrespective of its magnitude. Values are recorded in nanoseconds.
+ */
+typedef struct{
+    atomic_ullong counts[STATS_HIST_BUCKETS];
+    atomic_ullong count;
+    atomic_ullong sum_ns;
+    atomic_ullong max_ns;
+}net_histogram;
+
+// Snapshot of the counters of one socket (or the sum over several sockets)
+typedef struct{
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+    unsigned long long recv_calls;
+    unsigned long long send_calls;
+    unsigned long long msgs_in[STATS_N_MSG_TYPES]; // indexed by msg_type
+    unsigned long long msgs_out[STATS_N_MSG_TYPES];
+}net_conn_stats;
+
+// Snapshot summary of a latency histogram, in nanoseconds
+typedef struct{
+    unsigned long long count;
+    unsigned long long mean_ns;
+    unsigned long long p50_ns;
+    unsigned long long p90_ns;
+    unsigned long long p99_ns;
+    unsigned long long max_ns;
+}net_latency_stats;
+
+// Snapshot of all instrumentation, as returned by get_net_stats
+typedef struct{
+    int enabled;
+    net_conn_stats server; // the socket connected to the server
+    net_conn_stats peers; // all sockets connected to P2P clients, including those since closed
+    unsigned long long server_queue_high_water; // largest number of messages held in the server message queue at once
+    unsigned long long server_chats_dropped; // CHAT messages from the server dropped (oldest first) since their queue was full
+    unsigned long long peer_retransmits; // messages to P2P clients sent as datagrams and retransmitted (see set_peer_transport)
+    unsigned long long reactor_wakeups; // number of times the P2P event loop returned from waiting for events
+    unsigned long long reactor_wait_ns; // total time the P2P event loop spent waiting for events
+    net_latency_stats lines_send_latency; // from send_cleared_lines until the LINES_CLEARED message is sent to a client
+    net_latency_stats peer_dispatch_latency; // from the P2P event loop waking up until its ready sockets are handled
+    long long mesh_setup_ms; // from handling NEW_GAME until sending P2P_READY (-1 if not (yet) reached)
+    long long start_wait_ms; // from sending P2P_READY until START_GAME is received (-1 if not (yet) reached)
+}net_stats;
+
+// GLOBALS
+extern atomic_int net_stats_active;
+
+// FUNC DEFNS
+void set_net_stats_enabled(int enabled);
+long long net_stats_now_ns();
+void net_counters_add_msg(net_counters* counters, int msg_type, int outbound);
+void net_counters_read(net_counters* counters, net_conn_stats* stats);
+void net_counters_fold(net_counters* counters, net_conn_stats* stats);
+void net_counters_merge(net_counters* dst, net_counters* src);
+void net_counters_reset(net_counters* counters);
+void net_histogram_record(net_histogram* hist, long long value_ns);
+void net_histogram_read(net_histogram* hist, net_latency_stats* stats);
+void net_histogram_reset(net_histogram* hist);
+int net_stats_to_json(const net_stats* stats, char* buffer, size_t buffer_len);
+
+// Returns 1 if instrumentation is enabled (see set_net_stats_enabled); cheap enough to guard every update with
+static inline int net_stats_enabled(){
+    return atomic_load_explicit(&net_stats_active, memory_order_relaxed);
+}
+
+#endif //CPS2008_TETRIS_CLIENT_NET_STATS_H
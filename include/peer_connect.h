@@ -0,0 +1,60 @@
+#ifndef CPS2008_TETRIS_CLIENT_PEER_CONNECT_H
+#define CPS2008_TETRIS_CLIENT_PEER_CONNECT_H
+
+#include "socket_profile.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+
+// Default deadline and retry schedule for connecting to the clients in a game session
+#define CONNECT_DEFAULT_DEADLINE_MS 5000
+#define CONNECT_DEFAULT_INITIAL_BACKOFF_MS 25
+#define CONNECT_DEFAULT_MAX_BACKOFF_MS 800
+#define CONNECT_DEFAULT_MAX_ATTEMPTS 12
+#define CONNECT_POLL_INTERVAL_MS 1 // interval at which a batch stepped without waiting checks attempts in progress
+
+// STRUCTS
+typedef struct{
+    int deadline_ms; // time allowed for all connections to be established, after which pending attempts are abandoned
+    int initial_backoff_ms; // delay before retrying a failed attempt, doubled after every failure...
+    int max_backoff_ms; // ...up to this limit
+    int max_attempts; // number of attempts per target before giving up on it
+    const socket_profile* profile; // applied to each socket before connecting (none if NULL)
+}connect_options;
+
+typedef struct{
+    const char* ip;
+    int port;
+    const struct sockaddr_un* local_addr; // if not NULL, connect over this Unix domain socket address instead of TCP
+    socklen_t local_addr_len;
+}connect_target;
+
+// Called once per target, with fd the connected (blocking) socket, or -1 if the target could not be connected to
+typedef void (*connect_callback)(int target_idx, int fd, void* arg);
+
+/* Connections being established to a set of targets (see connect_batch_start), advanced by connect_batch_step; the state
+ * of each target (a copy of the target, and its attempts) is private to peer_connect.c.
+ */
+typedef struct{
+    struct connect_state* states;
+    struct pollfd* pfds;
+    int* pfd_targets;
+    int n_targets;
+    int n_done;
+    int n_connected;
+    long long deadline_ms;
+    connect_options opts;
+    connect_callback callback;
+    void* arg;
+}connect_batch;
+
+// FUNC DEFNS
+int connect_batch_start(connect_batch* batch, const connect_target* targets, int n_targets, const connect_options* opts,
+                        connect_callback callback, void* arg);
+int connect_batch_step(connect_batch* batch, int timeout_ms);
+void connect_batch_destroy(connect_batch* batch);
+int connect_all(const connect_target* targets, int n_targets, const connect_options* opts, connect_callback callback,
+                void* arg);
+connect_options connect_default_options();
+
+#endif //CPS2008_TETRIS_CLIENT_PEER_CONNECT_H
@@ -0,0 +1,69 @@
+#ifndef CPS2008_TETRIS_CLIENT_PROTOCOL_H
+#define CPS2008_TETRIS_CLIENT_PROTOCOL_H
+
+// MESSAGE FRAMING CONFIG
+#define MSG_LEN_DIGITS 4
+#define HEADER_SIZE (MSG_LEN_DIGITS + 6) // '<msg_len>::<msg_type>::\0' where msg_len is of size MSG_LEN_DIGITS chars and msg_type is 1 char
+#define MSG_MAX_LEN 9999 // largest data part length (including the null character) representable in MSG_LEN_DIGITS digits
+#define MSG_VARINT_MAX_BYTES 5 // binary frames encode the payload length as a LEB128 varint of at most 5 bytes
+#define MSG_BINARY_MAX_LEN (1 << 20) // largest payload accepted in a binary frame
+
+/* BINARY FORMAT
+ * Peers which advertise PEER_CAP_BINARY in their PEER_HELLO may be sent frames of the form
+ *      <msg_type : 1 byte><payload_len : LEB128 varint><payload : payload_len bytes>
+ * where msg_type < '0', such that binary frames are always distinguishable from ASCII ones. Payload layouts are:
+ *      LINES_CLEARED, SCORE_UPDATE, PEER_HELLO, PEER_ACK,
+ *      PEER_PING, PEER_PONG                                    : 32-bit little-endian signed integer
+ *      FINISHED_GAME, P2P_READY, CLIENTS_CONNECTED, START_GAME : empty
+ *      CHAT, NEW_GAME                                          : null-terminated string, as in the ASCII data part
+ */
+
+/* P2P HANDSHAKE
+ * The first message sent on every connection made to another client is a PEER_HELLO, whose integer carries the session
+ * slot of the sender (i.e. its port block offset) in the upper 16 bits and its capabilities (see enum PeerCapability) in
+ * the lower 16 bits. The receiving client identifies the sender by its slot, and replies on the same connection with a
+ * PEER_ACK, whose integer is encoded likewise with its own slot and capabilities, thereby confirming the connection.
+ *
+ * If both clients advertise PEER_CAP_SINGLE_SOCKET, this one connection is used in both directions, and only the client
+ * with the lower slot connects to the other. Otherwise each client connects to the other, i.e. there is one connection
+ * for each direction.
+ */
+/* P2P HEARTBEAT
+ * Clients which advertise PEER_CAP_HEARTBEAT are sent a PEER_PING once every heartbeat interval on the (confirmed)
+ * connection on which we send to them, whose integer is the time at which it was sent (in microseconds, modulo 2^31, on
+ * the sender's monotonic clock). The receiver replies on the same connection with a PEER_PONG echoing the integer, from
+ * which the sender estimates the round-trip time. A client from which nothing has been heard for a number of intervals
+ * is deemed dead, and is disconnected. In ASCII frames, the type of these messages is the single character '0' + type.
+ */
+/* P2P DATAGRAMS
+ * Clients which both advertise PEER_CAP_DATAGRAM also exchange UDP datagrams, each sent from and to the port on which
+ * the respective client accepts P2P connections. A datagram is made up of a 20-byte header (integers little-endian)
+ *      <0xD7 : 1 byte><flags : 1 byte><sender slot : 2 bytes><session : 4 bytes><seq : 4 bytes><ack : 4 bytes><ack_bits : 4 bytes>
+ * followed, if flags has DGRAM_DATA set, by a single binary frame as above (of an integer type, e.g. LINES_CLEARED)
+ * numbered seq. session is the seed of the game session. ack is the highest seq received from the other client, and bit
+ * k of ack_bits is set if ack - 1 - k was also received. DGRAM_HEARD is set once a datagram has been received from the
+ * other client; until a client receives a datagram with DGRAM_HEARD set, it periodically sends datagrams with
+ * DGRAM_PROBE set, each of which is replied to. In-game messages are only sent as datagrams once both clients have heard
+ * each other, and until then (or if datagrams never get through) on the P2P connection as usual. Messages are
+ * retransmitted until acknowledged.
+ */
+#define PEER_HELLO_VALUE(slot, caps) (((slot) << 16) | ((caps) & 0xFFFF))
+#define PEER_HELLO_SLOT(value) ((value) >> 16)
+#define PEER_HELLO_CAPS(value) ((value) & 0xFFFF)
+
+// STRUCTS
+typedef struct{
+    int msg_type;
+    char* msg;
+    int msg_format; // format in which the msg was received (MSG_FORMAT_ASCII or MSG_FORMAT_BINARY); ignored on send
+    int msg_alloc; // how the data part of a received msg is held (see enum MsgAlloc and msg_release); ignored on send
+}msg;
+
+enum MsgType {INVALID = -2, EMPTY = -1, CHAT = 0, SCORE_UPDATE = 1, NEW_GAME = 2, FINISHED_GAME = 3, P2P_READY = 4,
+              CLIENTS_CONNECTED = 5, START_GAME = 6, LINES_CLEARED = 7, PEER_HELLO = 8, PEER_ACK = 9, PEER_PING = 10,
+              PEER_PONG = 11};
+enum MsgFormat {MSG_FORMAT_ASCII = 0, MSG_FORMAT_BINARY = 1};
+enum MsgAlloc {MSG_ALLOC_VIEW = 0, MSG_ALLOC_POOL = 1, MSG_ALLOC_HEAP = 2};
+enum PeerCapability {PEER_CAP_BINARY = 1, PEER_CAP_SINGLE_SOCKET = 2, PEER_CAP_HEARTBEAT = 4, PEER_CAP_DATAGRAM = 8};
+
+#endif //CPS2008_TETRIS_CLIENT_PROTOCOL_H
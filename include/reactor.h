@@ -0,0 +1,43 @@
+#include <sys/epoll.h>
+
+#ifndef CPS2008_TETRIS_CLIENT_REACTOR_H
+#define CPS2008_TETRIS_CLIENT_REACTOR_H
+
+#define REACTOR_MAX_EVENTS 64 // maximum number of ready events dispatched per call to epoll_wait
+
+typedef void (*reactor_handler)(int fd, unsigned int events, void* arg);
+
+/* A file descriptor registered with a reactor, along with the handler to which its readiness is dispatched. The memory
+ * of a source is owned by the caller and must remain valid for as long as the descriptor is registered; setting the
+ * handler to NULL (see reactor_source_clear) causes any event still pending for the source to be ignored.
+ */
+typedef struct{
+    int fd;
+    reactor_handler handler;
+    void* arg;
+}reactor_source;
+
+/* Edge-triggered epoll event loop: descriptors are registered once, and each call to reactor_run_once dispatches only
+ * those which have become ready directly to their handlers. Since readiness is edge-triggered, handlers must consume
+ * all available input (e.g. until recv or accept report EAGAIN) before returning.
+ */
+typedef struct{
+    int epoll_fd;
+    int wake_fd; // eventfd used to interrupt a blocked reactor_run_once from another thread
+    reactor_source wake_source;
+    struct epoll_event ready[REACTOR_MAX_EVENTS]; // events returned by the last call to reactor_wait
+    int n_ready;
+}reactor;
+
+// FUNC DEFNS
+int reactor_init(reactor* r);
+int reactor_add(reactor* r, reactor_source* src, int fd, unsigned int events, reactor_handler handler, void* arg);
+int reactor_remove(reactor* r, reactor_source* src);
+int reactor_wait(reactor* r, int timeout_ms);
+int reactor_dispatch(reactor* r);
+int reactor_run_once(reactor* r, int timeout_ms);
+void reactor_wake(reactor* r);
+void reactor_source_clear(reactor_source* src);
+void reactor_destroy(reactor* r);
+
+#endif //CPS2008_TETRIS_CLIENT_REACTOR_H
@@ -0,0 +1,39 @@
+#include <stdatomic.h>
+#include <semaphore.h>
+#include <stddef.h>
+
+#ifndef CPS2008_TETRIS_CLIENT_RING_QUEUE_H
+#define CPS2008_TETRIS_CLIENT_RING_QUEUE_H
+
+#define RING_CACHE_LINE 64
+
+/* Bounded FIFO ring queue of fixed-size elements. The data path is lock-free: producers and the consumer only ever
+ * touch the (cache-line separated) head and tail indices and, in the multi-producer variant, a per-slot sequence number.
+ * Blocking (backpressure when full, waiting when empty) is delegated to a pair of counting semaphores, which are futex
+ * based and hence only enter the kernel when a thread actually has to sleep or be woken up.
+ */
+typedef struct{
+    _Alignas(RING_CACHE_LINE) atomic_size_t head; // next slot to be dequeued (consumer side)
+    _Alignas(RING_CACHE_LINE) atomic_size_t tail; // next slot to be claimed (producer side)
+    _Alignas(RING_CACHE_LINE) atomic_size_t* seqs; // per-slot sequence numbers (RING_MPSC only, otherwise NULL)
+    unsigned char* slots;
+    size_t capacity; // maximum number of elements held at any time
+    size_t mask; // number of slots - 1, where the number of slots is the capacity rounded up to a power of 2
+    size_t elem_size;
+    int mode;
+    sem_t free_slots; // counts the number of elements that may still be enqueued
+    sem_t used_slots; // counts the number of elements that may be dequeued
+}ring_queue;
+
+// FUNC DEFNS
+int ring_queue_init(ring_queue* q, size_t capacity, size_t elem_size, int mode);
+int ring_queue_push(ring_queue* q, const void* elem);
+int ring_queue_try_push(ring_queue* q, const void* elem);
+int ring_queue_pop(ring_queue* q, void* elem);
+int ring_queue_try_pop(ring_queue* q, void* elem);
+size_t ring_queue_size(ring_queue* q);
+void ring_queue_destroy(ring_queue* q);
+
+enum RingMode {RING_SPSC = 0, RING_MPSC = 1};
+
+#endif //CPS2008_TETRIS_CLIENT_RING_QUEUE_H
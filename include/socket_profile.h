@@ -0,0 +1,32 @@
+#ifndef CPS2008_TETRIS_CLIENT_SOCKET_PROFILE_H
+#define CPS2008_TETRIS_CLIENT_SOCKET_PROFILE_H
+
+// Default socket profile: small messages are sent immediately, while the remaining options are left to the system
+#define SOCKET_DEFAULT_NO_DELAY 1
+#define SOCKET_DEFAULT_QUICK_ACK 0
+#define SOCKET_DEFAULT_CLOSE_ON_EXEC 1
+
+// STRUCTS
+/* Options applied to every TCP socket opened by the library: the socket connected to the server, sockets connected to
+ * other clients (whether dialed or accepted) and the socket on which P2P connections are accepted. Fields set to 0 are
+ * left at the system default (or disabled, for the flags).
+ */
+typedef struct{
+    int no_delay; // TCP_NODELAY: disables Nagle's algorithm, such that small messages (e.g. LINES_CLEARED) are not held back
+    int quick_ack; // TCP_QUICKACK: acknowledges immediately rather than delaying the ACK; re-armed after every read
+    int busy_poll_us; // SO_BUSY_POLL: time for which reads busy-poll the device queue before sleeping
+    int send_buffer; // SO_SNDBUF (in bytes)
+    int recv_buffer; // SO_RCVBUF (in bytes)
+    int keepalive_idle_s; // SO_KEEPALIVE and TCP_KEEPIDLE: idle time before probing the peer, enabling keepalive if set...
+    int keepalive_interval_s; // ...TCP_KEEPINTVL: time between probes...
+    int keepalive_count; // ...and TCP_KEEPCNT: unanswered probes after which the connection is dropped
+    int user_timeout_ms; // TCP_USER_TIMEOUT: time for which sent data may remain unacknowledged before the connection is dropped
+    int close_on_exec; // FD_CLOEXEC: such that sockets are not leaked into processes spawned by the front-end
+}socket_profile;
+
+// FUNC DEFNS
+int socket_apply_profile(int fd, const socket_profile* profile);
+int socket_rearm_quick_ack(int fd);
+socket_profile socket_default_profile();
+
+#endif //CPS2008_TETRIS_CLIENT_SOCKET_PROFILE_H
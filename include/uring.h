@@ -0,0 +1,42 @@
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+#ifndef CPS2008_TETRIS_CLIENT_URING_H
+#define CPS2008_TETRIS_CLIENT_URING_H
+
+#define URING_ENTRIES 64 // number of submission queue entries, i.e. operations which may be submitted together
+
+/* Minimal io_uring instance, set up directly through the io_uring_setup and io_uring_enter system calls (hence not
+ * requiring liburing). Operations are prepared in the submission queue (see uring_get_sqe), submitted together with a
+ * single system call (see uring_submit), and their results then taken from the completion queue (see uring_reap). An
+ * instance is expected to be used by a single thread.
+ */
+typedef struct{
+    int ring_fd;
+    unsigned entries;
+    unsigned sqe_tail; // next submission queue entry to be prepared (published to the kernel by uring_submit)
+    unsigned sq_pending; // entries prepared but not yet submitted
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ring; // mappings shared with the kernel
+    size_t sq_ring_len;
+    void* cq_ring;
+    size_t cq_ring_len;
+    size_t sqes_len;
+}uring;
+
+// FUNC DEFNS
+int uring_init(uring* u, unsigned entries);
+struct io_uring_sqe* uring_get_sqe(uring* u);
+int uring_submit(uring* u, unsigned wait_nr);
+int uring_reap(uring* u, struct io_uring_cqe* cqe);
+void uring_destroy(uring* u);
+
+#endif //CPS2008_TETRIS_CLIENT_URING_H
@@ -1,38 +1,436 @@
 #include "../include/client_server.h"
+#include "../include/ring_queue.h"
+#include "../include/connection.h"
+#include "../include/reactor.h"
+#include "../include/msg_pool.h"
+#include "../include/datagram.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+
+/* Edge-triggered event loop of the P2P network, along with its instrumentation (see get_net_stats). Each client instance
+ * owns one, run by accept_peer_connections; an I/O engine (see io_engine_create) owns one of its own instead, shared by
+ * every instance attached to it.
+ */
+typedef struct{
+    reactor reactor;
+    atomic_ullong wakeups;
+    atomic_ullong wait_ns;
+    net_histogram dispatch_latency;
+}p2p_loop;
+
+/* Connections being established by connect_peers to the clients (players) at the given indices of a client instance;
+ * those established by the I/O engine are kept in a list, and stepped alongside its event loop (see step_peer_dials).
+ */
+typedef struct peer_dial{
+    client_ctx* ctx;
+    int* player_idxs;
+    connect_batch batch;
+    struct peer_dial* next;
+}peer_dial;
+
+/* Bounded queue of the CHAT messages received from the server, kept apart from the (session control) messages in the
+ * server message queue such that a burst of chat can neither delay nor block the latter. Rather than blocking the reader
+ * when full, the oldest message is dropped (chat being the only message type for which loss is preferable to delay).
+ * Accessed by the server reader and the front-end, under its mutex.
+ */
+typedef struct{
+    pthread_mutex_t mutex;
+    msg* msgs;
+    int capacity;
+    int head; // index of the oldest message
+    int size;
+}chat_queue;
+
+/* State of a client instance (see client_create), i.e. of one client of the game server, such that any number of
+ * instances may run side by side within a process. Every field is only accessed through the instance handed to the API.
+ */
+struct client_ctx{
+    game_session session;
+    pthread_mutex_t gameMutex;
+    pthread_mutex_t* clientMutexes; // one per entry of session.peers
+    int server_fd;
+
+    // FIFO queue of messages received from the server, other than CHAT (which are queued in server_chats); enqueued by
+    // enqueue_server_msg and dequeued by dequeue_server_msg, each of which is expected to be called from a single thread
+    // (hence a single-producer/single-consumer queue)
+    ring_queue server_msgs;
+    chat_queue server_chats;
+
+    // Pool of buffers holding the data parts of the messages in server_msgs and server_chats, until released by the
+    // front-end (see msg_release)
+    msg_pool server_msg_pool;
+
+    // epoll instance on which enqueue_server_msg waits for data from the server, and the socket registered with it
+    int server_epoll_fd;
+    int server_epoll_target;
+
+    // Event loop of the P2P network (own_loop, or that of the I/O engine to which the instance is attached); the socket on
+    // which we accept P2P connections and every socket connected to a P2P client are registered with it
+    p2p_loop own_loop;
+    p2p_loop* loop;
+    reactor_source p2p_source;
+
+    // Capabilities advertised to other clients in PEER_HELLO messages (see enum PeerCapability)
+    int peer_capabilities;
+
+    // Interval at which clients are pinged, the number of intervals without hearing from a client after which it is deemed
+    // dead (see set_peer_heartbeat), and the monotonic time at which the next pings are due (see service_heartbeats)
+    int heartbeat_interval_ms;
+    int heartbeat_max_missed;
+    long long next_heartbeat_ms;
+
+    // Deadline and retry schedule for connecting to the clients in a game session, and the front-end callback notified
+    // on completion of each connection (see set_peer_connect_options and set_peer_connected_callback)
+    connect_options peer_connect_options;
+    void (*peer_connected_callback)(int player_idx, int connected, void* arg);
+    void* peer_connected_callback_arg;
+
+    // Options applied to every TCP socket opened by the library (see set_socket_profile)
+    socket_profile sock_profile;
+
+    // Events not yet taken by the front-end (see enum ClientEvent and take_events), the eventfd which is readable while
+    // any are pending, and the front-end callback notified of each event as it occurs (see set_event_callback)
+    atomic_int pending_events;
+    int event_fd;
+    void (*event_callback)(int event, void* arg);
+    void* event_callback_arg;
+
+    // I/O engine to which the instance is attached (see io_engine_attach), the registration of the server socket with
+    // its event loop, and the state of the game session being set up by it; server_read_stalled is set while the engine
+    // has stopped reading from the server since the server message queue is full
+    io_engine* engine;
+    atomic_int engine_running, engine_session_pending, server_read_stalled;
+    reactor_source server_source;
+    int p2p_registered, mesh_pending;
+    long long mesh_deadline_ms;
+    peer_dial* dials; // connections to the clients in the game session still being established by the engine
+
+    // Set when lines cleared are accumulated for the clients in the game session (see session.peers.pending_lines) by
+    // send_cleared_lines, and reset once the P2P event loop, which is woken up on the first such accumulation, flushes
+    // them (coalesced into a single LINES_CLEARED message per client, see flush_cleared_lines)
+    atomic_int lines_flush_requested;
+
+    // Set when the score is changed by set_score, and reset once the P2P event loop, which is woken up on the first such
+    // change, publishes the latest score to the server (see publish_score); the minimum interval between SCORE_UPDATE
+    // messages (see set_score_update_interval), the score last published and the monotonic time at which it was
+    atomic_int score_publish_requested;
+    int score_wake_fd; // eventfd on which enqueue_server_msg is woken up to publish the score (see wait_server_socket)
+    int score_update_interval_ms;
+    int published_score;
+    long long score_published_ms;
+
+    // Instrumentation of the server message queue, of the sockets connected to P2P clients since closed, and of the set
+    // up of game sessions (see get_net_stats); timestamps are taken from the monotonic clock (see net_stats_now_ns), and
+    // are 0 if not (yet) taken
+    atomic_ullong server_queue_high_water, server_chats_dropped;
+    net_counters released_counters;
+    net_histogram lines_send_latency;
+    atomic_llong lines_pending_since_ns, new_game_ns, p2p_ready_ns, start_game_ns;
+
+    // Base port, to which the session slot of each client is added to obtain the port on which it accepts P2P
+    // connections, capacities of the server message and chat queues, and time out of enqueue_server_msg (see
+    // set_base_port, set_server_msg_capacity, set_server_chat_capacity and set_server_msg_timeout)
+    int base_port;
+    int server_msg_capacity;
+    int server_chat_capacity;
+    int server_msg_timeout_ms;
+    int p2p_port; // port to which session.p2p_fd is bound (0 if no such socket is open)
+
+    // Socket on which P2P connections from clients on this host are accepted (see open_p2p_endpoint), its registration
+    // with the P2P event loop, and which clients are deemed to be on this host (see set_local_transport)
+    int p2p_local_fd;
+    reactor_source p2p_local_source;
+    int local_transport;
+
+    // Socket on which in-game messages are exchanged as datagrams with the clients which support it (see
+    // open_dgram_p2p_endpoint), its registration with the P2P event loop, the port to which it is bound, and whether it is
+    // to be opened at all (see set_peer_transport)
+    dgram_endpoint dgram;
+    reactor_source dgram_source;
+    int dgram_port;
+    int peer_transport;
+
+    // Used by service_peer_connections to wait for changes to the state of the P2P mesh (see signal_mesh_change)
+    pthread_mutex_t meshMutex;
+    pthread_cond_t meshCond;
+    int mesh_generation;
+};
+
+/* Library-managed I/O engine (see io_engine_create): its thread, the P2P event loop which it runs for every client
+ * instance attached to it, and the io_uring instance through which sends are batched (if selected). Instances are only
+ * ever added (up to max_contexts), such that the engine thread may walk them without taking attachMutex.
+ */
+struct io_engine{
+    p2p_loop loop;
+    pthread_t thread;
+    atomic_int stop;
+    int batch_sends;
+    uring ring;
+    pthread_mutex_t attachMutex;
+    client_ctx** contexts;
+    int max_contexts;
+    atomic_int n_contexts;
+};
+
+// Discards any per-socket state kept by the library (such as buffered bytes) and closes the socket, keeping its counters
+// in those of the client instance (see get_net_stats)
+static void close_socket(client_ctx* ctx, int socket_fd){
+    if(net_stats_enabled() && conn_get(socket_fd) != NULL){
+        net_counters_merge(&ctx->released_counters, &conn_get(socket_fd)->counters);
+    }
+
+    conn_release(socket_fd);
+    close(socket_fd);
+}
+
+/* Grows the table of clients in the game session (see peer_table) to hold at least capacity entries, keeping the first
+ * session.n_players entries. All the arrays of the table, as well as the mutex of each client, are carved out of one
+ * allocation.
+ * Must not be called while any thread is accessing the table, i.e. outside of a game session (or while setting one up).
+ * Returns 0 on success, -1 on failure (in which case the table is left as is).
+ */
+static int peer_table_reserve(client_ctx* ctx, int capacity){
+    peer_table* old_table = &ctx->session.peers;
+    if(capacity <= old_table->capacity){
+        return 0;
+    }
+
+    size_t n = (size_t) capacity;
+    // one mutex, one datagram link, one timestamp, one atomic counter, 12 integers and an IPv4 address per entry
+    char* block = malloc(n * (sizeof(pthread_mutex_t) + sizeof(dgram_link) + sizeof(long long) + sizeof(atomic_int) +
+                              12 * sizeof(int) + INET_ADDRSTRLEN));
+    if(block == NULL){
+        return -1;
+    }
+
+    // carve out the arrays in decreasing order of alignment, such that each is suitably aligned
+    peer_table table = {.capacity = capacity, .block = block};
+    pthread_mutex_t* mutexes = (pthread_mutex_t*) block; block += n * sizeof(pthread_mutex_t);
+    table.dgram = (dgram_link*) block; block += n * sizeof(dgram_link);
+    table.last_heard_ms = (long long*) block; block += n * sizeof(long long);
+    table.pending_lines = (atomic_int*) block; block += n * sizeof(atomic_int);
+    table.port = (int*) block; block += n * sizeof(int);
+    table.client_fd = (int*) block; block += n * sizeof(int);
+    table.server_fd = (int*) block; block += n * sizeof(int);
+    table.state = (int*) block; block += n * sizeof(int);
+    table.peer_caps = (int*) block; block += n * sizeof(int);
+    table.slot = (int*) block; block += n * sizeof(int);
+    table.link_flags = (int*) block; block += n * sizeof(int);
+    table.link_failure = (int*) block; block += n * sizeof(int);
+    table.dial_pending = (int*) block; block += n * sizeof(int);
+    table.local = (int*) block; block += n * sizeof(int);
+    table.rtt_us = (int*) block; block += n * sizeof(int);
+    table.rtt_var_us = (int*) block; block += n * sizeof(int);
+    table.ip = (char (*)[INET_ADDRSTRLEN]) block;
+
+    for(int i = 0; i < capacity; i++){
+        pthread_mutex_init(mutexes + i, NULL);
+        atomic_init(table.pending_lines + i, 0);
+    }
+
+    // keep the entries of the clients already in the table
+    int n_used = old_table->block != NULL ? ctx->session.n_players : 0;
+    for(int i = 0; i < n_used; i++){
+        atomic_init(table.pending_lines + i, atomic_load(old_table->pending_lines + i));
+    }
+    size_t used = (size_t) n_used * sizeof(int);
+    memcpy(table.port, old_table->port, used); memcpy(table.client_fd, old_table->client_fd, used);
+    memcpy(table.server_fd, old_table->server_fd, used); memcpy(table.state, old_table->state, used);
+    memcpy(table.peer_caps, old_table->peer_caps, used); memcpy(table.slot, old_table->slot, used);
+    memcpy(table.link_flags, old_table->link_flags, used); memcpy(table.link_failure, old_table->link_failure, used);
+    memcpy(table.dial_pending, old_table->dial_pending, used); memcpy(table.local, old_table->local, used);
+    memcpy(table.rtt_us, old_table->rtt_us, used); memcpy(table.rtt_var_us, old_table->rtt_var_us, used);
+    memcpy(table.last_heard_ms, old_table->last_heard_ms, (size_t) n_used * sizeof(long long));
+    memcpy(table.dgram, old_table->dgram, (size_t) n_used * sizeof(dgram_link));
+    memcpy(table.ip, old_table->ip, (size_t) n_used * INET_ADDRSTRLEN);
+
+    // then release the previous table (if any)
+    for(int i = 0; i < old_table->capacity; i++){
+        pthread_mutex_destroy(ctx->clientMutexes + i);
+    }
+    free(old_table->block);
+
+    ctx->session.peers = table;
+    ctx->clientMutexes = mutexes;
+
+    return 0;
+}
+
+/* Sets the number of other clients in a game session for which room is reserved up front (N_SESSION_PLAYERS by default).
+ * Larger sessions are still supported, the table of clients being grown on receipt of the NEW_GAME message; reserving
+ * room beforehand merely avoids doing so. May not be called while in a game session. Returns 0 on success, -1 if the
+ * capacity is invalid, memory could not be allocated or a game session is in progress.
+ */
+int set_session_capacity(client_ctx* ctx, int capacity){
+    int ret = -1;
+
+    pthread_mutex_lock(&ctx->gameMutex); // obtain mutex lock for game session
+    if(capacity > 0 && !atomic_load(&ctx->session.game_in_progress)){
+        ret = peer_table_reserve(ctx, capacity);
+    }
+    pthread_mutex_unlock(&ctx->gameMutex); // release mutex lock for game session
+
+    return ret;
+}
+
+/* Creates a client instance, with the default settings (which may then be changed through the set_* functions), and
+ * initialises its P2P event loop and the eventfd through which the front-end is notified of events. No connection is
+ * made until client_init. Returns NULL on failure.
+ */
+client_ctx* client_create(){
+    client_ctx* ctx = calloc(1, sizeof(client_ctx));
+    if(ctx == NULL){
+        smrerror("Failed to allocate memory for the client instance");
+        return NULL;
+    }
+
+    ctx->server_fd = -1;
+    ctx->server_epoll_fd = ctx->server_epoll_target = -1;
+    ctx->p2p_local_fd = -1;
+    ctx->dgram.fd = -1;
+    ctx->peer_capabilities = PEER_CAP_BINARY | PEER_CAP_SINGLE_SOCKET | PEER_CAP_HEARTBEAT;
+    ctx->heartbeat_interval_ms = HEARTBEAT_INTERVAL_MS;
+    ctx->heartbeat_max_missed = HEARTBEAT_MAX_MISSED;
+    ctx->score_update_interval_ms = SCORE_UPDATE_INTERVAL_MS;
+    ctx->peer_connect_options = connect_default_options();
+    ctx->sock_profile = socket_default_profile();
+    ctx->base_port = PORT;
+    ctx->server_msg_capacity = MSG_BUFFER_SIZE;
+    ctx->server_chat_capacity = CHAT_BUFFER_SIZE;
+    ctx->server_msg_timeout_ms = SERVER_MSG_TIMEOUT_MS;
+    ctx->local_transport = LOCAL_TRANSPORT_LOOPBACK;
+    ctx->loop = &ctx->own_loop;
+    pthread_mutex_init(&ctx->gameMutex, NULL);
+    pthread_mutex_init(&ctx->server_chats.mutex, NULL);
+    pthread_mutex_init(&ctx->meshMutex, NULL);
+    pthread_cond_init(&ctx->meshCond, NULL);
+
+    // initialise the event loop on which P2P connections and messages are handled
+    if(reactor_init(&ctx->own_loop.reactor) < 0){
+        smrerror("Failed to initialise the peer-to-peer event loop");
+        free(ctx);
+        return NULL;
+    }
+
+    // initialise the eventfd through which the front-end is notified of events (see get_event_fd)
+    if((ctx->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0){
+        smrerror("Failed to initialise the event notification file descriptor");
+        reactor_destroy(&ctx->own_loop.reactor);
+        free(ctx);
+        return NULL;
+    }
+
+    // and that through which the thread reading from the server is woken up to publish the score (see set_score)
+    if((ctx->score_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0){
+        smrerror("Failed to initialise the event notification file descriptor");
+        close(ctx->event_fd);
+        reactor_destroy(&ctx->own_loop.reactor);
+        free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+/* Releases a client instance, closing every socket still held by it (including that connected to the server). Must be
+ * called outside of a game session, once no thread is using the instance, and after destroying the I/O engine to which
+ * it is attached (if any).
+ */
+void client_destroy(client_ctx* ctx){
+    if(ctx == NULL){
+        return;
+    }
+
+    if(ctx->server_fd >= 0){ close_socket(ctx, ctx->server_fd);}
+    if(ctx->session.p2p_fd > 0){ close(ctx->session.p2p_fd);}
+    if(ctx->p2p_local_fd >= 0){ close(ctx->p2p_local_fd);}
+    if(ctx->dgram.fd >= 0){ close_socket(ctx, ctx->dgram.fd);}
+    if(ctx->server_epoll_fd >= 0){ close(ctx->server_epoll_fd);}
+    close(ctx->event_fd);
+    close(ctx->score_wake_fd);
+    reactor_destroy(&ctx->own_loop.reactor);
+
+    if(ctx->server_msgs.slots != NULL){ ring_queue_destroy(&ctx->server_msgs);}
+    free(ctx->server_chats.msgs);
+    if(ctx->server_msg_pool.slab != NULL){ msg_pool_destroy(&ctx->server_msg_pool);}
+    for(int i = 0; i < ctx->session.peers.capacity; i++){
+        pthread_mutex_destroy(ctx->clientMutexes + i);
+    }
+    free(ctx->session.peers.block);
 
-/* Initialiser for a new client instance, in particular responsible for:
+    pthread_cond_destroy(&ctx->meshCond);
+    pthread_mutex_destroy(&ctx->meshMutex);
+    pthread_mutex_destroy(&ctx->gameMutex);
+    pthread_mutex_destroy(&ctx->server_chats.mutex);
+    free(ctx);
+}
+
+/* Initialiser for a client instance (see client_create), in particular responsible for:
  * (i) connecting to the game server by calling the client_server library function
- * (ii) initialising the mutexes for the P2P clients array
+ * (ii) initialising the table of P2P clients, along with their mutexes
+ * (iii) initialising the queue of messages received from the server (and its pool of buffers)
  *
- * If client_connect fails to open and connect a socket, -1 is returned. This return is propogated by client_init and
- * its the resonsibility of the caller to handle this accordingly.
+ * If the IPv4 address is invalid, memory could not be allocated, or client_connect fails to open and connect a socket,
+ * -1 is returned (rather than the process exiting). It is then the resonsibility of the caller to handle this
+ * accordingly, e.g. by releasing the instance through client_destroy.
  */
-int client_init(char* ip){
+int client_init(client_ctx* ctx, char* ip){
     // first being by validating the given ip address...
     struct sockaddr_in temp_sa;
     if(inet_pton(AF_INET, ip, &(temp_sa.sin_addr)) <= 0){
-        mrerror("Invalid IPv4 address. Exiting...");
+        errno = EINVAL;
+        smrerror("Invalid IPv4 address");
+        return -1;
     }
 
     char ip_str[INET_ADDRSTRLEN]; strcpy(ip_str, ip); // copy into a string
 
-    // initialise mutexes for P2P clients
-    for(int i = 0; i < N_SESSION_PLAYERS; i++){
-        pthread_mutex_init(&clientMutexes[i], NULL);
+    // initialise the table of P2P clients (and their mutexes), unless already done through set_session_capacity
+    if(peer_table_reserve(ctx, N_SESSION_PLAYERS) < 0){
+        smrerror("Failed to allocate memory for the peer-to-peer clients");
+        return -1;
+    }
+
+    // initialise the FIFO queue in which messages received from the server are kept until dequeued by the front-end
+    if(ctx->server_msgs.slots == NULL && ring_queue_init(&ctx->server_msgs, ctx->server_msg_capacity, sizeof(msg), RING_SPSC) < 0){
+        smrerror("Failed to initialise the server message queue");
+        return -1;
     }
 
-    // connect to the game server and set global file descriptor reference to returned fd by client_connect
-    server_fd = client_connect(ip_str, PORT); // returns -1 on failure
-    return server_fd; // propogate the return of client_connect...
+    if(ctx->server_chats.msgs == NULL){
+        ctx->server_chats.msgs = malloc(ctx->server_chat_capacity * sizeof(msg));
+        ctx->server_chats.capacity = ctx->server_chat_capacity;
+        if(ctx->server_chats.msgs == NULL){
+            smrerror("Failed to initialise the server chat queue");
+            return -1;
+        }
+    }
+
+    // pool the buffers of the messages in the queues, with a few to spare for messages dequeued but not yet released
+    if(ctx->server_msg_pool.slab == NULL && msg_pool_init(&ctx->server_msg_pool, ctx->server_msg_capacity +
+       ctx->server_chat_capacity + MSG_POOL_SPARE, MSG_POOL_BUFFER_SIZE) < 0){
+        smrerror("Failed to initialise the server message pool");
+        return -1;
+    }
+
+    // connect to the game server and keep a reference to the fd returned by client_connect
+    ctx->server_fd = client_connect(ctx, ip_str, ctx->base_port); // returns -1 on failure
+    return ctx->server_fd; // propogate the return of client_connect...
 }
 
 /* Library function for connecting a client at a specified IPv4 address and port, initialising a socket and attempt to
  * connect. We also attempt to set socket reuse at the specified port, to mitigate the port allocation issue outlined in
- * the report.
+ * the report. The socket is set up according to the socket profile of the client instance (see set_socket_profile).
  *
  * The function returns >= 0 (the socket file descriptor) on success, -1 on failure.
  */
-int client_connect(char ip[INET_ADDRSTRLEN], int port){
+int client_connect(client_ctx* ctx, char ip[INET_ADDRSTRLEN], int port){
     int socket_fd;
     struct sockaddr_in serveraddrIn = {.sin_family = SDOMAIN, .sin_addr.s_addr = inet_addr(ip), .sin_port = htons(port)};
 
@@ -44,11 +442,17 @@ int client_connect(char ip[INET_ADDRSTRLEN], int port){
 
     // (attempt to) allow port reuse...
     if(setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) < 0){
+        close(socket_fd);
 	    return -1; // return -1 on failure
     }
 
+    // apply the socket profile before connecting, such that the buffer sizes are taken into account in the handshake
+    socket_apply_profile(socket_fd, &ctx->sock_profile);
+    conn_set_quick_ack(socket_fd, ctx->sock_profile.quick_ack);
+
     // Then connect it...
     if(connect(socket_fd, (struct sockaddr*) &serveraddrIn, sizeof(serveraddrIn)) < 0){
+        close(socket_fd); // such that a process running many client instances does not leak descriptors
         return -1; // return -1 on failure
     }
 
@@ -58,595 +462,2284 @@ int client_connect(char ip[INET_ADDRSTRLEN], int port){
 /* Library function for fetching an encoded message from the specified socket. The message is decoded accordingly and
  * represented as a msg struct. The encoding format and decoding procedure is outlined accordingly in the project report.
  *
+ * Bytes are read through a per-socket receive buffer (see connection.c), such that a single call to recv typically
+ * yields several messages, and messages already buffered are returned without any system call. No memory is allocated
+ * per message: the data part of the returned msg points into the receive buffer, and is hence only valid until the next
+ * call to recv_msg on the same socket. Callers wishing to keep the data part must copy it.
+ *
  * Returns the msg instance to the caller. In case of a failure during message receipt, the msg instance is still returned
  * but the msg type is set to INVALID.
  */
 msg recv_msg(int socket_fd){
     msg recv_msg;
-    recv_msg.msg_type = INVALID;
-
-    // variables used to maintain total bytes read (tbr), number of bytes received from last call to recv, and the
-    // expected length of the next data part
-    int ret, tbr, recv_str_len; // tbr = total bytes read
-
-    // initialise char array to keep header of message
-    char header[HEADER_SIZE]; header[HEADER_SIZE - 1] = '\0';
-
-    // initial call to recv attempts to fetch the header of the message first
-    if((ret = recv(socket_fd, (void*) &header, HEADER_SIZE - 1, 0)) > 0){
-        // ensure that the header is recieved entirely (keep on looping until tbr == HEADER_SIZE - 1)
-        for(tbr = ret; tbr < HEADER_SIZE - 1; tbr += ret){
-            if((ret = recv(socket_fd, (void*) (&header + tbr), HEADER_SIZE - tbr, 0)) < 0){
-                // if erroneous i.e. we have not managed to fetch a complete message header, set type as INVALID to
-                // signal to calling function
-                recv_msg.msg_type = INVALID;
-            }
+
+    if(conn_read_msg(socket_fd, &recv_msg) < 0){
+        recv_msg.msg_type = INVALID; // signal to the calling function that the message could not be fetched
+        recv_msg.msg = NULL;
+        recv_msg.msg_alloc = MSG_ALLOC_VIEW;
+    }
+
+    return recv_msg;
+}
+
+/* Raises the given event(s) (see enum ClientEvent) to the front-end: the events are added to those pending, making the
+ * eventfd readable if none were pending (such that a burst of events results in a single wake up), and the callback set
+ * by the front-end (if any) is then called. May be called from any thread, including while holding a client mutex.
+ */
+static void notify_event(client_ctx* ctx, int event){
+    if(atomic_fetch_or(&ctx->pending_events, event) == 0 && ctx->event_fd >= 0){
+        eventfd_write(ctx->event_fd, 1);
+    }
+
+    if(ctx->event_callback != NULL){
+        ctx->event_callback(event, ctx->event_callback_arg);
+    }
+}
+
+/* Enqueues a CHAT message received from the server in the server chat queue, first dropping (and releasing) the oldest
+ * message in the queue if it is full; never blocks.
+ */
+static void queue_server_chat(client_ctx* ctx, msg chatMsg){
+    msg dropped = {.msg_type = EMPTY, .msg = NULL, .msg_alloc = MSG_ALLOC_VIEW};
+    chat_queue* chats = &ctx->server_chats;
+
+    pthread_mutex_lock(&chats->mutex); // obtain mutex lock for the server chat queue
+    if(chats->size == chats->capacity){
+        dropped = chats->msgs[chats->head];
+        chats->head = (chats->head + 1) % chats->capacity;
+        chats->size--;
+    }
+    chats->msgs[(chats->head + chats->size) % chats->capacity] = chatMsg;
+    chats->size++;
+    pthread_mutex_unlock(&chats->mutex); // release mutex lock for the server chat queue
+
+    if(dropped.msg_type != EMPTY){
+        msg_release(ctx, &dropped);
+        if(net_stats_enabled()){ atomic_fetch_add_explicit(&ctx->server_chats_dropped, 1, memory_order_relaxed);}
+    }
+}
+
+// Dequeues the oldest message in the server chat queue into chatMsg; returns 1 if a message was dequeued, else 0
+static int dequeue_server_chat(client_ctx* ctx, msg* chatMsg){
+    chat_queue* chats = &ctx->server_chats;
+    int ret = 0;
+
+    pthread_mutex_lock(&chats->mutex); // obtain mutex lock for the server chat queue
+    if(chats->size > 0){
+        *chatMsg = chats->msgs[chats->head];
+        chats->head = (chats->head + 1) % chats->capacity;
+        chats->size--;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&chats->mutex); // release mutex lock for the server chat queue
+
+    return ret;
+}
+
+/* Enqueues a message received from the server (or of type INVALID, on disconnection) in the server message queue,
+ * blocking (without spinning) while the queue is full, and notifies the front-end. CHAT messages are instead enqueued
+ * in the server chat queue, which never blocks (see queue_server_chat), such that a burst of chat can never hold back
+ * the session control messages behind it (e.g. START_GAME) while the front-end catches up. The data part returned by recv_msg is
+ * a view into the receive buffer, which is overwritten by subsequent reads; since the message is kept in the queue until
+ * dequeued (and released) by the front-end, we keep a copy of the data part, in a buffer from the pool (such that no heap
+ * allocation is made in the steady state); should this fail, a msg of type INVALID is enqueued in its place. Returns the
+ * enqueued message.
+ */
+static msg queue_server_msg(client_ctx* ctx, msg recvMsg){
+    if(recvMsg.msg_type != INVALID){
+        size_t msg_len = strlen(recvMsg.msg) + 1;
+        char* data = msg_pool_acquire(&ctx->server_msg_pool, msg_len, &recvMsg.msg_alloc);
+        if(data == NULL){ // the message is lost, which is signalled to the front-end as a failure (rather than exiting)
+            smrerror("Error while allocating memory");
+            recvMsg.msg_type = INVALID; recvMsg.msg_alloc = MSG_ALLOC_VIEW;
+            recvMsg.msg = NULL;
+        }else{
+            recvMsg.msg = memcpy(data, recvMsg.msg, msg_len);
         }
+    }
+
+    // enqueue the message, blocking (without spinning) while the queue is full; note that while we are blocked the
+    // socket is not drained, and hence TCP flow control kicks in on the server side, since it is a streaming protocol
+    if(recvMsg.msg_type == CHAT){
+        queue_server_chat(ctx, recvMsg);
+    }else{
+        ring_queue_push(&ctx->server_msgs, &recvMsg);
+    }
 
-        // decode the header by extracting the expected length of the data part and the message type
-	    char str_len_part[5]; strncpy(str_len_part, header, 4); str_len_part[4] = '\0';
-        recv_str_len = strtol(str_len_part, NULL, 10);
-        recv_msg.msg_type = header[6] - '0';
+    notify_event(ctx, recvMsg.msg_type == START_GAME ? EVENT_SERVER_MSG | EVENT_GAME_STARTED : EVENT_SERVER_MSG);
 
-        // initialise array of decoded data part length, in which data part will be stored
-        recv_msg.msg = malloc(recv_str_len);
-        if(recv_msg.msg == NULL){
-            mrerror("Error while allocating memory");
+    if(net_stats_enabled()){
+        unsigned long long depth = ring_queue_size(&ctx->server_msgs);
+        unsigned long long high_water = atomic_load(&ctx->server_queue_high_water);
+        while(depth > high_water && !atomic_compare_exchange_weak(&ctx->server_queue_high_water, &high_water, depth));
+
+        if(recvMsg.msg_type == START_GAME){
+            atomic_store(&ctx->start_game_ns, net_stats_now_ns());
         }
+    }
 
-        // reset tbr to 0, loop until the successive calls to recv yield the entire data part
-        for(tbr = 0; tbr < recv_str_len; tbr += ret){
-            if((ret = recv(socket_fd, (void*) recv_msg.msg + tbr, recv_str_len - tbr, 0)) < 0){
-                // if erroneous i.e. we have not managed to fetch a complete data part, set type as INVALID to signal to
-                // calling function
-                recv_msg.msg_type = INVALID;
-            }
+    return recvMsg;
+}
+
+/* Sends the score set by set_score to the server in a SCORE_UPDATE message, at most once every score update interval
+ * (see set_score_update_interval): changes made in the meantime are coalesced, only the latest score being sent once the
+ * interval has elapsed, such that live scores take a bounded share of the bandwidth to the server. Called by whichever
+ * thread reads from the server (enqueue_server_msg, or the I/O engine), for every game type; the message is queued and
+ * sent without ever blocking, any bytes the socket cannot take being sent before the next message on the socket (see
+ * conn_send). Returns the time in milliseconds until the score is due to be published, or -1 if it has not changed.
+ */
+static int publish_score(client_ctx* ctx){
+    if(!atomic_load_explicit(&ctx->score_publish_requested, memory_order_acquire)){
+        return -1;
+    }
+
+    long long now_ms = net_stats_now_ns() / 1000000;
+    long long due_ms = ctx->score_published_ms + ctx->score_update_interval_ms;
+    if(now_ms < due_ms){
+        return (int) (due_ms - now_ms);
+    }
+    atomic_store_explicit(&ctx->score_publish_requested, 0, memory_order_release); // later changes request anew
+
+    // the game session lock orders the update before the final SCORE_UPDATE sent by end_game (and serialises it with
+    // the P2P_READY message, see finish_mesh_setup)
+    int retry_ms = -1;
+    pthread_mutex_lock(&ctx->gameMutex); // obtain mutex lock for game session
+    int score = atomic_load(&ctx->session.score);
+    if(atomic_load(&ctx->session.game_in_progress) && score != ctx->published_score){
+        // unless the previous update is still (partly) queued, since the server is not keeping up, in which case the
+        // latest score is sent once the interval elapses again
+        if(conn_flush(ctx->server_fd, 0) == 1 && conn_queue_int(ctx->server_fd, SCORE_UPDATE, score) == 0){
+            conn_flush(ctx->server_fd, 0);
+            ctx->published_score = score;
+        }else{
+            atomic_store_explicit(&ctx->score_publish_requested, 1, memory_order_release);
+            retry_ms = ctx->score_update_interval_ms;
         }
+        ctx->score_published_ms = now_ms;
     }
+    pthread_mutex_unlock(&ctx->gameMutex); // release mutex lock for game session
 
-    return recv_msg;
+    return retry_ms;
+}
+
+/* Waits (with the time out of enqueue_server_msg) until the server socket is readable, meanwhile publishing the score
+ * whenever due (see publish_score), as signalled by set_score through score_wake_fd. Returns 1 if the socket is readable,
+ * 0 on time out, -1 on failure.
+ */
+static int wait_server_socket(client_ctx* ctx){
+    long long timeout_at_ms = net_stats_now_ns() / 1000000 + ctx->server_msg_timeout_ms;
+
+    while(1){
+        long long left_ms = timeout_at_ms - net_stats_now_ns() / 1000000;
+        int wait_ms = ctx->server_msg_timeout_ms < 0 ? -1 : left_ms > 0 ? (int) left_ms : 0;
+        int score_ms = publish_score(ctx);
+        if(score_ms >= 0 && (wait_ms < 0 || score_ms < wait_ms)){
+            wait_ms = score_ms;
+        }
+
+        struct epoll_event event;
+        int ret = epoll_wait(ctx->server_epoll_fd, &event, 1, wait_ms);
+        if(ret < 0 && errno != EINTR){
+            return -1;
+        }else if(ret > 0 && event.data.fd != ctx->score_wake_fd){
+            return 1;
+        }else if(ret > 0){ // the score has changed
+            eventfd_t n_wakeups;
+            eventfd_read(ctx->score_wake_fd, &n_wakeups);
+        }else if(ret == 0 && wait_ms != score_ms){
+            return 0;
+        }
+    }
 }
-/* Library function for fetching a message from the specified socket, by first selecting on the socket with a timeout.
- * If a socket has data to stream, this is fetched using a call to recv_msg outlined earlier, and enqueing the message
- * in recv_server_msgs buffer. In essence then, enqueue_server_msg is a time-out variant of recv_msg.
+
+/* Library function for fetching a message from the server socket of the client instance, by first waiting on the socket
+ * with a timeout. If the socket has data to stream, this is fetched using a call to recv_msg outlined earlier, and enqueing the message
+ * in the server message queue. In essence then, enqueue_server_msg is a time-out variant of recv_msg.
+ *
+ * The time out is 5 seconds by default (see set_server_msg_timeout); a front-end waiting on the socket in an event loop
+ * of its own may set it to 0, and then call enqueue_server_msg whenever the socket is readable, until a msg of type
+ * EMPTY is returned (since several messages may be buffered by a single read). Every message enqueued raises an
+ * EVENT_SERVER_MSG event (see take_events). While waiting, the score is published to the server as it changes (see
+ * publish_score); a front-end setting the time out to 0 should hence also call it periodically during a game session.
  */
-msg enqueue_server_msg(int socket_fd){
-    // Define file descriptor set on which to carry out select; in essence contains socket_fd only
-    fd_set set; FD_ZERO(&set); FD_SET(socket_fd, &set);
+msg enqueue_server_msg(client_ctx* ctx){
+    if(atomic_load(&ctx->engine_running)){ // messages are then enqueued by the I/O engine
+        msg empty_msg = {.msg_type = EMPTY, .msg = NULL, .msg_alloc = MSG_ALLOC_VIEW};
+        return empty_msg;
+    }
+
+    int socket_fd = ctx->server_fd;
+    int ret = 1; // if a complete message is already buffered, there is no need to wait for data on the socket
+
+    if(!conn_has_msg(socket_fd)){
+        // the socket is registered (level-triggered) with an epoll instance once, rather than building a new file
+        // descriptor set on every call; it is only re-registered if the instance has since connected anew
+        if(ctx->server_epoll_fd < 0){
+            struct epoll_event wake_event = {.events = EPOLLIN, .data.fd = ctx->score_wake_fd}; // see wait_server_socket
+            if((ctx->server_epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+               epoll_ctl(ctx->server_epoll_fd, EPOLL_CTL_ADD, ctx->score_wake_fd, &wake_event) < 0){
+                smrerror("Failed to initialise epoll instance for the server socket");
+                msg err_msg = {.msg_type = INVALID, .msg = NULL, .msg_alloc = MSG_ALLOC_VIEW};
+                return err_msg;
+            }
+        }
 
-    // Define time out for select, set for 5 seconds
-    struct timeval timeout;
-    timeout.tv_sec = 5;
-    timeout.tv_usec = 0;
+        if(ctx->server_epoll_target != socket_fd){
+            struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP, .data.fd = socket_fd};
+            if(ctx->server_epoll_target >= 0){ epoll_ctl(ctx->server_epoll_fd, EPOLL_CTL_DEL, ctx->server_epoll_target, NULL);}
+            if(epoll_ctl(ctx->server_epoll_fd, EPOLL_CTL_ADD, socket_fd, &event) < 0){
+                msg err_msg = {.msg_type = INVALID, .msg = NULL, .msg_alloc = MSG_ALLOC_VIEW};
+                return err_msg;
+            }
+            ctx->server_epoll_target = socket_fd;
+        }
 
-    int ret = select(socket_fd + 1, &set, NULL, NULL, &timeout); // select on file descriptor set with time out
+        // wait for data on the socket, with a time out of 5 seconds (unless set otherwise), publishing the score meanwhile
+        ret = wait_server_socket(ctx);
+    }
 
     // if ret < 0, then server has disconnected and we return a msg of type INVALID to signal disconnection to the caller
     if(ret < 0){
-        msg err_msg; err_msg.msg_type = INVALID;
+        msg err_msg = {.msg_type = INVALID, .msg = NULL, .msg_alloc = MSG_ALLOC_VIEW};
         return err_msg;
     }
     else if(ret == 0){ // else if ret = 0, then no data is available from the server after the timeout
         // we then send a msg to type EMPTY to the caller, to signal that server is still connected but no data is available
-        msg empty_msg; empty_msg.msg_type = EMPTY;
+        msg empty_msg = {.msg_type = EMPTY, .msg = NULL, .msg_alloc = MSG_ALLOC_VIEW};
         return empty_msg;
     }else{
-        // else data is available and we fetch it via a call to recv_msg
-        msg recvMsg = recv_msg(socket_fd);
-
-        while(1){ // wait until we can enqueue the msgs
-            // note that if msg buffer is full, TCP flow control kicks in, since it is a streaming protocol...
-            if(n_server_msgs < (MSG_BUFFER_SIZE - 1)){
-                // since the message buffer is also accessed to retrieve messages, possibly by a different thread, we
-                // must ensure that it is accessed in a thread--safe manner.
-                pthread_mutex_lock(&threadMutex); // obtain mutex lock for thread of execution
-                recv_server_msgs[n_server_msgs] = recvMsg; // enqueue in order
-                n_server_msgs++; // update queue size
-                pthread_mutex_unlock(&threadMutex); // release mutex lock for thread of execution
-
-		        break;
-            }
-        }
-
-        return recvMsg;
+        // else data is available and we fetch it via a call to recv_msg, and enqueue it
+        return queue_server_msg(ctx, recv_msg(socket_fd));
     }
 }
 
-/* Library function for returning a msg instance from the recv_server_msgs buffer, in the order received, and in a
- * thread-safe manner. If queue is empty, a msg of type EMPTY is returned.
+/* Library function for returning a msg instance from the server message queue, in the order received (FIFO), and in a
+ * thread-safe manner. Session control messages take priority: CHAT messages (also in the order received) are only
+ * returned once no other message is queued. Does not block; if both queues are empty, a msg of type EMPTY is returned.
+ * Once done with the message, the caller must release it through msg_release.
  */
-msg dequeue_server_msg(){
-    msg recv_msg; recv_msg.msg_type = EMPTY;
-
-    if(n_server_msgs > 0){ //
-        pthread_mutex_lock(&threadMutex); // obtain mutex lock for thread of execution
-        recv_msg = recv_server_msgs[n_server_msgs - 1]; // dequeue in order
-        n_server_msgs--; // update queue size
-        pthread_mutex_unlock(&threadMutex); // release mutex lock for thread of execution
+msg dequeue_server_msg(client_ctx* ctx){
+    msg recv_msg = {.msg_type = EMPTY, .msg = NULL, .msg_alloc = MSG_ALLOC_VIEW};
 
+    // leaves recv_msg untouched if the queue is empty; if the I/O engine had stopped reading from the server since the
+    // queue was full, it is woken up to resume now that there is room
+    if(ring_queue_try_pop(&ctx->server_msgs, &recv_msg)){
+        if(atomic_load(&ctx->server_read_stalled)){ reactor_wake(&ctx->loop->reactor);}
+    }else{
+        dequeue_server_chat(ctx, &recv_msg);
     }
 
     return recv_msg;
 }
 
+/* Library function for releasing the data part of a msg returned by dequeue_server_msg (returning its buffer to the pool
+ * from which it was taken), once the caller is done with it; may be called from any thread. Messages whose data part is
+ * a view into a receive buffer (e.g. those returned by recv_msg) are left untouched, as are messages of type EMPTY or
+ * INVALID. Note that the msg returned by enqueue_server_msg shares its data part with the queued copy, and hence must
+ * not be released itself. The data part is set to NULL, such that releasing the same msg twice is harmless.
+ */
+void msg_release(client_ctx* ctx, msg* releaseMsg){
+    if(releaseMsg->msg != NULL){
+        msg_pool_release(&ctx->server_msg_pool, releaseMsg->msg, releaseMsg->msg_alloc);
+    }
+
+    releaseMsg->msg = NULL;
+    releaseMsg->msg_alloc = MSG_ALLOC_VIEW;
+}
+
 /* Library function used to send a message at the specified socket, taking care of encoding the message (as described in
  * detail in the project report), ensuring that the entire message is sent, and carrying out suitable error checks and
- * handling. Returns the number of sent bytes to the caller; if the return is negative, then an error has occured on
- * send, and should typically follow by disconnection.
+ * handling. The header and data part are sent together using scatter-gather I/O (see conn_send), without any memory
+ * allocation or copying of the data part. Returns the number of sent bytes to the caller; if the return is negative,
+ * then an error has occured on send (or the message is too long to be encoded), and should typically follow by
+ * disconnection.
  */
 int send_msg(msg sendMsg, int socket_fd){
-    // initialise necessary variables for encoding the message
-    int msg_len = strlen(sendMsg.msg) + 1;
-    int str_to_send_len = HEADER_SIZE + msg_len - 1; // enough space for the header + data part + null character
-    char header[HEADER_SIZE];
-    char* str_to_send = malloc(str_to_send_len);
+    return conn_send(socket_fd, sendMsg.msg_type, sendMsg.msg, strlen(sendMsg.msg));
+}
 
-    // if allocation of memory for holding the message to send failed, report an error and exit
-    if(str_to_send == NULL){
-        mrerror("Failed to allocate memory for message send");
-    }
+/* ----------- UTIL FUNCTIONS ----------- */
 
-    // the header must always be of fixed size, with the data part length having MSG_LEN_DIGITS; if the required number
-    // of digits is less than MSG_LEN_DIGITS, we prepend the required number of 0s to the header
-    int i = 0;
-    for(; i < MSG_LEN_DIGITS - ((int) floor(log10(msg_len)) + 1); i++){
-        header[i] = '0';
-    }
+/* Sets the port on which the server is connected to by client_init (PORT by default), which is also the base port to
+ * which the session slot of each client is added to obtain the port on which it accepts P2P connections. Must be called
+ * before client_init.
+ */
+void set_base_port(client_ctx* ctx, int port){
+    ctx->base_port = port;
+}
 
-    sprintf(header + i, "%d", msg_len); // concat the data part length
-    strcat(header, "::"); // concat the separation token
-    sprintf(header + MSG_LEN_DIGITS + 2, "%d", sendMsg.msg_type); // concat the message type
-    strcat(header, "::"); // concat the separation token
+/* Sets the time (in milliseconds) for which enqueue_server_msg waits for data from the server before returning a msg of
+ * type EMPTY; 0 returns immediately, while a negative time out waits indefinitely. SERVER_MSG_TIMEOUT_MS by default.
+ */
+void set_server_msg_timeout(client_ctx* ctx, int timeout_ms){
+    ctx->server_msg_timeout_ms = timeout_ms < 0 ? -1 : timeout_ms;
+}
 
-    strcpy(str_to_send, header); // copy the header to the string holding the final message string to be sent
-    strcat(str_to_send, sendMsg.msg); // append the data part to this string
-    str_to_send[str_to_send_len-1] = '\0'; // ensure null terminated
+// Sets the capacity of the queue of messages received from the server (MSG_BUFFER_SIZE by default); must be called
+// before client_init
+void set_server_msg_capacity(client_ctx* ctx, int capacity){
+    ctx->server_msg_capacity = capacity > 0 ? capacity : MSG_BUFFER_SIZE;
+}
 
-    int tbs; // tbs = total bytes sent
-    int sent_bytes;
+// Sets the number of CHAT messages from the server kept until dequeued, beyond which the oldest are dropped
+// (CHAT_BUFFER_SIZE by default); must be called before client_init
+void set_server_chat_capacity(client_ctx* ctx, int capacity){
+    ctx->server_chat_capacity = capacity > 0 ? capacity : CHAT_BUFFER_SIZE;
+}
 
-    // make successive calls to send() until the entire message is sent or an error occurs
-    for(tbs = 0; tbs < str_to_send_len; tbs += sent_bytes){
-        if((sent_bytes = send(socket_fd, (void*) str_to_send + tbs, str_to_send_len - tbs, 0)) < 0){
-            break; // in case of error, sent_bytes < 0 and hence a -ve value is returned indicating an error
-        }
-    }
+/* Enables (the default) or disables the compact binary format for messages sent to other clients in the P2P network.
+ * The binary format is only ever used towards clients which have themselves advertised support for it, falling back to
+ * the ASCII format otherwise; messages are always exchanged with the server in ASCII. Must be called before a game
+ * session is joined for it to take effect in that session.
+ */
+void set_binary_protocol(client_ctx* ctx, int enabled){
+    ctx->peer_capabilities = enabled ? (ctx->peer_capabilities | PEER_CAP_BINARY) : (ctx->peer_capabilities & ~PEER_CAP_BINARY);
+}
 
-    free(str_to_send); // free memory as necessary
+/* Enables (the default) or disables the use of a single (full-duplex) connection with each client in the P2P network,
+ * rather than one connection for each direction; this halves the number of connections to be set up and of sockets held.
+ * A single connection is only used with clients which have themselves advertised support for it, in which case the
+ * client with the lower slot connects to the other. Must be called before a game session is joined to take effect in it.
+ */
+void set_single_peer_socket(client_ctx* ctx, int enabled){
+    ctx->peer_capabilities = enabled ? (ctx->peer_capabilities | PEER_CAP_SINGLE_SOCKET) : (ctx->peer_capabilities & ~PEER_CAP_SINGLE_SOCKET);
+}
 
-    return sent_bytes;
+// Returns 1 if a single connection is used in both directions with the P2P client (player) at index i, as negotiated
+static int is_single_peer_socket(client_ctx* ctx, int i){
+    return (ctx->peer_capabilities & ctx->session.peers.peer_caps[i] & PEER_CAP_SINGLE_SOCKET) != 0;
 }
 
-/* ----------- UTIL FUNCTIONS ----------- */
+// Returns 1 if we are to connect to the P2P client (player) at index i when setting up the P2P mesh; if both sides may
+// use a single connection, only the client with the lower slot connects to the other
+static int is_peer_dialer(client_ctx* ctx, int i){
+    return !(ctx->peer_capabilities & PEER_CAP_SINGLE_SOCKET) || ctx->session.slot < ctx->session.peers.slot[i];
+}
 
-/* Responsible for decoding the game options from the recieved NEW_GAME message. Note that it is assumed that the game
- * options given have been validated already (in this case, by the server). A detailed outline of the format of the msg
- * is given in the report, on the section about the service_game_request server function (which is responsible for sending
- * the NEW_GAME message).
- *
- * From the message, the port_block_offset is decoded. The port_block_offset is an integer which is added to the default
- * port 8080 so as to obtain a distinct port number for each client. We allocate this by enumerating the clients in the
- * game session from 1 <= i <= n, and giving client i the port offset i, i.e. the resulting port number on which they
- * will open a socket to accept P2P connects will be 8080 + i. The list of IPv4 addresses that follow specifies the
- * clients to which to connect in the P2P network. The offset is also used to prevent a client from connecting to itself
- * (the IPv4 address at position $i$ for the client with port_block_offset i is the IPv4 address of the client itself.
- * This prevents any 'feedback loop' situations that bombard the client with requests.
+/* Sets the format of messages sent to the P2P client (player) at index i to binary if both ends support it, i.e. if
+ * the client has advertised PEER_CAP_BINARY in its PEER_HELLO and so do we. Expects the mutex of the client to be held.
  */
-void handle_new_game_msg(msg recvMsg){
-    // Begin by decoding the game options from the message, converting from string to int and populating the gameSession
-    // struct with the passed game options...
-    char* token = strtok(recvMsg.msg, "::");
-    gameSession.game_type = strtol(token, NULL, 10);
+void negotiate_peer_format(client_ctx* ctx, int i){
+    if(ctx->session.peers.server_fd[i] > 0){
+        int common_caps = ctx->peer_capabilities & ctx->session.peers.peer_caps[i];
+        conn_set_format(ctx->session.peers.server_fd[i], (common_caps & PEER_CAP_BINARY) ? MSG_FORMAT_BINARY : MSG_FORMAT_ASCII);
+    }
+}
 
-    token = strtok(NULL, "::");
-    gameSession.n_baselines = strtol(token, NULL, 10);
+/* Fills addr with the (abstract) Unix domain socket address on which the client accepting P2P connections on the given
+ * port accepts those from clients on the same host (see LOCAL_P2P_NAME), returning the length of the address.
+ */
+static socklen_t local_p2p_address(int port, struct sockaddr_un* addr){
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    int len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, LOCAL_P2P_NAME, port); // sun_path[0] = '\0'
 
-    token = strtok(NULL, "::");
-    gameSession.n_winlines = strtol(token, NULL, 10);
+    return (socklen_t) (offsetof(struct sockaddr_un, sun_path) + 1 + len);
+}
 
-    token = strtok(NULL, "::");
-    gameSession.time = strtol(token, NULL, 10);
+/* Opens the Unix domain socket on which P2P connections from clients on this host are accepted, alongside that listening
+ * on the specified port (see open_p2p_endpoint), or closes it if the local transport is disabled (see
+ * set_local_transport). The socket is in the abstract namespace, hence released as soon as it is closed. On failure,
+ * such clients simply connect over TCP instead.
+ */
+static void open_local_p2p_endpoint(client_ctx* ctx, int port){
+    if(ctx->local_transport == LOCAL_TRANSPORT_NONE && ctx->p2p_local_fd >= 0){
+        close(ctx->p2p_local_fd);
+        ctx->p2p_local_fd = -1;
+    }
+    if(ctx->local_transport == LOCAL_TRANSPORT_NONE || ctx->p2p_local_fd >= 0){ // disabled, or already open
+        return;
+    }
 
-    token = strtok(NULL, "::");
-    gameSession.seed = strtol(token, NULL, 10);
+    struct sockaddr_un addrUn;
+    socklen_t addr_len = local_p2p_address(port, &addrUn);
 
-    // then extract the port block offset and find the port (PORT = 8080) on which to open a socket for P2P connections
-    token = strtok(NULL, "::");
-    int port = PORT + strtol(token, NULL, 10);
+    ctx->p2p_local_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(ctx->p2p_local_fd >= 0 && (bind(ctx->p2p_local_fd, (struct sockaddr*) &addrUn, addr_len) < 0 || listen(ctx->p2p_local_fd, SOMAXCONN) < 0)){
+        smrerror("Local peer-to-peer socket binding failed");
+        close(ctx->p2p_local_fd);
+        ctx->p2p_local_fd = -1;
+    }
+}
 
-    // populate the gameSession struct with default values...
-    gameSession.score = 0;
-    gameSession.game_in_progress = 1; // flag that indicates that game is now in progress
-    gameSession.n_lines_to_add = 0;
-    gameSession.total_lines_cleared = 0;
-    time(&gameSession.start_time);
+/* Opens the socket on which in-game messages are exchanged as datagrams with the clients which support it, bound to the
+ * same port as the socket accepting P2P connections (see open_p2p_endpoint), or closes it if datagrams are disabled (see
+ * set_peer_transport). As with the latter, the socket is kept across game sessions, discarding any datagrams left over.
+ * Datagrams are only advertised to the clients in the session if the socket is open; on failure, every message is hence
+ * sent on the P2P connections as usual.
+ */
+static void open_dgram_p2p_endpoint(client_ctx* ctx, int port){
+    if(ctx->dgram.fd >= 0 && (ctx->peer_transport != PEER_TRANSPORT_DATAGRAM || ctx->dgram_port != port)){
+        close_socket(ctx, ctx->dgram.fd);
+        ctx->dgram.fd = -1;
+    }
 
-    // initially 0 players are in the game; we increment this for every IPv4 address specified in the next part of the
-    // message, so long as the address is distinct from out own public IPv4 address...
-    gameSession.n_players = 0; // if this remains 0, the no P2P required (game mode must be CHILL)
-    token = strtok(NULL, "::");
+    if(ctx->peer_transport == PEER_TRANSPORT_DATAGRAM){
+        if(ctx->dgram.fd >= 0){
+            dgram_drain(&ctx->dgram);
+        }else if(dgram_open(&ctx->dgram, port) < 0){
+            smrerror("Peer-to-peer datagram socket binding failed");
+        }else{
+            ctx->dgram_port = port;
+        }
+    }
 
-    int offset = 1;
-    while(token != NULL){
-        // decode the IPv4 address etc and maintain information, except if it corrsponds to this client
-        // this is in order to prevent the feedback loop situation mentioned earlier
-        if(port != (PORT + offset)){
-            gameSession.players[gameSession.n_players] = malloc(sizeof(ingame_client)); // allocate new client struct
-            gameSession.players[gameSession.n_players]->state = WAITING; // initially not connected to this client in P2P
-            gameSession.players[gameSession.n_players]->port = PORT + offset; // find port on which other client is accepting P2P connections
-            strcpy(gameSession.players[gameSession.n_players]->ip, token); // copy IPv4 address
+    ctx->dgram.slot = ctx->session.slot;
+    ctx->dgram.session = (unsigned int) ctx->session.seed; // shared by every client in the game session
+    ctx->peer_capabilities = ctx->dgram.fd >= 0 ? (ctx->peer_capabilities | PEER_CAP_DATAGRAM) : (ctx->peer_capabilities & ~PEER_CAP_DATAGRAM);
+}
 
-            gameSession.n_players++;
+/* Opens the socket on which P2P connections are accepted, listening on the specified port. The socket outlives the game
+ * session: if it is still bound to the same port from a previous session, it is simply reused, after discarding any
+ * connections left pending from that session (e.g. by clients which dialed late), such that back-to-back sessions require
+ * no new socket. Otherwise, the previous socket (if any) is closed and a new one is bound with SO_REUSEADDR set, such that
+ * binding does not fail on connections of a previous session lingering in the TIME_WAIT state (see the report). Unless
+ * disabled (see set_local_transport), a Unix domain socket accepting connections from clients on this host is likewise
+ * opened alongside it.
+ *
+ * Returns 0 on success, and -1 (without exiting) if the socket could not be opened.
+ */
+static int open_p2p_endpoint(client_ctx* ctx, int port){
+    if(ctx->session.p2p_fd > 0 && ctx->p2p_port == port){
+        int fd; // the sockets are non-blocking, hence this stops as soon as no more connections are pending
+        while((fd = accept(ctx->session.p2p_fd, NULL, NULL)) >= 0){
+            close(fd);
+        }
+        while(ctx->p2p_local_fd >= 0 && (fd = accept(ctx->p2p_local_fd, NULL, NULL)) >= 0){
+            close(fd);
         }
 
-        offset++;
-        token = strtok(NULL, "::");
+        open_local_p2p_endpoint(ctx, port); // in case the local transport has since been enabled or disabled
+        open_dgram_p2p_endpoint(ctx, port);
+        return 0;
     }
 
-    if(gameSession.game_type != CHILL){ // if game mode is not CHILL, setup P2P...
-        // Create socket
-        int p2p_fd = socket(SDOMAIN, TYPE, 0);
-        if(p2p_fd < 0){
-            mrerror("Peer-to-peer socket initialisation failed");
-        }
-
-        // Attempt to allow port re-use to prevent the socket binding error outlines in the report...
-        struct sockaddr_in sockaddrIn = {.sin_family = SDOMAIN, .sin_addr.s_addr = INADDR_ANY, .sin_port = htons(port)};
+    if(ctx->session.p2p_fd > 0){ // listening on a different port in this session
+        close(ctx->session.p2p_fd);
+        ctx->session.p2p_fd = 0;
+        ctx->p2p_port = 0;
+    }
+    if(ctx->p2p_local_fd >= 0){
+        close(ctx->p2p_local_fd);
+        ctx->p2p_local_fd = -1;
+    }
 
-        // Then (in darkness) bind it...
-        if(bind(p2p_fd, (struct sockaddr*) &sockaddrIn, sizeof(sockaddrIn)) < 0){
-            mrerror("Peer-to-peer socket binding failed");
-        }
+    // Create socket
+    int p2p_fd = socket(SDOMAIN, TYPE, 0);
+    if(p2p_fd < 0){
+        smrerror("Peer-to-peer socket initialisation failed");
+        return -1;
+    }
 
-        // Finally, listen.
-        if(listen(p2p_fd, 5) < 0){
-            mrerror("Listening on peer-to-peer socket failed");
-        }
+    // Allow port re-use to prevent the socket binding error outlined in the report...
+    int reuse = 1;
+    setsockopt(p2p_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    socket_apply_profile(p2p_fd, &ctx->sock_profile); // mostly inherited by accepted sockets, e.g. the buffer sizes
+    struct sockaddr_in sockaddrIn = {.sin_family = SDOMAIN, .sin_addr.s_addr = INADDR_ANY, .sin_port = htons(port)};
+
+    // Then (in darkness) bind it...
+    if(bind(p2p_fd, (struct sockaddr*) &sockaddrIn, sizeof(sockaddrIn)) < 0){
+        smrerror("Peer-to-peer socket binding failed");
+        close(p2p_fd);
+        return -1;
+    }
 
-        gameSession.p2p_fd = p2p_fd;
+    // Finally, listen (non-blocking, such that pending connections may be drained by the P2P event loop).
+    if(listen(p2p_fd, SOMAXCONN) < 0){
+        smrerror("Listening on peer-to-peer socket failed");
+        close(p2p_fd);
+        return -1;
+    }
+    fcntl(p2p_fd, F_SETFL, fcntl(p2p_fd, F_GETFL) | O_NONBLOCK);
 
-        // lastly, send a P2P_READY message to the server to indicate that client is ready to accept P2P connections...
-        msg sendMsg;
-        sendMsg.msg_type = P2P_READY;
-        sendMsg.msg = malloc(1);
-        strcpy(sendMsg.msg, "\0");
+    ctx->session.p2p_fd = p2p_fd;
+    ctx->p2p_port = port;
 
-        send_msg(sendMsg, server_fd);
-    }
+    open_local_p2p_endpoint(ctx, port);
+    open_dgram_p2p_endpoint(ctx, port);
+    return 0;
 }
 
-/* Clean-up function that in particular is responsible for disconnecting all P2P clients still connected, sending a final
- * SCORE_UPDATE message to ensure that the server has recieved the final score at the time of completion, send a FINISHED_GAME
- * message, and lastly free any memory as necessary.
+/* Consumes the delimiter "::" following a field of the NEW_GAME message at *p; returns 1 if a delimiter was consumed
+ * (i.e. a further field follows), 0 at the end of the message, and -1 if the field is followed by anything else.
  */
-int end_game(){
-    // initialise new FINISHED_GAME message to send to server and connected P2P clients to flag successful completion
-    msg finished_msg;
-    finished_msg.msg_type = FINISHED_GAME;
-    finished_msg.msg = malloc(1);
-    strcpy(finished_msg.msg, "\0");
+static int parse_delimiter(const char** p){
+    if(**p == '\0'){
+        return 0;
+    }else if((*p)[0] == ':' && (*p)[1] == ':'){
+        *p += 2;
+        return 1;
+    }
 
-    // in a thread--safe manner we update the gameSession struct
-    pthread_mutex_lock(&gameMutex); // obtain mutex lock for gameSession
-    for(int i = 0; i < gameSession.n_players; i++){
-        // if P2P client (player) is connected i.e. not disconnected or finished the game successfully
-        if(gameSession.players[i]->state != DISCONNECTED || gameSession.players[i]->state != FINISHED){
-            send_msg(finished_msg, gameSession.players[i]->server_fd); // send FINISHED_GAME over the P2P to the client
+    return -1;
+}
 
-            // then close any valid sockets associated with the client for bi-directional P2P communication
-            if(gameSession.players[i]->server_fd > 0){ close(gameSession.players[i]->server_fd);}
-            if(gameSession.players[i]->client_fd > 0){ close(gameSession.players[i]->client_fd);}
+/* Parses a (signed) decimal integer field of the NEW_GAME message at *p, advancing *p past it. Returns 0 on success, -1
+ * if the field is empty, contains anything other than digits, or is out of the range of an int.
+ */
+static int parse_int_field(const char** p, int* value){
+    const char* c = *p;
+    int negative = *c == '-';
+    c += negative;
+
+    long long v = 0;
+    const char* digits = c;
+    while(*c >= '0' && *c <= '9'){
+        v = 10 * v + (*c++ - '0');
+        if(v > (long long) INT_MAX + negative){
+            return -1;
         }
-
-        free(gameSession.players[i]); // free memory as necessary
-    }
-
-    if(gameSession.game_type != CHILL){ // if multiplayer, close socket on which we accepted P2P connections
-        close(gameSession.p2p_fd);
     }
-    gameSession.p2p_fd = 0;
 
-    // initialise SCORE_UPDATE message
-    // note that we do not need to use the thread-safe score getter here as we already have the gameSession mutex
-    msg score_msg;
-    score_msg.msg_type = SCORE_UPDATE;
-    score_msg.msg = malloc(7);
-    if(score_msg.msg == NULL){
-        mrerror("Failed to allocate memory for score update to server");
+    if(c == digits){
+        return -1;
     }
-    sprintf(score_msg.msg, "%d", gameSession.score); // and copy last score to the data part of the message
-
-    gameSession.game_in_progress = 0;
-    pthread_mutex_unlock(&gameMutex); // release mutex lock for gameSession
 
-    // send final score update to server
-    send_msg(score_msg, server_fd);
-
-    // signal to server that player is finished
-    return send_msg(finished_msg, server_fd);
+    *value = (int) (negative ? -v : v);
+    *p = c;
+    return 0;
 }
 
-// Sends a LINES_CLEARED message to all connected clients in the P2P network specifying the number of lines cleared in
-// the last move, in a thread--safe manner; the passed integer is assumed to be correct
-void send_cleared_lines(int n_cleared_lines){
-    // initialise new LINES_CLEARED message
-    msg lines_msg;
-    lines_msg.msg_type = LINES_CLEARED;
-    lines_msg.msg = malloc(4);
-    sprintf(lines_msg.msg, "%d", n_cleared_lines); // copy passed int into message data part, convering int to string
-
-    pthread_mutex_lock(&gameMutex); // obtain mutex lock for gameSession
-    for(int i = 0; i < gameSession.n_players; i++){
-        // if P2P client (player) is connected i.e. not disconnected or finished the game successfully
-        if(gameSession.players[i]->state != DISCONNECTED || gameSession.players[i]->state != FINISHED){
-            send_msg(lines_msg, gameSession.players[i]->server_fd); // send to client
+/* Parses an IPv4 address field (in dotted-decimal notation) of the NEW_GAME message at *p into ip, advancing *p past it;
+ * the address is validated as it is copied, rather than through a further pass with inet_pton. Returns 0 on success, -1
+ * if the field is not a valid IPv4 address (which also ensures that it fits in ip).
+ */
+static int parse_ip_field(const char** p, char ip[INET_ADDRSTRLEN]){
+    const char* c = *p;
+    int len = 0;
+
+    for(int octet = 0; octet < 4; octet++){
+        if(octet > 0){
+            if(*c != '.'){
+                return -1;
+            }
+            ip[len++] = *c++;
         }
-    }
-    pthread_mutex_unlock(&gameMutex); // release mutex lock for gameSession
-}
 
-// Thread--safe getter for the score variable in the gameSession struct; returns >= 0 if in a game session, -1 otherwise
-int get_score(){
-    pthread_mutex_lock(&gameMutex); // obtain mutex lock for gameSession
+        int value = 0, n_digits = 0;
+        while(*c >= '0' && *c <= '9' && n_digits < 3 && (n_digits == 0 || value > 0)){ // without leading zeros
+            value = 10 * value + (*c - '0');
+            ip[len++] = *c++;
+            n_digits++;
+        }
 
-    int score = -1; // returns -1 if not in a game session
-    if(gameSession.game_in_progress){ // if in a game session
-        score = gameSession.score; // set score the gameSession.score
+        if(n_digits == 0 || value > 255){
+            return -1;
+        }
     }
 
-    pthread_mutex_unlock(&gameMutex); // release mutex lock for gameSession
-
-    return score; // returns gameSession.score (>= 0) if in a game session
+    ip[len] = '\0'; // at most 15 characters, i.e. within INET_ADDRSTRLEN
+    *p = c;
+    return 0;
 }
 
-// Thread--safe setter for the score variable in the gameSession struct; score is assumed to be valid
-void set_score(int score){
-    pthread_mutex_lock(&gameMutex); // obtain mutex lock for gameSession
-
-    if(gameSession.game_in_progress){ // if in a game session
-        gameSession.score = score; // set gameSession.score to the passed score value
+/* Returns 1 if the client at the given IPv4 address is deemed to be on this host (see set_local_transport), given our
+ * own address as sent by the server, else 0.
+ */
+static int is_local_peer(client_ctx* ctx, const char* ip, const char* self_ip){
+    switch(ctx->local_transport){
+        case LOCAL_TRANSPORT_LOOPBACK: return strncmp(ip, "127.", 4) == 0;
+        case LOCAL_TRANSPORT_SAME_IP: return strncmp(ip, "127.", 4) == 0 || strcmp(ip, self_ip) == 0;
+        default: return 0;
     }
-
-    pthread_mutex_unlock(&gameMutex); // release mutex lock for gameSession
 }
 
-/* Thread--safe getter for the n_lines_to_add variable in the gameSession struct; after a successful call, sets the
- * variable to 0 (i.e. we are assuming that once the lines have been 'fetched', they have been added to the bottom of
- * the playing board). Returns >= 0 if in a game session, -1 otherwise.
+/* Decodes the NEW_GAME message into the game session struct, without opening any sockets nor starting the game (see
+ * handle_new_game_msg). The message has the format
+ *
+ *     game_type::n_baselines::n_winlines::time::seed::slot::ip_1::ip_2:: ... ::ip_n
+ *
+ * and is parsed in a single pass over the data part (which is left untouched, hence the message may be a view into a
+ * receive buffer, and the function is reentrant), with each integer decoded as it is scanned and each IPv4 address copied
+ * directly into its entry of the (pre-allocated) table of clients; the address at position slot is that of the client
+ * itself, and is skipped. Every field is bounds-checked: an empty or malformed field, a run of more than two ':' or an
+ * IPv4 address which does not fit its entry is rejected rather than misread. The table of clients is only grown if the
+ * session is larger than any before it.
+ *
+ * Returns 0 on success, -1 if the message is malformed (in which case session.n_players is 0, and the game options
+ * are left untouched) or the table of clients could not be grown.
  */
-int get_lines_to_add(){
-    pthread_mutex_lock(&gameMutex); // obtain mutex lock for gameSession
+int parse_new_game_msg(client_ctx* ctx, msg recvMsg){
+    const char* p = recvMsg.msg;
+    int options[6]; // game_type, n_baselines, n_winlines, time, seed and slot, in the order in which they are sent
+    char self_ip[INET_ADDRSTRLEN] = "";
+
+    ctx->session.n_players = 0;
+    if(p == NULL){
+        return -1;
+    }
 
-    int n_lines = -1; // returns -1 if not in a game session
-    if(gameSession.game_in_progress){ // if in a game session
-        n_lines = gameSession.n_lines_to_add; // copy current value of n_lines_to_add
-	    gameSession.n_lines_to_add = 0; // then reset it to 0
+    for(int f = 0; f < 6; f++){ // each option is followed by a delimiter, since at least the slot is followed by addresses
+        if(parse_int_field(&p, options + f) < 0 || parse_delimiter(&p) != 1){
+            return -1;
+        }
     }
 
-    pthread_mutex_unlock(&gameMutex); // release mutex lock for gameSession
+    int slot = options[5];
+    if(options[0] < RISING_TIDE || options[0] > CHILL || slot < 1){
+        return -1;
+    }
 
-    return n_lines; // returns number of lines cleared received (>= 0) if in a game session
-}
+    int n_players = 0, more = 1;
+    for(int offset = 1; more; offset++){
+        if(offset == slot){ // the client itself, so as to prevent any 'feedback loop' situations
+            if(parse_ip_field(&p, self_ip) < 0){
+                return -1;
+            }
+        }else{
+            // grow the table of clients if the session is larger than anticipated, rather than overflowing it
+            if(n_players == ctx->session.peers.capacity && peer_table_reserve(ctx, 2 * ctx->session.peers.capacity) < 0){
+                return -1;
+            }
+
+            if(parse_ip_field(&p, ctx->session.peers.ip[n_players]) < 0){
+                return -1;
+            }
 
-// In a thread--safe manner, if in a game session (game_in_progress = 1), we set game_in_progress to 0; return 1 on
-// success, 0 otherwise (if called when not in a game session)
-int signalGameTermination(){
-   int ret = 0; // returns 0 if not in a game session
+            ctx->session.peers.client_fd[n_players] = 0; // no connection with the client yet
+            ctx->session.peers.server_fd[n_players] = 0;
+            ctx->session.peers.state[n_players] = WAITING; // initially not connected to this client in P2P
+            ctx->session.peers.peer_caps[n_players] = 0; // capabilities unknown until its PEER_HELLO
+            ctx->session.peers.slot[n_players] = offset; // slot by which the client identifies itself
+            ctx->session.peers.link_flags[n_players] = 0; // no direction confirmed by the handshake yet
+            ctx->session.peers.link_failure[n_players] = LINK_NO_FAILURE;
+            ctx->session.peers.dial_pending[n_players] = 0;
+            ctx->session.peers.local[n_players] = 0; // determined once our own address is known (see below)
+            ctx->session.peers.rtt_us[n_players] = ctx->session.peers.rtt_var_us[n_players] = 0; // not yet measured
+            ctx->session.peers.last_heard_ms[n_players] = 0;
+            atomic_store(ctx->session.peers.pending_lines + n_players, 0); // no lines yet to be sent to the client
+            ctx->session.peers.port[n_players] = ctx->base_port + offset; // port on which the client accepts P2P connections
+            n_players++;
+        }
 
-    pthread_mutex_lock(&gameMutex); // obtain mutex lock for gameSession
-    if(gameSession.game_in_progress){ // if in a game session
-	    ret = 1; // returns 1 if was in a game session
-        gameSession.game_in_progress = 0; // set to 0 to flag that the game has ended
+        if((more = parse_delimiter(&p)) < 0){
+            return -1;
+        }
     }
-    pthread_mutex_unlock(&gameMutex); // release mutex lock for gameSession
 
-    return ret;
-}
+    for(int i = 0; i < n_players; i++){ // clients on this host are connected to over a Unix domain socket
+        ctx->session.peers.local[i] = is_local_peer(ctx, ctx->session.peers.ip[i], self_ip);
+    }
 
-// ------ THREADED FRONT-END FUNCTIONS ------
+    ctx->session.game_type = options[0];
+    ctx->session.n_baselines = options[1];
+    ctx->session.n_winlines = options[2];
+    ctx->session.time = options[3];
+    ctx->session.seed = options[4];
+    ctx->session.slot = slot; // our slot in the session, by which we identify ourselves to other clients
+    ctx->session.n_players = n_players; // if 0, then no P2P required (game mode must be CHILL)
 
-/* Threaded function for accepting P2P connections during P2P setup, and then handling messages recieved by P2P clients
- * during game play, by calling the appropriate handler functions. To do so, we select across the FDSET of client fds.
+    return 0;
+}
+
+/* Responsible for decoding the game options from the recieved NEW_GAME message (see parse_new_game_msg), and setting up
+ * the game session accordingly. A detailed outline of the format of the msg is given in the report, on the section about
+ * the service_game_request server function (which is responsible for sending the NEW_GAME message).
  *
- * We ignore received messages until the number of clients connected is equal to the number of *active* clients (since
- * clients may disconnect during P2P setup).
+ * From the message, the port_block_offset (slot) is decoded. The port_block_offset is an integer which is added to the
+ * base port (8080 by default) so as to obtain a distinct port number for each client. We allocate this by enumerating the
+ * clients in the game session from 1 <= i <= n, and giving client i the port offset i, i.e. the resulting port number on
+ * which they will open a socket to accept P2P connects will be 8080 + i. The list of IPv4 addresses that follow specifies
+ * the clients to which to connect in the P2P network.
+ *
+ * No memory is allocated unless the session is larger than any before it, and the socket on which P2P connections are
+ * accepted is kept across sessions (see open_p2p_endpoint). Returns 0 on success, and -1 if the message is malformed or
+ * this socket could not be opened, in which case the front-end may quit the session rather than the process exiting.
  */
-void* accept_peer_connections(void* arg){
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL); // maintaining atomic transactions; see report
-
-    // setting up for socket select
-    struct sockaddr_in clientaddrIn;
-    socklen_t sizeof_clientaddrIn = sizeof(struct sockaddr_in);
-    fd_set recv_fds;
-    int nfds;
-
-    int n_connected_players, n_expected_players;
-    // initially the number of connected players is 0 and the number of active players (and hence expected to join) is
-    // equal to n_players i.e. the number of players which joined the game session
-    n_connected_players = 0; n_expected_players = gameSession.n_players;
-
-    // initialise to 0
-    pthread_mutex_lock(&gameMutex);
-    for(int i = 0; i < gameSession.n_players; i++){
-        gameSession.players[i]->client_fd = 0;
+int handle_new_game_msg(client_ctx* ctx, msg recvMsg){
+    if(parse_new_game_msg(ctx, recvMsg) < 0){
+        errno = EINVAL;
+        smrerror("Malformed NEW_GAME message");
+        return -1;
     }
-    pthread_mutex_unlock(&gameMutex); // release mutex lock for gameSession struct
 
-    int select_ret = 0; // maintain return of select; initially set to 0, the default on timeout
-    while(1){
-        pthread_mutex_lock(&gameMutex); // obtain mutex lock for gameSession struct
-        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL); // maintaining atomic transactions; see report
+    int port = ctx->base_port + ctx->session.slot; // port on which to open a socket for P2P connections
+
+    // populate the game session struct with default values...
+    atomic_store(&ctx->session.score, 0);
+    atomic_store(&ctx->score_publish_requested, 0);
+    ctx->published_score = 0; // as far as the server is concerned, every game session starts with a score of 0
+    ctx->score_published_ms = 0;
+    atomic_store(&ctx->session.n_lines_to_add, 0);
+    atomic_store(&ctx->session.total_lines_cleared, 0);
+    atomic_store(&ctx->session.game_in_progress, 1); // flag that indicates that game is now in progress
+    ctx->session.p2p_ready = 0; // P2P_READY is only sent once the P2P mesh is set up, see service_peer_connections
+    time(&ctx->session.start_time);
+    atomic_store(&ctx->new_game_ns, net_stats_enabled() ? net_stats_now_ns() : 0); // the set up of the session is timed
+    atomic_store(&ctx->p2p_ready_ns, 0);
+    atomic_store(&ctx->start_game_ns, 0);
+
+    if(ctx->session.game_type != CHILL){ // if game mode is not CHILL, setup P2P...
+        if(open_p2p_endpoint(ctx, port) < 0){
+            return -1;
+        }
 
-        if(!gameSession.game_in_progress){ // if game not in progress i.e. has terminated, break
-            pthread_mutex_unlock(&gameMutex); // release mutex lock for gameSession struct
-            break;
+        for(int i = 0; i < ctx->session.n_players; i++){ // datagrams are sent to the port on which each accepts connections
+            dgram_link_reset(ctx->session.peers.dgram + i, ctx->session.peers.ip[i], ctx->session.peers.port[i]);
         }
-        pthread_mutex_unlock(&gameMutex); // release mutex lock for gameSession struct
 
-        // set up FD_SET to select on;
-        FD_ZERO(&recv_fds); // first zero out
-        FD_SET(gameSession.p2p_fd, &recv_fds); // add the fd on which we accept p2p connections
-        nfds = gameSession.p2p_fd; // maintain highest fd in FD_SET recv_fds
+        // if attached to the I/O engine, it sets up the P2P mesh itself (see step_engine_client)
+        if(atomic_load(&ctx->engine_running)){
+            atomic_store(&ctx->engine_session_pending, 1);
+            reactor_wake(&ctx->loop->reactor);
+        }
 
-        // populate timeval struct for a 1 second timeout, to be used with the select call (i.e. non-blocking call)
-        struct timeval timeout;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+        // note that P2P_READY is not sent to the server at this point, but rather by service_peer_connections, once every
+        // connection with the other clients has been confirmed in both directions (or has failed)
+    }
 
-        // begin iterating through the player instances in the game and if connected, add to FD_SET recv_fds
-        for(int i = 0; i < gameSession.n_players; i++){
-            pthread_mutex_lock(clientMutexes + i); // obtain mutex lock for client in gameSession struct
+    return 0;
+}
 
-            // if client is still connected and in the game session
-            if(gameSession.players[i]->state != DISCONNECTED || gameSession.players[i]->state != FINISHED){
-                // and if the client has a valid client_fd
-                if(gameSession.players[i]->client_fd > 0){
-                    FD_SET(gameSession.players[i]->client_fd, &recv_fds); // then add to FD_SET recv_fds
-                }
+// Returns 1 if in-game messages are sent to the P2P client (player) at index i as datagrams, i.e. if both ends support it
+static int is_datagram_peer(client_ctx* ctx, int i){
+    return (ctx->peer_capabilities & ctx->session.peers.peer_caps[i] & PEER_CAP_DATAGRAM) != 0;
+}
 
-                // since nfds initially set to 0, then nfds >= 0 always
-                // i.e. gets updated only if gameSession.players[i]->client_fd > 0
-                // i.e. gets updated only if client_fd is valid, as above when adding to FD_SET recv_fds
-                if(nfds < gameSession.players[i]->client_fd){ // maintain highest fd in FD_SET recv_fds
-                    nfds = gameSession.players[i]->client_fd;
-                }
-            }else{ // else if no longer in game session (FINISHED or DISCONNECTED)
-                n_expected_players--; // the number of expected players is 1 less
+/* Waits (for up to DGRAM_LINGER_MS) until every message sent as a datagram to the clients still connected has been
+ * acknowledged, while the P2P event loop keeps retransmitting them, such that ending the game (and with it the event
+ * loop) does not lose the last lines cleared; messages still on the P2P connections are instead flushed by end_game.
+ */
+static void linger_peer_datagrams(client_ctx* ctx){
+    long long deadline_ns = net_stats_now_ns() + DGRAM_LINGER_MS * 1000000LL;
+    int n_pending = 1;
+
+    while(n_pending > 0 && atomic_load(&ctx->session.game_in_progress) && net_stats_now_ns() < deadline_ns){
+        n_pending = 0;
+        for(int i = 0; i < ctx->session.n_players; i++){
+            pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex lock for client in game session struct
+            if(ctx->session.peers.state[i] == CONNECTED && is_datagram_peer(ctx, i)){
+                n_pending += ctx->session.peers.dgram[i].n_pending;
             }
+            pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex lock for client in game session struct
+        }
 
-            pthread_mutex_unlock(clientMutexes + i); // release mutex lock for client in gameSession struct
+        if(n_pending > 0){
+            usleep(1000);
         }
+    }
+}
 
-        select_ret = select(nfds + 1, &recv_fds, NULL, NULL, &timeout); // select on the FD_SET recv_fds
+static void disconnect_peer(client_ctx* ctx, int i, int state, int failure);
 
-        // on timeout of select, simply continue, restarting the while loop, ready to wait again for some data to be recieved
-        if(select_ret <= 0){
-            continue;
-        }
-        /* otherwise if the following are satisfied:
-         * (i)   select returned successfully i.e. there are 1 >= bytes to be recieved from one of the sockets in FD_SET recv_fds
-         * (ii)  p2p_fd is set in the FD_SET recv_fds
-         * (iii) n_connected_players < n_expected_players
-         * there there is some game session client ready to connect to this client's P2P server, forming one direction of
-         * the bi-directional connection.
-         */
-        else if(FD_ISSET(gameSession.p2p_fd, &recv_fds) && n_connected_players < n_expected_players){
-            // accept the connection
-            int client_fd = accept(gameSession.p2p_fd, (struct sockaddr*) &clientaddrIn, &sizeof_clientaddrIn);
-
-            // maintain the ip address of the client of the accepted connection
-            char ip[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &clientaddrIn.sin_addr, ip, INET_ADDRSTRLEN);
-
-            // traverse the players array to find the game session client with the matching ip address and which have
-            // not already joined this client's P2P server
-            for(int i = 0; i < gameSession.n_players; i++){
-                if(strcmp(gameSession.players[i]->ip, ip) == 0 && gameSession.players[i]->client_fd == 0){
-                    // if match found, then update with the connection settings
-
-                    pthread_mutex_lock(clientMutexes + i); // obtain mutex lock for client in gameSession struct
-                    gameSession.players[i]->state = CONNECTED; // flag as connected
-                    gameSession.players[i]->client_fd = client_fd; // and keep a reference to the fd returned by accept
-                    pthread_mutex_unlock(clientMutexes + i); // release mutex lock for client in gameSession struct
-
-                    n_connected_players++; // number of connected players (p2p clients) has increased by 1
-                    break;
-                }
-            }
-        // else if the number of connect players is equal to the number of expected players, we accept messages from the
-        // p2p clients (players) whose fd is set in the FD_SET recv_fds (there must be at least one since we enter this
-        // case only if select returns > 0 and no new connections are expected on p2p_fd).
-        }else if(n_connected_players == n_expected_players){
-            for(int i = 0; i < gameSession.n_players; i++){
-                pthread_mutex_lock(clientMutexes + i); // obtain mutex lock for client in gameSession struct
-                if(FD_ISSET(gameSession.players[i]->client_fd, &recv_fds)){
-                    // fetch message using the recv_msg function
-                    msg recv_client_msg = recv_msg(gameSession.players[i]->client_fd);
-
-                    if(recv_client_msg.msg_type == INVALID){ // if fetched successfully (i.e. sender did not disconnect)
-                        gameSession.players[i]->state = DISCONNECTED; // flag sender as disconnected
-                        if(gameSession.players[i]->client_fd > 0){ // if valid client_fd
-                            close(gameSession.players[i]->client_fd); // then close
-                        }
-                        gameSession.players[i]->client_fd = 0; // and set to 0
-
-                        if(gameSession.players[i]->server_fd > 0){ // if valid server_fd
-                            close(gameSession.players[i]->server_fd); // then close
-                        }
-                        gameSession.players[i]->server_fd = 0; // and set to 0
-
-                    }else{ // otherwise is message received successfully, check type and handle accordingly
-                        switch(recv_client_msg.msg_type){
-                            // if FINISHED_GAME message, then flag sender as finished and close connection
-                            case FINISHED_GAME: gameSession.players[i]->state = FINISHED; // flag as finished
-			                                    if(gameSession.players[i]->client_fd > 0){ // if valid client_fd
-			                                        close(gameSession.players[i]->client_fd); // then close
-			                                    }
-			                                    gameSession.players[i]->client_fd = 0; // and set to 0
-
-                       				            if(gameSession.players[i]->server_fd > 0){ // if valid server_fd
-                       				                close(gameSession.players[i]->server_fd); // then close
-                       				            }
-                       				            gameSession.players[i]->server_fd = 0; // and set to 0
-
-                       				            break;
-                       		// else if LINES_CLEARED message, add number of lines cleared by sender to n_lines_to_add in
-                       		// a thread-safe manner
-                            case LINES_CLEARED: pthread_mutex_lock(&gameMutex); // obtain mutex lock for gameSession struct
-                                                // decode number of lines cleared by sender and add to count
-                                                gameSession.n_lines_to_add += strtol(recv_client_msg.msg, NULL, 10);
-                                                pthread_mutex_unlock(&gameMutex); // release mutex lock for gameSession struct
-                                                break;
-
-                        }
-                    }
-                }
-                pthread_mutex_unlock(clientMutexes + i); // release mutex lock for client in gameSession struct
+/* Clean-up function that in particular is responsible for disconnecting all P2P clients still connected, sending a final
+ * SCORE_UPDATE message to ensure that the server has recieved the final score at the time of completion (whether or not
+ * it was already published, see publish_score), and lastly send a FINISHED_GAME message. No memory is allocated in doing so.
+ *
+ * The game is flagged as no longer in progress (and the P2P event loop woken up) before any socket is closed, such that
+ * the timers of the event loop stop; each client is then disconnected under its mutex (see disconnect_peer), such that
+ * its sockets are never used by the event loop once closed (nor, once reused by another socket, closed a second time).
+ */
+int end_game(client_ctx* ctx){
+    // FINISHED_GAME message to send to server and connected P2P clients to flag successful completion (with an empty
+    // data part, hence requiring no allocation)
+    msg finished_msg = {.msg_type = FINISHED_GAME, .msg = ""};
+
+    // messages sent as datagrams may still be awaiting acknowledgement, and hence retransmission by the P2P event loop
+    linger_peer_datagrams(ctx);
+
+    // keep the last score for the final SCORE_UPDATE message
+    // note that we do not use the score getter here, since it returns -1 once the game is no longer in progress
+    pthread_mutex_lock(&ctx->gameMutex); // obtain mutex lock for game session
+    int score = atomic_load(&ctx->session.score);
+
+    // the P2P event loop only publishes the score while the game is in progress, hence no (older) score may follow the
+    // final one
+    atomic_store(&ctx->session.game_in_progress, 0);
+    atomic_store(&ctx->score_publish_requested, 0);
+    pthread_mutex_unlock(&ctx->gameMutex); // release mutex lock for game session
+
+    reactor_wake(&ctx->loop->reactor); // such that accept_peer_connections notices the termination immediately
+
+    for(int i = 0; i < ctx->session.n_players; i++){
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex lock for client in game session struct
+        // if P2P client (player) is connected i.e. not disconnected or finished the game successfully (and a connection
+        // to it was made at all)
+        if(ctx->session.peers.state[i] != DISCONNECTED && ctx->session.peers.state[i] != FINISHED &&
+           ctx->session.peers.server_fd[i] > 0){
+            // first send anything still queued for the client by the P2P event loop, and any lines not yet handed over
+            // to it, such that they are not lost (nor interleaved with the FINISHED_GAME message)
+            int n_lines = atomic_exchange(ctx->session.peers.pending_lines + i, 0);
+            if(conn_flush(ctx->session.peers.server_fd[i], 1) > 0 && n_lines > 0){
+                conn_send_int(ctx->session.peers.server_fd[i], LINES_CLEARED, n_lines);
             }
+            send_msg(finished_msg, ctx->session.peers.server_fd[i]); // send FINISHED_GAME over the P2P to the client
         }
 
-        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL); // maintaining atomic transactions; see report
+        // then close any valid sockets associated with the client for bi-directional P2P communication (a single
+        // connection may be used in both directions, in which case it is only closed once), unless already closed; a
+        // client still being connected to (e.g. if the game ended before the P2P network was set up) is reported as such
+        if(ctx->session.peers.state[i] != DISCONNECTED && ctx->session.peers.state[i] != FINISHED){
+            int connected = ctx->session.peers.state[i] == CONNECTED;
+            disconnect_peer(ctx, i, connected ? FINISHED : DISCONNECTED, LINK_SESSION_ENDED);
+        }
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex lock for client in game session struct
     }
 
-    pthread_exit(NULL);
+    // note that the socket on which we accepted P2P connections is kept open for the next session (see open_p2p_endpoint)
+
+    notify_event(ctx, EVENT_GAME_FINISHED);
+
+    // send final score update to server (encoded into a stack buffer, see conn_send_int)
+    conn_send_int(ctx->server_fd, SCORE_UPDATE, score);
+
+    // signal to server that player is finished
+    return send_msg(finished_msg, ctx->server_fd);
 }
 
-/* Threaded function for connecting with each client's P2P server, during P2P setup of a game session, forming one
- * direction of the bi--directional fully connected mesh network. Observe that no handshake is carried out between the
- * clients; as outlined in the limitations section, this may result in a one-direction connection instead of a bi-directional
- * one, as one party may not successfully manage to connect with the other.
- *
- * Side note: Since this function, at the moment, only requires handling of connecting with clients during P2P setup,
- * it is relatively 'short lived'. For this reason, the front--end implementation does not execute this function in its
- * own thread. Rather, it is executed in the main thread. However, if a more robust handshaking mechanism as discussed
- * in the final chapter of the report is to be implemented, then this function would almost definitely have to run in its
- * own thread. The design then is such that we keep this future extension in mind.
- *
- * Updating to the gameSession struct is carried out in a thread--safe manner (even if executing in the main thread --
- * there might be other spawned threads!)
+/* Sends a LINES_CLEARED message to all connected clients in the P2P network specifying the number of lines cleared in
+ * the last move; the passed integer is assumed to be correct. The lines are only accumulated for each client and handed
+ * over to the P2P event loop (see flush_cleared_lines), such that the caller never blocks on a (slow) client nor holds
+ * any lock while doing so; lines cleared in quick succession are then coalesced into a single message per client.
  */
-void* service_peer_connections(void* arg){
-    // for each client in the game session
-    for(int i = 0; i < gameSession.n_players; i++){
-        // call client_connect with the specified IP and port as determined from the NEW_GAME message recieved prior
-        int client_server_fd = client_connect(gameSession.players[i]->ip, gameSession.players[i]->port);
+void send_cleared_lines(client_ctx* ctx, int n_cleared_lines){
+    if(n_cleared_lines <= 0 || !atomic_load(&ctx->session.game_in_progress)){ // nothing is sent outside of a game session
+        return;
+    }
 
-        if(client_server_fd < 0){ // if client_connect was succesful (>= 0 implies a valid fild descriptor returned)
-            pthread_mutex_lock(clientMutexes + i); // obtain mutex for the client in the game session struct
-            gameSession.players[i]->state = DISCONNECTED; // flag as disconnected (so we do not attempt further communication)
+    atomic_fetch_add(&ctx->session.total_lines_cleared, n_cleared_lines);
 
-            // and close any valid file descriptors
-            if(gameSession.players[i]->client_fd > 0){ close(gameSession.players[i]->client_fd);} gameSession.players[i]->client_fd = 0;
-            if(gameSession.players[i]->server_fd > 0){ close(gameSession.players[i]->server_fd);} gameSession.players[i]->server_fd = 0;
+    for(int i = 0; i < ctx->session.n_players; i++){
+        atomic_fetch_add_explicit(ctx->session.peers.pending_lines + i, n_cleared_lines, memory_order_relaxed);
+    }
 
-            pthread_mutex_unlock(clientMutexes + i); // release mutex for the client in the game session struct
-        }
-        else{
-            pthread_mutex_lock(clientMutexes + i); // obtain mutex for the client in the game session struct
-            gameSession.players[i]->server_fd = client_server_fd; // set reference to server_fd to the returned fd by client_connect
-            pthread_mutex_unlock(clientMutexes + i); // release mutex for the client in the game session struct
+    // wake up the event loop, unless it has already been woken up and has not flushed since (in which case the lines
+    // are only sent once it does, which is timed from the first call since the last flush)
+    if(net_stats_enabled() && !atomic_load_explicit(&ctx->lines_flush_requested, memory_order_acquire)){
+        atomic_store_explicit(&ctx->lines_pending_since_ns, net_stats_now_ns(), memory_order_relaxed);
+    }
+    if(!atomic_exchange_explicit(&ctx->lines_flush_requested, 1, memory_order_acq_rel)){
+        reactor_wake(&ctx->loop->reactor);
+    }
+}
+
+// Thread--safe (lock-free) getter for the score variable in the game session struct; returns >= 0 if in a game session,
+// -1 otherwise
+int get_score(client_ctx* ctx){
+    int score = -1; // returns -1 if not in a game session
+    if(atomic_load(&ctx->session.game_in_progress)){ // if in a game session
+        score = atomic_load(&ctx->session.score); // set score the session.score
+    }
+
+    return score; // returns session.score (>= 0) if in a game session
+}
+
+/* Thread--safe (lock-free) setter for the score variable in the game session struct; score is assumed to be valid. The
+ * score is published to the server by the thread reading from it (see publish_score), i.e. enqueue_server_msg or the I/O
+ * engine, which is only woken up on the first change since it last published; the caller hence never blocks on the
+ * server, however often the score changes.
+ */
+void set_score(client_ctx* ctx, int score){
+    if(atomic_load(&ctx->session.game_in_progress)){ // if in a game session
+        atomic_store(&ctx->session.score, score); // set session.score to the passed score value
+
+        if(ctx->score_update_interval_ms > 0 && !atomic_exchange_explicit(&ctx->score_publish_requested, 1, memory_order_acq_rel)){
+            if(atomic_load(&ctx->engine_running)){
+                reactor_wake(&ctx->loop->reactor);
+            }else{
+                eventfd_write(ctx->score_wake_fd, 1);
+            }
+        }
+    }
+}
+
+/* Thread--safe (lock-free) getter for the n_lines_to_add variable in the game session struct; after a successful call,
+ * sets the variable to 0 (i.e. we are assuming that once the lines have been 'fetched', they have been added to the
+ * bottom of the playing board). The variable is read and reset in a single atomic exchange, such that no lines added
+ * concurrently by the P2P event loop are lost. Returns >= 0 if in a game session, -1 otherwise.
+ */
+int get_lines_to_add(client_ctx* ctx){
+    int n_lines = -1; // returns -1 if not in a game session
+    if(atomic_load(&ctx->session.game_in_progress)){ // if in a game session
+        n_lines = atomic_exchange(&ctx->session.n_lines_to_add, 0); // copy current value of n_lines_to_add and reset it to 0
+    }
+
+    return n_lines; // returns number of lines cleared received (>= 0) if in a game session
+}
+
+// Returns the socket connected to the server (see client_connect), or -1 if not connected
+int get_server_fd(client_ctx* ctx){
+    return ctx->server_fd;
+}
+
+/* Returns the game session struct of the client instance, e.g. for the front-end to read the players in the session
+ * after handling a NEW_GAME message. Fields shared with the P2P event loop must be accessed as documented in the struct
+ * (i.e. atomically, or under the mutex of the respective client).
+ */
+game_session* get_game_session(client_ctx* ctx){
+    return &ctx->session;
+}
+
+// In a thread--safe (lock-free) manner, if in a game session (game_in_progress = 1), we set game_in_progress to 0;
+// return 1 on success, 0 otherwise (if called when not in a game session)
+int signalGameTermination(client_ctx* ctx){
+    int ret = atomic_exchange(&ctx->session.game_in_progress, 0) != 0; // returns 1 if was in a game session
+
+    reactor_wake(&ctx->loop->reactor); // such that accept_peer_connections notices the termination immediately
+    if(ret){
+        notify_event(ctx, EVENT_GAME_FINISHED);
+    }
+
+    return ret;
+}
+
+// ------ THREADED FRONT-END FUNCTIONS ------
+
+/* Notifies service_peer_connections (if waiting for the P2P mesh to be set up) that the state of some connection with a
+ * P2P client has changed. May be called while holding the mutex of a client, but not the mesh mutex.
+ */
+static void signal_mesh_change(client_ctx* ctx){
+    pthread_mutex_lock(&ctx->meshMutex);
+    ctx->mesh_generation++;
+    pthread_cond_broadcast(&ctx->meshCond);
+    pthread_mutex_unlock(&ctx->meshMutex);
+}
+
+/* Closes any valid sockets associated with the P2P client (player) at index i, and flags it with the given state (i.e.
+ * DISCONNECTED or FINISHED) such that no further communication is attempted. If the connection had not yet been confirmed
+ * in both directions, the reason for the failure is recorded. Expects the mutex of the client to be held.
+ */
+static void disconnect_peer(client_ctx* ctx, int i, int state, int failure){
+    ctx->session.peers.state[i] = state;
+    if(ctx->session.peers.link_flags[i] != LINK_BOTH && ctx->session.peers.link_failure[i] == LINK_NO_FAILURE){
+        ctx->session.peers.link_failure[i] = failure;
+    }
+
+    if(ctx->session.peers.client_fd[i] > 0){ // if valid client_fd
+        close_socket(ctx, ctx->session.peers.client_fd[i]); // then close (implicitly removing it from the event loop)
+    }
+
+    // if valid server_fd (and not the same connection as client_fd, which has already been closed)
+    if(ctx->session.peers.server_fd[i] > 0 && ctx->session.peers.server_fd[i] != ctx->session.peers.client_fd[i]){
+        close_socket(ctx, ctx->session.peers.server_fd[i]); // then close (implicitly removing it from the event loop)
+    }
+    ctx->session.peers.server_fd[i] = 0; // and set to 0
+    ctx->session.peers.client_fd[i] = 0; // and set to 0
+    ctx->session.peers.dial_pending[i] = 0;
+
+    signal_mesh_change(ctx);
+    notify_event(ctx, EVENT_PEER_STATE);
+}
+
+/* Flags the given direction(s) of the connection with the P2P client (player) at index i as confirmed by the handshake;
+ * once both directions are confirmed, the client is flagged as connected. Expects the mutex of the client to be held.
+ */
+static void confirm_peer_link(client_ctx* ctx, int i, int link_flag){
+    ctx->session.peers.link_flags[i] |= link_flag;
+    if(ctx->session.peers.link_flags[i] == LINK_BOTH && ctx->session.peers.state[i] == WAITING){
+        ctx->session.peers.state[i] = CONNECTED;
+        ctx->session.peers.last_heard_ms[i] = net_stats_now_ns() / 1000000; // start of the heartbeat window
+        notify_event(ctx, EVENT_PEER_STATE);
+    }
+
+    signal_mesh_change(ctx);
+}
+
+static void sent_peer_lines(client_ctx* ctx, int i, int ret);
+
+/* Sends the lines cleared since the last flush to the P2P client (player) at index i as a single LINES_CLEARED datagram,
+ * to be retransmitted until acknowledged (see service_peer_datagrams). If too many datagrams are still awaiting
+ * acknowledgement, the lines are instead kept (coalesced with any which follow) until some are acknowledged. Expects the
+ * mutex of the client to be held.
+ */
+static void send_peer_datagram_lines(client_ctx* ctx, int i){
+    int n_lines = atomic_exchange_explicit(ctx->session.peers.pending_lines + i, 0, memory_order_relaxed);
+    if(n_lines <= 0){
+        return;
+    }
+
+    if(dgram_send_int(&ctx->dgram, ctx->session.peers.dgram + i, LINES_CLEARED, n_lines)){
+        sent_peer_lines(ctx, i, 0);
+    }else{
+        atomic_fetch_add_explicit(ctx->session.peers.pending_lines + i, n_lines, memory_order_relaxed);
+    }
+}
+
+/* Queues the lines cleared since the last flush for the P2P client (player) at index i as a single LINES_CLEARED message.
+ * If the client has not yet taken all the bytes previously sent to it, nothing further is queued until the socket becomes
+ * writable (see handle_peer_msgs), the lines meanwhile being coalesced with any which follow. Returns 1 if a message was
+ * queued (to be sent by the caller), 0 otherwise. Expects the mutex of the client to be held.
+ */
+static int queue_peer_lines(client_ctx* ctx, int i){
+    int fd = ctx->session.peers.server_fd[i];
+
+    if(ctx->session.peers.state[i] == DISCONNECTED || ctx->session.peers.state[i] == FINISHED){
+        atomic_store_explicit(ctx->session.peers.pending_lines + i, 0, memory_order_relaxed); // no further communication is attempted
+        return 0;
+    }else if(is_datagram_peer(ctx, i) && ctx->session.peers.dgram[i].confirmed){
+        send_peer_datagram_lines(ctx, i);
+        return 0;
+    }else if(fd <= 0 || conn_has_queued(fd)){
+        return 0;
+    }
+
+    int n_lines = atomic_exchange_explicit(ctx->session.peers.pending_lines + i, 0, memory_order_relaxed);
+    if(n_lines > 0 && conn_queue_int(fd, LINES_CLEARED, n_lines) < 0){
+        disconnect_peer(ctx, i, DISCONNECTED, LINK_PEER_CLOSED);
+        return 0;
+    }
+
+    return n_lines > 0;
+}
+
+// Handles the result (as returned by conn_flush) of sending the lines queued by queue_peer_lines to the client at index i
+static void sent_peer_lines(client_ctx* ctx, int i, int ret){
+    if(ret < 0){
+        disconnect_peer(ctx, i, DISCONNECTED, LINK_PEER_CLOSED);
+    }else if(net_stats_enabled()){
+        long long since_ns = atomic_load_explicit(&ctx->lines_pending_since_ns, memory_order_relaxed);
+        if(since_ns > 0){
+            net_histogram_record(&ctx->lines_send_latency, net_stats_now_ns() - since_ns);
+        }
+    }
+}
+
+/* Sends the lines cleared since the last flush to the P2P client (player) at index i as a single LINES_CLEARED message,
+ * without blocking (see queue_peer_lines). Expects the mutex of the client to be held.
+ */
+static void flush_peer_lines(client_ctx* ctx, int i){
+    if(queue_peer_lines(ctx, i)){
+        sent_peer_lines(ctx, i, conn_flush(ctx->session.peers.server_fd[i], 0));
+    }
+}
+
+/* Sends the lines accumulated by send_cleared_lines to every client in the P2P network; called by the P2P event loop.
+ * If the I/O engine runs on io_uring (see io_engine_create), the messages to all clients are sent together with a single
+ * system call (see conn_flush_batch), the mutex of each client in the batch being held until it is sent.
+ */
+static void flush_cleared_lines(client_ctx* ctx){
+    // nothing is sent once the game has ended (the sockets of the clients being closed, or about to be, by end_game)
+    if(!atomic_exchange_explicit(&ctx->lines_flush_requested, 0, memory_order_acq_rel) ||
+       !atomic_load(&ctx->session.game_in_progress)){
+        return;
+    }
+
+    if(ctx->engine == NULL || !ctx->engine->batch_sends){
+        for(int i = 0; i < ctx->session.n_players; i++){
+            pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex lock for client in game session struct
+            flush_peer_lines(ctx, i);
+            pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex lock for client in game session struct
+        }
+        return;
+    }
+
+    int n_batch = 0, batch_size = ctx->session.n_players > 0 ? ctx->session.n_players : 1;
+    int fds[batch_size], player_idxs[batch_size], results[batch_size];
+    for(int i = 0; i < ctx->session.n_players; i++){
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex lock for client in game session struct (in order of index)
+        if(queue_peer_lines(ctx, i)){
+            fds[n_batch] = ctx->session.peers.server_fd[i];
+            player_idxs[n_batch++] = i;
+        }else{
+            pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex lock for client in game session struct
+        }
+    }
+
+    conn_flush_batch(&ctx->engine->ring, fds, n_batch, results);
+    for(int k = 0; k < n_batch; k++){
+        sent_peer_lines(ctx, player_idxs[k], results[k]);
+        pthread_mutex_unlock(ctx->clientMutexes + player_idxs[k]); // release mutex lock for client in game session struct
+    }
+}
+
+// Returns the current time of the monotonic clock in microseconds, modulo 2^31, as carried by PEER_PING (see protocol.h)
+static int heartbeat_now_us(){
+    return (int) ((net_stats_now_ns() / 1000) & 0x7FFFFFFF);
+}
+
+/* Updates the round-trip time estimate of the connection with the P2P client (player) at index i, given the integer
+ * echoed by a PEER_PONG (i.e. the time at which the PEER_PING was sent). The estimate and its mean deviation are smoothed
+ * as for the TCP retransmission timer (with gains 1/8 and 1/4, see RFC 6298). Expects the mutex of the client to be held.
+ */
+static void update_peer_rtt(client_ctx* ctx, int i, int ping_us){
+    int sample_us = (heartbeat_now_us() - ping_us) & 0x7FFFFFFF;
+    int* rtt_us = ctx->session.peers.rtt_us + i;
+    int* rtt_var_us = ctx->session.peers.rtt_var_us + i;
+
+    if(*rtt_us == 0){ // first measurement
+        *rtt_us = sample_us > 0 ? sample_us : 1;
+        *rtt_var_us = sample_us / 2;
+    }else{
+        int deviation = *rtt_us > sample_us ? *rtt_us - sample_us : sample_us - *rtt_us;
+        *rtt_var_us = (3 * *rtt_var_us + deviation) / 4;
+        *rtt_us = (7 * *rtt_us + sample_us) / 8 > 0 ? (7 * *rtt_us + sample_us) / 8 : 1;
+    }
+}
+
+/* Sends a PEER_PING to every connected P2P client which supports heartbeats (see PEER_CAP_HEARTBEAT) once every heartbeat
+ * interval, and disconnects any such client from which nothing has been heard for heartbeat_max_missed intervals. A
+ * client which vanished without closing its connection (e.g. on a crash of its host, or a lost route) is hence detected
+ * within a few intervals, rather than lines being sent into the connection indefinitely. Called by the P2P event loop;
+ * returns the time in milliseconds until it is next due, or -1 if heartbeats are disabled.
+ */
+static int service_heartbeats(client_ctx* ctx){
+    if(ctx->heartbeat_interval_ms <= 0){
+        return -1;
+    }
+
+    long long now_ms = net_stats_now_ns() / 1000000;
+    if(now_ms < ctx->next_heartbeat_ms){
+        return (int) (ctx->next_heartbeat_ms - now_ms);
+    }
+    ctx->next_heartbeat_ms = now_ms + ctx->heartbeat_interval_ms;
+
+    long long dead_after_ms = (long long) ctx->heartbeat_interval_ms * ctx->heartbeat_max_missed;
+    int ping_us = heartbeat_now_us();
+    for(int i = 0; i < ctx->session.n_players; i++){
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex lock for client in game session struct
+        int fd = ctx->session.peers.server_fd[i];
+        if(ctx->session.peers.state[i] == CONNECTED && (ctx->session.peers.peer_caps[i] & PEER_CAP_HEARTBEAT)){
+            if(now_ms - ctx->session.peers.last_heard_ms[i] > dead_after_ms){
+                ctx->session.peers.link_failure[i] = LINK_HEARTBEAT_TIMEOUT;
+                disconnect_peer(ctx, i, DISCONNECTED, LINK_HEARTBEAT_TIMEOUT);
+            }
+            // unless the client has not yet taken the bytes previously sent to it (in which case a ping would not tell
+            // us anything more)
+            else if(!conn_has_queued(fd) && (conn_queue_int(fd, PEER_PING, ping_us) < 0 || conn_flush(fd, 0) < 0)){
+                disconnect_peer(ctx, i, DISCONNECTED, LINK_PEER_CLOSED);
+            }
+        }
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex lock for client in game session struct
+    }
+
+    return ctx->heartbeat_interval_ms;
+}
+
+/* Retransmits the messages sent as datagrams to the clients in the game session which have not been acknowledged in
+ * time, and probes the clients with which datagrams are not yet known to get through (see dgram_service). Called by the
+ * P2P event loop; returns the time in milliseconds until it is next due, or -1 if nothing is awaiting acknowledgement.
+ */
+static int service_peer_datagrams(client_ctx* ctx){
+    if(ctx->dgram.fd < 0){
+        return -1;
+    }
+
+    long long now_ns = net_stats_now_ns();
+    int next_ms = -1;
+    for(int i = 0; i < ctx->session.n_players; i++){
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex lock for client in game session struct
+        if(ctx->session.peers.state[i] == CONNECTED && is_datagram_peer(ctx, i)){
+            int ms = dgram_service(&ctx->dgram, ctx->session.peers.dgram + i, now_ns);
+            if(ms >= 0 && (next_ms < 0 || ms < next_ms)){
+                next_ms = ms;
+            }
+        }
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex lock for client in game session struct
+    }
+
+    return next_ms;
+}
+
+// Returns the earlier of two timers (in milliseconds, -1 if not due at all)
+static int earliest_timer_ms(int a_ms, int b_ms){
+    return a_ms < 0 || (b_ms >= 0 && b_ms < a_ms) ? b_ms : a_ms;
+}
+
+// Services every timer of the P2P network (heartbeats and retransmissions); returns the time in milliseconds until the
+// earliest is next due, or -1 if none is
+static int service_peer_timers(client_ctx* ctx){
+    return earliest_timer_ms(service_heartbeats(ctx), service_peer_datagrams(ctx));
+}
+
+// Returns the index of the P2P client (player) with the given session slot, or -1 if none
+static int peer_index_by_slot(client_ctx* ctx, int slot){
+    for(int i = 0; i < ctx->session.n_players; i++){
+        if(ctx->session.peers.slot[i] == slot){
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Event loop handler for the datagram socket of the client instance arg (see open_dgram_p2p_endpoint). Every datagram
+ * received is handled (see dgram_handle), delivering the message it carries unless it is a duplicate, until the socket is
+ * drained. Only then is each client which sent any datagram acknowledged, with a single datagram covering all of them;
+ * lines cleared meanwhile are sent along, if they had been held back for lack of acknowledgements.
+ */
+static void handle_peer_datagrams(int fd, unsigned int events, void* arg){
+    (void) fd; (void) events;
+    client_ctx* ctx = arg;
+    dgram_packet packet;
+
+    while(dgram_recv(&ctx->dgram, &packet) > 0){
+        int i = peer_index_by_slot(ctx, packet.slot);
+        if(i < 0){
+            continue;
+        }
+
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex lock for client in game session struct
+        // datagrams are handled until the client is disconnected; a client which has finished may still be owed acks
+        if(ctx->session.peers.state[i] != DISCONNECTED && is_datagram_peer(ctx, i)){
+            if(dgram_handle(ctx->session.peers.dgram + i, &packet) && packet.msg.msg_type == LINES_CLEARED){
+                atomic_fetch_add(&ctx->session.n_lines_to_add, msg_get_int(packet.msg));
+                notify_event(ctx, EVENT_LINES_INCOMING);
+            }
+            ctx->session.peers.last_heard_ms[i] = net_stats_now_ns() / 1000000;
+        }
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex lock for client in game session struct
+    }
+
+    for(int i = 0; i < ctx->session.n_players; i++){
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex lock for client in game session struct
+        if(ctx->session.peers.state[i] != DISCONNECTED && is_datagram_peer(ctx, i)){
+            dgram_link* link = ctx->session.peers.dgram + i;
+            if(link->confirmed && atomic_load_explicit(ctx->session.peers.pending_lines + i, memory_order_relaxed) > 0){
+                send_peer_datagram_lines(ctx, i); // carries the acknowledgement along
+            }
+            if(link->ack_pending){
+                dgram_send_ack(&ctx->dgram, link);
+            }
+        }
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex lock for client in game session struct
+    }
+}
+
+/* Returns the index of the P2P client (player) to which the given socket is connected, or -1 if none (e.g. if it has been
+ * disconnected meanwhile). The table of clients is small and contiguous, hence a sweep over it is cheap.
+ */
+static int peer_index(client_ctx* ctx, int fd){
+    for(int i = 0; i < ctx->session.n_players; i++){
+        if(ctx->session.peers.client_fd[i] == fd || ctx->session.peers.server_fd[i] == fd){
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Event loop handler for the sockets connected to a P2P client (player) of the client instance arg. Since readiness is
+ * edge-triggered, every message available on the socket is fetched and handled, until the socket is drained (or the
+ * connection is closed), calling the appropriate handler for each message type. If the socket on which we send to the
+ * client has become writable, any bytes still queued for it, and then any lines cleared meanwhile, are sent.
+ */
+static void handle_peer_msgs(int fd, unsigned int events, void* arg){
+    client_ctx* ctx = arg;
+    int i = peer_index(ctx, fd);
+    if(i < 0){
+        return;
+    }
+
+    pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex lock for client in game session struct
+    if(ctx->session.peers.client_fd[i] != fd && ctx->session.peers.server_fd[i] != fd){ // disconnected meanwhile
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex lock for client in game session struct
+        return;
+    }
+
+    int ret, ack, n_msgs = 0;
+    msg recv_client_msg;
+    while((ret = conn_poll_msg(fd, &recv_client_msg)) > 0){
+        n_msgs++;
+        switch(recv_client_msg.msg_type){
+            // if FINISHED_GAME message, then flag sender as finished and close connection
+            case FINISHED_GAME: disconnect_peer(ctx, i, FINISHED, LINK_PEER_CLOSED);
+                                break;
+            // else if LINES_CLEARED message, add number of lines cleared by sender to n_lines_to_add in a thread-safe
+            // manner, with a single atomic addition rather than taking the game session mutex
+            case LINES_CLEARED: atomic_fetch_add(&ctx->session.n_lines_to_add, msg_get_int(recv_client_msg));
+                                notify_event(ctx, EVENT_LINES_INCOMING);
+                                break;
+            // else if PEER_HELLO message (re-sent on an already identified connection), keep the capabilities advertised
+            // by the sender and switch our connection to it to the binary format if both support it
+            case PEER_HELLO: ctx->session.peers.peer_caps[i] = PEER_HELLO_CAPS(msg_get_int(recv_client_msg));
+                             negotiate_peer_format(ctx, i);
+                             break;
+            // else if PEER_ACK message, in reply to our PEER_HELLO, then our connection to the sender is confirmed; if
+            // both sides support it, the connection is then also used for messages from the sender
+            case PEER_ACK: ack = msg_get_int(recv_client_msg);
+                           if(PEER_HELLO_SLOT(ack) == ctx->session.peers.slot[i] && fd == ctx->session.peers.server_fd[i]){
+                               ctx->session.peers.peer_caps[i] = PEER_HELLO_CAPS(ack);
+                               negotiate_peer_format(ctx, i);
+
+                               if(is_single_peer_socket(ctx, i) && ctx->session.peers.client_fd[i] == 0){
+                                   ctx->session.peers.client_fd[i] = fd;
+                                   confirm_peer_link(ctx, i, LINK_BOTH);
+                               }else{
+                                   confirm_peer_link(ctx, i, LINK_OUTBOUND);
+                               }
+                           }
+                           break;
+            // else if PEER_PING message, echo its integer back to the sender on the same connection (see protocol.h)
+            case PEER_PING: if(conn_queue_int(fd, PEER_PONG, msg_get_int(recv_client_msg)) < 0 || conn_flush(fd, 0) < 0){
+                                ret = -1;
+                            }
+                            break;
+            // else if PEER_PONG message, in reply to our PEER_PING, then update the round-trip time estimate
+            case PEER_PONG: update_peer_rtt(ctx, i, msg_get_int(recv_client_msg));
+                            break;
+        }
+
+        if(recv_client_msg.msg_type == FINISHED_GAME || ret < 0){ // the connection has been closed, stop reading from it
+            break;
+        }
+    }
+
+    if(n_msgs > 0 && ret >= 0){ // any message, not only a PEER_PONG, shows that the client is alive
+        ctx->session.peers.last_heard_ms[i] = net_stats_now_ns() / 1000000;
+    }
+
+    // if the message could not be fetched (i.e. the sender disconnected), flag the sender as disconnected
+    if(ret < 0){
+        disconnect_peer(ctx, i, DISCONNECTED, LINK_PEER_CLOSED);
+    }
+    else if((events & EPOLLOUT) && fd == ctx->session.peers.server_fd[i]){
+        if(conn_flush(fd, 0) < 0){
+            disconnect_peer(ctx, i, DISCONNECTED, LINK_PEER_CLOSED);
+        }else{
+            flush_peer_lines(ctx, i);
+        }
+    }
+
+    pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex lock for client in game session struct
+}
+
+/* Event loop handler for accepted P2P connections which have not yet been identified. The first message on such a
+ * connection must be a PEER_HELLO, whose slot identifies the sender among the game session clients (rather than its IP
+ * address, which may be shared by multiple clients). On a match, the connection is confirmed by replying with a PEER_ACK,
+ * and the socket is handed over to handle_peer_msgs; otherwise the connection is closed.
+ *
+ * If both sides support a single connection, it is also used for messages to the sender. Otherwise, if we had left it
+ * to the sender to connect to us (expecting a single connection), service_peer_connections is notified that we must
+ * now connect to the sender ourselves.
+ */
+static void handle_pending_peer(int fd, unsigned int events, void* arg){
+    client_ctx* ctx = arg;
+    msg hello_msg;
+    int ret = conn_poll_msg(fd, &hello_msg);
+
+    if(ret == 0){ // no complete message yet, wait for the rest
+        return;
+    }else if(ret < 0 || hello_msg.msg_type != PEER_HELLO){
+        close_socket(ctx, fd);
+        return;
+    }
+
+    int hello = msg_get_int(hello_msg);
+    for(int i = 0; i < ctx->session.n_players; i++){
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex lock for client in game session struct
+        if(ctx->session.peers.slot[i] == PEER_HELLO_SLOT(hello) && ctx->session.peers.client_fd[i] == 0 &&
+           ctx->session.peers.state[i] == WAITING){
+            // if match found, then update with the connection settings and hand the socket over to handle_peer_msgs
+            ctx->session.peers.client_fd[i] = fd; // keep a reference to the fd returned by accept
+            ctx->session.peers.peer_caps[i] = PEER_HELLO_CAPS(hello);
+            reactor_add(&ctx->loop->reactor, &conn_get(fd)->source, fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP, handle_peer_msgs, ctx);
+
+            int single_socket = is_single_peer_socket(ctx, i) && ctx->session.peers.server_fd[i] == 0;
+            if(single_socket){
+                ctx->session.peers.server_fd[i] = fd; // messages to the sender are sent on the same connection
+            }
+            negotiate_peer_format(ctx, i);
+
+            // confirm the connection to the sender, identifying ourselves by our slot and advertising our capabilities
+            if(conn_send_int(fd, PEER_ACK, PEER_HELLO_VALUE(ctx->session.slot, ctx->peer_capabilities)) < 0){
+                disconnect_peer(ctx, i, DISCONNECTED, LINK_PEER_CLOSED);
+            }else{
+                confirm_peer_link(ctx, i, single_socket ? LINK_BOTH : LINK_INBOUND);
+
+                if(!single_socket && !is_peer_dialer(ctx, i) && ctx->session.peers.server_fd[i] == 0){
+                    ctx->session.peers.dial_pending[i] = 1; // the sender does not support a single connection
+                    signal_mesh_change(ctx);
+                }
+            }
+            // decided while the lock is held, since the socket may be closed (and its number reused) once released
+            int still_open = ctx->session.peers.client_fd[i] == fd;
+            pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex lock for client in game session struct
+
+            // since readiness is edge-triggered, handle any further messages already received on the socket
+            if(still_open){
+                handle_peer_msgs(fd, events, ctx);
+            }
+            return;
+        }
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex lock for client in game session struct
+    }
+
+    close_socket(ctx, fd); // unknown (or duplicate) sender
+}
+
+/* Accepts every pending P2P connection on the given socket (as required by edge-triggered readiness) and registers it
+ * with the event loop, to be identified by its PEER_HELLO message (see handle_pending_peer), forming one direction of the
+ * bi-directional connection. local is set for the socket accepting connections from clients on this host.
+ */
+static void accept_pending_peers(client_ctx* ctx, int fd, int local){
+    int client_fd;
+
+    while((client_fd = accept(fd, NULL, NULL)) >= 0){
+        socket_apply_profile(client_fd, &ctx->sock_profile); // in case any options are not inherited from the listening socket
+        if(!local){ // not a client on this host (see open_p2p_endpoint), hence over TCP
+            conn_set_quick_ack(client_fd, ctx->sock_profile.quick_ack);
+        }
+
+        if(reactor_add(&ctx->loop->reactor, &conn_get(client_fd)->source, client_fd, EPOLLIN | EPOLLRDHUP, handle_pending_peer, ctx) < 0){
+            close_socket(ctx, client_fd);
+        }
+    }
+}
+
+// Event loop handler for the socket on which the client instance arg accepts P2P connections
+static void handle_peer_connection(int fd, unsigned int events, void* arg){
+    (void) events;
+    accept_pending_peers(arg, fd, 0);
+}
+
+// Event loop handler for the socket on which the client instance arg accepts P2P connections from clients on this host
+static void handle_local_peer_connection(int fd, unsigned int events, void* arg){
+    (void) events;
+    accept_pending_peers(arg, fd, 1);
+}
+
+/* Runs a single iteration of the given P2P event loop: waits for up to timeout_ms milliseconds (-1 to wait indefinitely)
+ * until some socket is ready (or the loop is woken up), and dispatches each ready socket to its handler. If cancellable
+ * is set, cancellation is enabled while waiting (but never while handlers, which hold mutex locks, are running). Returns
+ * -1 if the event loop failed, 0 otherwise.
+ */
+static int run_loop_once(p2p_loop* loop, int timeout_ms, int cancellable){
+    int stats_enabled = net_stats_enabled();
+    long long wait_start_ns = stats_enabled ? net_stats_now_ns() : 0;
+
+    if(cancellable){ pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);} // maintaining atomic transactions; see report
+    int n_events = reactor_wait(&loop->reactor, timeout_ms);
+    if(cancellable){ pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);} // maintaining atomic transactions; see report
+
+    long long wake_ns = stats_enabled ? net_stats_now_ns() : 0;
+    if(stats_enabled){
+        atomic_fetch_add_explicit(&loop->wakeups, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&loop->wait_ns, (unsigned long long) (wake_ns - wait_start_ns), memory_order_relaxed);
+    }
+
+    if(n_events < 0){
+        smrerror("Peer-to-peer event loop failed");
+        return -1;
+    }
+
+    // dispatch each ready socket to its handler, timing the handling of any socket (rather than mere wake ups)
+    if(reactor_dispatch(&loop->reactor) > 0 && stats_enabled){
+        net_histogram_record(&loop->dispatch_latency, net_stats_now_ns() - wake_ns);
+    }
+
+    return 0;
+}
+
+// Runs a single iteration of the P2P event loop of the given client (see run_loop_once), then sends any cleared lines
+static int run_p2p_loop_once(client_ctx* ctx, int timeout_ms, int cancellable){
+    if(run_loop_once(ctx->loop, timeout_ms, cancellable) < 0){
+        return -1;
+    }
+    flush_cleared_lines(ctx); // send any lines cleared since the last iteration
+
+    return 0;
+}
+
+// Registers the socket on which we accept P2P connections with the P2P event loop, for the game session being set up
+static int register_p2p_endpoint(client_ctx* ctx){
+    // initialise to 0
+    pthread_mutex_lock(&ctx->gameMutex);
+    for(int i = 0; i < ctx->session.n_players; i++){
+        ctx->session.peers.client_fd[i] = 0;
+    }
+    pthread_mutex_unlock(&ctx->gameMutex); // release mutex lock for game session struct
+
+    // register the sockets on which we accept P2P connections (non-blocking, see open_p2p_endpoint)
+    if(reactor_add(&ctx->loop->reactor, &ctx->p2p_source, ctx->session.p2p_fd, EPOLLIN, handle_peer_connection, ctx) < 0){
+        smrerror("Failed to register peer-to-peer socket with the event loop");
+        return -1;
+    }
+    if(ctx->p2p_local_fd >= 0 && reactor_add(&ctx->loop->reactor, &ctx->p2p_local_source, ctx->p2p_local_fd, EPOLLIN, handle_local_peer_connection, ctx) < 0){
+        smrerror("Failed to register local peer-to-peer socket with the event loop"); // clients on this host then use TCP
+    }
+    if(ctx->dgram.fd >= 0 && reactor_add(&ctx->loop->reactor, &ctx->dgram_source, ctx->dgram.fd, EPOLLIN, handle_peer_datagrams, ctx) < 0){
+        smrerror("Failed to register peer-to-peer datagram socket with the event loop");
+        close_socket(ctx, ctx->dgram.fd); // such that datagrams are no longer advertised, and every message is sent on the connections
+        ctx->dgram.fd = -1;
+        ctx->peer_capabilities &= ~PEER_CAP_DATAGRAM;
+    }
+
+    return 0;
+}
+
+// Removes the sockets on which we accept P2P connections from the P2P event loop, once the game session has ended
+static void unregister_p2p_endpoint(client_ctx* ctx){
+    reactor_remove(&ctx->loop->reactor, &ctx->p2p_source);
+    if(ctx->p2p_local_source.handler != NULL){ // if registered
+        reactor_remove(&ctx->loop->reactor, &ctx->p2p_local_source);
+    }
+    if(ctx->dgram_source.handler != NULL){
+        reactor_remove(&ctx->loop->reactor, &ctx->dgram_source);
+    }
+}
+
+/* Threaded function for accepting P2P connections during P2P setup, and then handling messages recieved by P2P clients
+ * during game play, by calling the appropriate handler functions. To do so, we run an edge-triggered epoll event loop on
+ * which the socket accepting P2P connections, as well as every socket connected to a P2P client, is registered only
+ * once; readiness of any of these sockets is then dispatched directly to its handler (see handle_peer_connection and
+ * handle_peer_msgs), with no per-iteration set-up or sweeps across the clients.
+ *
+ * The loop terminates as soon as the game session is no longer in progress, since signalGameTermination and end_game
+ * wake up the event loop. Returns immediately if the I/O engine is running (see io_engine_attach), which then runs
+ * the event loop itself. arg is the client instance.
+ */
+void* accept_peer_connections(void* arg){
+    client_ctx* ctx = arg;
+    if(atomic_load(&ctx->engine_running)){
+        return NULL;
+    }
+
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL); // maintaining atomic transactions; see report
+
+    if(register_p2p_endpoint(ctx) < 0){
+        pthread_exit(NULL);
+    }
+
+    // run the event loop until the game has terminated, waking up in time for the heartbeats and retransmissions
+    while(atomic_load(&ctx->session.game_in_progress) && run_p2p_loop_once(ctx, service_peer_timers(ctx), 1) == 0);
+
+    unregister_p2p_endpoint(ctx);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL); // maintaining atomic transactions; see report
+    pthread_exit(NULL);
+}
+
+/* Completion handler for the connection to the P2P server of the client (player) at index player_idxs[target_idx] of the
+ * peer_dial arg, called by connect_all as soon as the connection is established (fd >= 0) or given up on (fd < 0). In the
+ * latter case the client is flagged as disconnected (unless it is on this host, in which case it is then dialed over TCP
+ * instead); otherwise the connection is set up as one direction of the bi-directional P2P connection (or both, if a
+ * single connection is negotiated in the handshake). In either case, the callback set by the front-end (if any) is then
+ * notified.
+ */
+static void handle_peer_connected(int target_idx, int fd, void* arg){
+    client_ctx* ctx = ((peer_dial*) arg)->ctx;
+    int i = ((peer_dial*) arg)->player_idxs[target_idx]; // index of the client in session.players
+
+    if(fd < 0 && ctx->session.peers.local[i]){ // if the client on this host could not be connected to locally...
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex for the client in the game session struct
+        if(ctx->session.peers.state[i] == WAITING){ // ...then fall back to TCP, within what remains of the deadline
+            ctx->session.peers.local[i] = 0;
+            ctx->session.peers.dial_pending[i] = 1;
+            signal_mesh_change(ctx);
         }
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex for the client in the game session struct
+        return;
+    }
+    else if(fd < 0){ // if the connection could not be established within the allowed attempts and deadline
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex for the client in the game session struct
+        disconnect_peer(ctx, i, DISCONNECTED, LINK_CONNECT_FAILED); // flag as disconnected (so we do not attempt further communication)
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex for the client in the game session struct
+    }
+    else{
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex for the client in the game session struct
+        if(ctx->session.peers.state[i] != WAITING){ // the client has been given up on (or left) in the meantime
+            close_socket(ctx, fd);
+        }
+        else{
+            ctx->session.peers.server_fd[i] = fd; // set reference to server_fd to the connected socket
+            if(!ctx->session.peers.local[i]){ // the rest of the socket profile is applied by connect_all
+                conn_set_quick_ack(fd, ctx->sock_profile.quick_ack);
+            }
+
+            // register the socket with the P2P event loop, such that messages (or a disconnection) on it are handled
+            reactor_add(&ctx->loop->reactor, &conn_get(fd)->source, fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP, handle_peer_msgs, ctx);
+
+            // identify ourselves to the client and advertise our capabilities (always in ASCII, as the first message on
+            // the connection); the connection is confirmed once the client replies with a PEER_ACK. Then switch to the
+            // binary format if the client had already advertised support for it on its own connection
+            if(conn_send_int(fd, PEER_HELLO, PEER_HELLO_VALUE(ctx->session.slot, ctx->peer_capabilities)) < 0){
+                disconnect_peer(ctx, i, DISCONNECTED, LINK_CONNECT_FAILED);
+            }
+            negotiate_peer_format(ctx, i);
+        }
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex for the client in the game session struct
+    }
+
+    if(ctx->peer_connected_callback != NULL){
+        ctx->peer_connected_callback(i, fd >= 0, ctx->peer_connected_callback_arg);
+    }
+}
+
+// Connects in parallel to the P2P servers of the clients (players) at the given indices, within the given time, over a
+// Unix domain socket for those on this host (see handle_peer_connected for the handling of each connection)
+static void connect_peers(client_ctx* ctx, int* player_idxs, int n_players, int deadline_ms){
+    connect_target targets[ctx->session.peers.capacity];
+    connect_options opts = ctx->peer_connect_options;
+    opts.deadline_ms = deadline_ms > 0 ? deadline_ms : 0;
+    opts.profile = &ctx->sock_profile;
+
+    struct sockaddr_un local_addrs[ctx->session.peers.capacity];
+
+    for(int t = 0; t < n_players; t++){
+        int i = player_idxs[t];
+        targets[t].ip = ctx->session.peers.ip[i];
+        targets[t].port = ctx->session.peers.port[i];
+        targets[t].local_addr = NULL;
+
+        if(ctx->session.peers.local[i]){ // a client on this host, connected to over a Unix domain socket
+            targets[t].local_addr_len = local_p2p_address(targets[t].port, local_addrs + t);
+            targets[t].local_addr = local_addrs + t;
+        }
+    }
+
+    // the I/O engine must never block on the connections (nor on anything else), and hence steps them alongside its event
+    // loop instead (see step_peer_dials); otherwise they are awaited here
+    if(atomic_load(&ctx->engine_running)){
+        peer_dial* dial = malloc(sizeof(peer_dial) + n_players * sizeof(int));
+        if(dial != NULL){
+            dial->ctx = ctx;
+            dial->player_idxs = (int*) (dial + 1);
+            memcpy(dial->player_idxs, player_idxs, n_players * sizeof(int));
+            if(connect_batch_start(&dial->batch, targets, n_players, &opts, handle_peer_connected, dial) == 0){
+                dial->next = ctx->dials;
+                ctx->dials = dial;
+                return;
+            }
+            free(dial);
+        }
+        smrerror("Failed to start connecting to clients in the background"); // then connect to them synchronously
+    }
+
+    peer_dial dial = {.ctx = ctx, .player_idxs = player_idxs};
+    connect_all(targets, n_players, &opts, handle_peer_connected, &dial);
+}
+
+// Returns the current (wall-clock) time in milliseconds, as used for the deadline of the P2P mesh set up
+static long long realtime_ms(){
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Connects to the clients in the game session to which we are to connect, by the given deadline: initially (pending_only
+ * = 0) every client for which we are the dialer, and subsequently (pending_only = 1) any client which connected to us but
+ * (unlike us) does not support a single connection (see handle_pending_peer). Returns the number of clients dialed.
+ */
+static int dial_peers(client_ctx* ctx, int pending_only, long long deadline_ms){
+    int player_idxs[ctx->session.peers.capacity], n_dial = 0;
+
+    for(int i = 0; i < ctx->session.n_players; i++){
+        if(!pending_only){
+            if(is_peer_dialer(ctx, i)){
+                player_idxs[n_dial++] = i;
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex for the client in the game session struct
+        if(ctx->session.peers.dial_pending[i]){
+            ctx->session.peers.dial_pending[i] = 0;
+            player_idxs[n_dial++] = i;
+        }
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex for the client in the game session struct
+    }
+
+    if(n_dial > 0){
+        connect_peers(ctx, player_idxs, n_dial, (int) (deadline_ms - realtime_ms()));
+    }
+
+    return n_dial;
+}
+
+/* Completes the set up of the P2P mesh, once it is complete or its deadline has passed: any connection not confirmed in
+ * both directions is given up on, and a P2P_READY message is sent to the server.
+ */
+static void finish_mesh_setup(client_ctx* ctx){
+    // any connection not confirmed in both directions by the deadline is given up on
+    for(int i = 0; i < ctx->session.n_players; i++){
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex for the client in the game session struct
+        if(ctx->session.peers.state[i] == WAITING){
+            errno = ETIMEDOUT;
+            smrerror("Peer-to-peer handshake with client did not complete");
+            disconnect_peer(ctx, i, DISCONNECTED, LINK_HANDSHAKE_TIMEOUT);
+        }
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex for the client in the game session struct
+    }
+
+    // lastly, send a P2P_READY message to the server to indicate that the P2P mesh has been set up
+    pthread_mutex_lock(&ctx->gameMutex); // obtain mutex lock for game session
+    if(!ctx->session.p2p_ready && ctx->session.game_type != CHILL){
+        ctx->session.p2p_ready = 1;
+        conn_send(ctx->server_fd, P2P_READY, "", 0);
+        atomic_store(&ctx->p2p_ready_ns, net_stats_enabled() ? net_stats_now_ns() : 0);
+    }
+    pthread_mutex_unlock(&ctx->gameMutex); // release mutex lock for game session
+}
+
+/* Threaded function for setting up the bi--directional fully connected mesh network of a game session: we connect with
+ * each client's P2P server (forming one direction of each connection) and then wait until every connection is confirmed
+ * by the handshake in both directions (see protocol.h), or has failed. Only then is a P2P_READY message sent to the
+ * server, such that the game is never started with a partially set up mesh going unnoticed. Where both sides support a
+ * single connection for both directions (see set_single_peer_socket), only the client with the lower slot connects.
+ *
+ * Connections to all clients are attempted in parallel using non-blocking sockets (see connect_all), with failed attempts
+ * (e.g. if a client is not yet accepting connections) retried with exponential backoff, as configured through
+ * set_peer_connect_options. Each completion is reported to the callback set through set_peer_connected_callback, if any.
+ * Connections which are not confirmed in both directions within the configured deadline are closed and flagged as
+ * failed, with the reason available through get_peer_link_info; hence the set up takes at most as long as the deadline,
+ * rather than waiting indefinitely for a connection which will never be made.
+ *
+ * Since P2P_READY is only sent once the mesh is set up, this function must be called as soon as the NEW_GAME message is
+ * handled (after starting accept_peer_connections), rather than waiting for any further message from the server. Returns
+ * immediately if the I/O engine is running (see io_engine_attach), which then sets up the mesh itself. arg is the client
+ * instance.
+ *
+ * Updating to the game session struct is carried out in a thread--safe manner (even if executing in the main thread --
+ * there might be other spawned threads!)
+ */
+void* service_peer_connections(void* arg){
+    client_ctx* ctx = arg;
+    if(atomic_load(&ctx->engine_running)){ // the mesh is then set up by the I/O engine
+        return NULL;
+    }
+
+    long long deadline_ms = realtime_ms() + ctx->peer_connect_options.deadline_ms;
+    struct timespec deadline = {.tv_sec = deadline_ms / 1000, .tv_nsec = (long) (deadline_ms % 1000) * 1000000};
+
+    // for each client in the game session (except those which are to connect to us over a single connection), connect to
+    // the IP and port as determined from the NEW_GAME message recieved prior
+    dial_peers(ctx, 0, deadline_ms);
+
+    // then wait until the mesh is complete, re-checking whenever the state of some connection changes
+    int timed_out = 0;
+    while(!timed_out){
+        pthread_mutex_lock(&ctx->meshMutex);
+        int generation = ctx->mesh_generation;
+        pthread_mutex_unlock(&ctx->meshMutex);
+
+        // connect to any client which connected to us but (unlike us) does not support a single connection
+        dial_peers(ctx, 1, deadline_ms);
+
+        if(is_mesh_complete(ctx)){
+            break;
+        }
+
+        pthread_mutex_lock(&ctx->meshMutex);
+        while(generation == ctx->mesh_generation && !timed_out){
+            timed_out = pthread_cond_timedwait(&ctx->meshCond, &ctx->meshMutex, &deadline) == ETIMEDOUT;
+        }
+        pthread_mutex_unlock(&ctx->meshMutex);
+    }
+
+    finish_mesh_setup(ctx);
+
+    return NULL;
+}
+
+// ------ I/O ENGINE ------
+
+/* Event loop handler for the server socket of the client instance arg, while attached to the I/O engine: every message available on the socket is
+ * fetched and enqueued in the server message queue, until the socket is drained. If the queue is full, reading is
+ * suspended rather than blocking the event loop (and with it the P2P network), and is resumed by the engine once the
+ * front-end dequeues a message. On disconnection, a msg of type INVALID is enqueued and the socket is de-registered.
+ */
+static void handle_server_msgs(int fd, unsigned int events, void* arg){
+    (void) events;
+    client_ctx* ctx = arg;
+    msg recvMsg;
+
+    while(1){
+        if(ring_queue_size(&ctx->server_msgs) >= ctx->server_msgs.capacity){
+            atomic_store(&ctx->server_read_stalled, 1);
+            return;
+        }
+
+        int ret = conn_poll_msg(fd, &recvMsg);
+        if(ret == 0){ // drained
+            return;
+        }else if(ret < 0){ // the server has disconnected, which is signalled to the front-end by a msg of type INVALID
+            recvMsg.msg_type = INVALID; recvMsg.msg = NULL; recvMsg.msg_alloc = MSG_ALLOC_VIEW;
+            queue_server_msg(ctx, recvMsg);
+            reactor_remove(&ctx->loop->reactor, &ctx->server_source);
+            return;
+        }
+
+        queue_server_msg(ctx, recvMsg);
+    }
+}
+
+/* Advances the connections to the clients in the game session being established by the I/O engine (see connect_peers),
+ * without waiting, releasing those which are done. Returns the deadline (see realtime_ms) by which they are next to be
+ * advanced, or -1 if none remain.
+ */
+static long long step_peer_dials(client_ctx* ctx){
+    long long deadline_ms = -1;
+    peer_dial** link = &ctx->dials;
+
+    while(*link != NULL){
+        peer_dial* dial = *link;
+        int next_ms = connect_batch_step(&dial->batch, 0);
+        if(next_ms < 0){ // every client is connected to or given up on
+            *link = dial->next;
+            connect_batch_destroy(&dial->batch);
+            free(dial);
+            continue;
+        }
+
+        long long due_ms = realtime_ms() + next_ms;
+        if(deadline_ms < 0 || due_ms < deadline_ms){
+            deadline_ms = due_ms;
+        }
+        link = &dial->next;
+    }
+
+    return deadline_ms;
+}
+
+// Abandons the connections to the clients in the game session still being established by the I/O engine, if any
+static void cancel_peer_dials(client_ctx* ctx){
+    while(ctx->dials != NULL){
+        peer_dial* dial = ctx->dials;
+        ctx->dials = dial->next;
+        connect_batch_destroy(&dial->batch);
+        free(dial);
+    }
+}
+
+/* Carries out the work of the I/O engine for a single client instance attached to it, in between iterations of the
+ * event loop: sets up the P2P network of a new game session once the NEW_GAME message is handled (as signalled by
+ * handle_new_game_msg), completes the set up of the P2P mesh once it is complete (or its deadline has passed), publishes
+ * the score (see publish_score), and resumes reading from the server once there is room in the server message queue.
+ * Returns the deadline (see realtime_ms)
+ * by which the engine must next do so, or -1 if none.
+ */
+static long long step_engine_client(client_ctx* ctx){
+    long long deadline_ms = -1;
+
+    // set up the P2P network of a new game session, as signalled by handle_new_game_msg
+    if(atomic_exchange(&ctx->engine_session_pending, 0)){
+        if(ctx->p2p_registered){ unregister_p2p_endpoint(ctx);} // the previous session has just ended
+        cancel_peer_dials(ctx);
+
+        ctx->p2p_registered = register_p2p_endpoint(ctx) == 0;
+        ctx->mesh_deadline_ms = realtime_ms() + ctx->peer_connect_options.deadline_ms;
+        dial_peers(ctx, 0, ctx->mesh_deadline_ms);
+        ctx->mesh_pending = 1;
+    }
+
+    // advance the connections to the clients, and check whether the mesh is complete (or its deadline has passed) after
+    // every change to its state
+    if(ctx->mesh_pending && atomic_load(&ctx->session.game_in_progress)){
+        long long dial_deadline_ms = step_peer_dials(ctx);
+        if(dial_peers(ctx, 1, ctx->mesh_deadline_ms) > 0){
+            dial_deadline_ms = realtime_ms(); // the new connections are to be started right away
+        }
+
+        if(is_mesh_complete(ctx) || realtime_ms() >= ctx->mesh_deadline_ms){
+            finish_mesh_setup(ctx);
+            cancel_peer_dials(ctx);
+            ctx->mesh_pending = 0;
+        }else{
+            deadline_ms = dial_deadline_ms >= 0 && dial_deadline_ms < ctx->mesh_deadline_ms ? dial_deadline_ms : ctx->mesh_deadline_ms;
+        }
+    }
+
+    if(ctx->p2p_registered && !atomic_load(&ctx->session.game_in_progress)){ // the game session has ended
+        unregister_p2p_endpoint(ctx);
+        cancel_peer_dials(ctx);
+        ctx->p2p_registered = ctx->mesh_pending = 0;
+    }
+
+    // ping the clients in the game session (detecting any which are dead) and retransmit unacknowledged datagrams, as due
+    if(ctx->p2p_registered && atomic_load(&ctx->session.game_in_progress)){
+        int timer_ms = service_peer_timers(ctx);
+        if(timer_ms >= 0 && (deadline_ms < 0 || realtime_ms() + timer_ms < deadline_ms)){
+            deadline_ms = realtime_ms() + timer_ms;
+        }
+    }
+
+    // publish the score to the server, as due (for every game type, i.e. whether or not there are clients to connect to)
+    if(atomic_load(&ctx->session.game_in_progress)){
+        int score_ms = publish_score(ctx);
+        if(score_ms >= 0 && (deadline_ms < 0 || realtime_ms() + score_ms < deadline_ms)){
+            deadline_ms = realtime_ms() + score_ms;
+        }
+    }
+
+    // resume reading from the server once there is room in the server message queue
+    if(atomic_load(&ctx->server_read_stalled) && ring_queue_size(&ctx->server_msgs) < ctx->server_msgs.capacity){
+        atomic_store(&ctx->server_read_stalled, 0);
+        handle_server_msgs(ctx->server_fd, EPOLLIN, ctx);
     }
+
+    return deadline_ms;
+}
+
+/* Threaded function run by the I/O engine, in place of the threads otherwise run by the front-end for each client
+ * instance (enqueue_server_msg in a loop, accept_peer_connections and service_peer_connections): a single P2P event loop,
+ * on which the server socket of every attached instance is registered alongside its P2P sockets, and which also sets up
+ * the P2P mesh of each game session (see step_engine_client) without ever blocking on a condition variable. Runs until
+ * stopped by io_engine_destroy.
+ */
+static void* run_io_engine(void* arg){
+    io_engine* engine = arg;
+
+    while(!atomic_load(&engine->stop)){
+        // instances are only ever appended, and published once fully set up (see io_engine_attach)
+        int n_contexts = atomic_load_explicit(&engine->n_contexts, memory_order_acquire);
+        long long deadline_ms = -1;
+
+        for(int c = 0; c < n_contexts; c++){
+            long long client_deadline_ms = step_engine_client(engine->contexts[c]);
+            if(client_deadline_ms >= 0 && (deadline_ms < 0 || client_deadline_ms < deadline_ms)){
+                deadline_ms = client_deadline_ms;
+            }
+        }
+
+        long long timeout_ms = deadline_ms < 0 ? -1 : deadline_ms - realtime_ms();
+        if(run_loop_once(&engine->loop, deadline_ms >= 0 && timeout_ms < 0 ? 0 : (int) timeout_ms, 0) < 0){
+            break;
+        }
+
+        for(int c = 0; c < n_contexts; c++){
+            flush_cleared_lines(engine->contexts[c]); // send any lines cleared since the last iteration
+        }
+    }
+
+    return NULL;
+}
+
+/* Creates an I/O engine: a single library-managed thread which, for each client instance attached to it (up to
+ * max_clients, see io_engine_attach), reads messages from the server into the server message queue, accepts and handles
+ * P2P connections, and sets up the P2P mesh of each game session (see run_io_engine), such that the front-end need not
+ * run any threads of its own for networking, and any number of instances are served by one event loop.
+ *
+ * The backend (see enum IoBackend) is either epoll alone, or epoll for readiness along with io_uring, through which the
+ * LINES_CLEARED messages to all the clients in a game session are sent with a single system call (see conn_flush_batch).
+ * Returns NULL on failure (e.g. if io_uring is not available).
+ */
+io_engine* io_engine_create(int backend, int max_clients){
+    if(max_clients <= 0){
+        errno = EINVAL;
+        smrerror("Invalid number of clients for the I/O engine");
+        return NULL;
+    }
+
+    io_engine* engine = calloc(1, sizeof(io_engine));
+    client_ctx** contexts = calloc((size_t) max_clients, sizeof(client_ctx*));
+    if(engine == NULL || contexts == NULL){
+        smrerror("Failed to allocate the I/O engine");
+        free(engine); free(contexts);
+        return NULL;
+    }
+    engine->contexts = contexts;
+    engine->max_contexts = max_clients;
+
+    if(reactor_init(&engine->loop.reactor) < 0){
+        smrerror("Failed to initialise the I/O engine event loop");
+        free(contexts); free(engine);
+        return NULL;
+    }
+
+    if(backend == IO_BACKEND_URING){
+        if(uring_init(&engine->ring, URING_ENTRIES) < 0){
+            smrerror("Failed to initialise io_uring instance");
+            reactor_destroy(&engine->loop.reactor); free(contexts); free(engine);
+            return NULL;
+        }
+        engine->batch_sends = 1;
+    }
+
+    pthread_mutex_init(&engine->attachMutex, NULL);
+    if(pthread_create(&engine->thread, NULL, run_io_engine, engine) != 0){
+        smrerror("Failed to start the I/O engine thread");
+        pthread_mutex_destroy(&engine->attachMutex);
+        if(engine->batch_sends){ uring_destroy(&engine->ring);}
+        reactor_destroy(&engine->loop.reactor); free(contexts); free(engine);
+        return NULL;
+    }
+
+    return engine;
+}
+
+/* Attaches the client instance to the I/O engine, which from then on handles all of its networking (see
+ * io_engine_create). While attached, enqueue_server_msg, accept_peer_connections and service_peer_connections return
+ * immediately; the front-end merely dequeues messages (see also get_event_fd) and calls handle_new_game_msg and end_game
+ * as usual. Must be called after client_init, outside of a game session; the instance remains attached until the engine
+ * is destroyed. Returns 0 on success, -1 on failure (e.g. if already attached, or the engine is at capacity).
+ */
+int io_engine_attach(io_engine* engine, client_ctx* ctx){
+    if(atomic_load(&ctx->engine_running) || ctx->server_fd < 0){
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&engine->attachMutex); // obtain mutex lock for the instances attached to the engine
+    int n_contexts = atomic_load(&engine->n_contexts);
+    if(n_contexts >= engine->max_contexts){
+        pthread_mutex_unlock(&engine->attachMutex); // release mutex lock for the instances attached to the engine
+        errno = ENOSPC;
+        smrerror("I/O engine is at capacity");
+        return -1;
+    }
+
+    ctx->engine = engine;
+    ctx->loop = &engine->loop;
+    ctx->p2p_registered = ctx->mesh_pending = 0;
+    atomic_store(&ctx->engine_session_pending, 0);
+    atomic_store(&ctx->server_read_stalled, 1); // messages may already be buffered, which no readiness would report
+    if(reactor_add(&engine->loop.reactor, &ctx->server_source, ctx->server_fd, EPOLLIN | EPOLLRDHUP, handle_server_msgs, ctx) < 0){
+        smrerror("Failed to register server socket with the event loop");
+        ctx->engine = NULL;
+        ctx->loop = &ctx->own_loop;
+        pthread_mutex_unlock(&engine->attachMutex); // release mutex lock for the instances attached to the engine
+        return -1;
+    }
+    atomic_store(&ctx->engine_running, 1);
+
+    engine->contexts[n_contexts] = ctx;
+    atomic_store_explicit(&engine->n_contexts, n_contexts + 1, memory_order_release); // publish to the engine thread
+    pthread_mutex_unlock(&engine->attachMutex); // release mutex lock for the instances attached to the engine
+
+    reactor_wake(&engine->loop.reactor); // such that the server socket is drained (see step_engine_client)
+    return 0;
+}
+
+/* Stops the I/O engine, waiting for its thread to exit, and detaches every client instance attached to it (which may
+ * then be run by threads of the front-end once again, or attached to another engine); the engine is signalled and woken
+ * up rather than cancelled, hence never leaving a mutex held. Should be called outside of a game session (e.g. after
+ * end_game).
+ */
+void io_engine_destroy(io_engine* engine){
+    if(engine == NULL){
+        return;
+    }
+
+    atomic_store(&engine->stop, 1);
+    reactor_wake(&engine->loop.reactor);
+    pthread_join(engine->thread, NULL);
+
+    int n_contexts = atomic_load(&engine->n_contexts);
+    for(int c = 0; c < n_contexts; c++){
+        client_ctx* ctx = engine->contexts[c];
+        if(ctx->p2p_registered){
+            unregister_p2p_endpoint(ctx);
+            ctx->p2p_registered = ctx->mesh_pending = 0;
+        }
+        cancel_peer_dials(ctx);
+        if(ctx->server_source.handler != NULL){ // unless already de-registered on disconnection
+            reactor_remove(&engine->loop.reactor, &ctx->server_source);
+        }
+
+        ctx->loop = &ctx->own_loop;
+        ctx->engine = NULL;
+        atomic_store(&ctx->engine_running, 0);
+    }
+
+    if(engine->batch_sends){
+        uring_destroy(&engine->ring);
+    }
+    reactor_destroy(&engine->loop.reactor);
+    pthread_mutex_destroy(&engine->attachMutex);
+    free(engine->contexts);
+    free(engine);
+}
+
+/* Returns 1 if the P2P mesh of the current game session is complete, i.e. if every connection with the other clients has
+ * either been confirmed by the handshake in both directions, or has been closed (or failed); 0 otherwise.
+ */
+int is_mesh_complete(client_ctx* ctx){
+    int complete = 1;
+
+    for(int i = 0; i < ctx->session.n_players && complete; i++){
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex for the client in the game session struct
+        complete = ctx->session.peers.state[i] != WAITING;
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex for the client in the game session struct
+    }
+
+    return complete;
+}
+
+/* Thread--safe getter for the state of the connection with the P2P client (player) at index player_idx, reporting the
+ * slot of the client, its state (see enum State), the directions confirmed by the handshake (see enum LinkFlag), and the
+ * reason for which the connection failed, if it did (see enum LinkFailure). Returns 0 on success, -1 if the index is
+ * invalid.
+ */
+int get_peer_link_info(client_ctx* ctx, int player_idx, peer_link_info* info){
+    if(player_idx < 0 || player_idx >= ctx->session.n_players){
+        return -1;
+    }
+
+    pthread_mutex_lock(ctx->clientMutexes + player_idx); // obtain mutex for the client in the game session struct
+    info->slot = ctx->session.peers.slot[player_idx];
+    info->state = ctx->session.peers.state[player_idx];
+    info->link_flags = ctx->session.peers.link_flags[player_idx];
+    info->link_failure = ctx->session.peers.link_failure[player_idx];
+    info->rtt_us = ctx->session.peers.rtt_us[player_idx];
+    info->rtt_var_us = ctx->session.peers.rtt_var_us[player_idx];
+    info->datagram = is_datagram_peer(ctx, player_idx) && ctx->session.peers.dgram[player_idx].confirmed;
+    pthread_mutex_unlock(ctx->clientMutexes + player_idx); // release mutex for the client in the game session struct
+
+    return 0;
+}
+
+// Returns the time elapsed between two timestamps of the set up of a game session in milliseconds, or -1 if either of
+// them has not (yet) been taken
+static long long elapsed_ms(atomic_llong* from_ns, atomic_llong* to_ns){
+    long long from = atomic_load(from_ns), to = atomic_load(to_ns);
+    return from > 0 && to >= from ? (to - from) / 1000000 : -1;
+}
+
+/* Takes a snapshot of the instrumentation collected while enabled (see set_net_stats_enabled): per message type counts of
+ * messages sent and received, along with byte and system call counts, on the socket connected to the server and summed
+ * over all sockets connected to P2P clients; the high-water mark of the server message queue; the time the P2P event
+ * loop spent waiting; latency histograms; and the timings of the set up of the current game session. Counters are read
+ * without locking, and hence the snapshot is cheap to take at any time (even every frame), though not necessarily
+ * consistent across counters. See net_stats_to_json for dumping the snapshot. Always returns 0.
+ */
+int get_net_stats(client_ctx* ctx, net_stats* stats){
+    *stats = (net_stats) {0};
+    stats->enabled = net_stats_enabled();
+
+    if(ctx->server_fd > 0 && conn_get(ctx->server_fd) != NULL){
+        net_counters_read(&conn_get(ctx->server_fd)->counters, &stats->server);
+    }
+
+    net_counters_read(&ctx->released_counters, &stats->peers); // sockets connected to P2P clients since closed
+    if(ctx->dgram.fd >= 0){ net_counters_fold(&conn_get(ctx->dgram.fd)->counters, &stats->peers);}
+    for(int i = 0; i < ctx->session.n_players; i++){
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex for the client in the game session struct
+        int client_fd = ctx->session.peers.client_fd[i], peer_server_fd = ctx->session.peers.server_fd[i];
+        if(client_fd > 0){ net_counters_fold(&conn_get(client_fd)->counters, &stats->peers);}
+        if(peer_server_fd > 0 && peer_server_fd != client_fd){ net_counters_fold(&conn_get(peer_server_fd)->counters, &stats->peers);}
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex for the client in the game session struct
+    }
+
+    stats->server_queue_high_water = atomic_load(&ctx->server_queue_high_water);
+    stats->server_chats_dropped = atomic_load(&ctx->server_chats_dropped);
+    stats->peer_retransmits = atomic_load(&ctx->dgram.retransmits);
+    stats->reactor_wakeups = atomic_load(&ctx->loop->wakeups);
+    stats->reactor_wait_ns = atomic_load(&ctx->loop->wait_ns);
+    net_histogram_read(&ctx->lines_send_latency, &stats->lines_send_latency);
+    net_histogram_read(&ctx->loop->dispatch_latency, &stats->peer_dispatch_latency);
+    stats->mesh_setup_ms = elapsed_ms(&ctx->new_game_ns, &ctx->p2p_ready_ns);
+    stats->start_wait_ms = elapsed_ms(&ctx->p2p_ready_ns, &ctx->start_game_ns);
+
+    return 0;
+}
+
+// Resets all instrumentation collected so far (see get_net_stats), e.g. at the start of a game session
+void reset_net_stats(client_ctx* ctx){
+    if(ctx->server_fd > 0 && conn_get(ctx->server_fd) != NULL){
+        net_counters_reset(&conn_get(ctx->server_fd)->counters);
+    }
+
+    net_counters_reset(&ctx->released_counters);
+    if(ctx->dgram.fd >= 0){ net_counters_reset(&conn_get(ctx->dgram.fd)->counters);}
+    for(int i = 0; i < ctx->session.n_players; i++){
+        pthread_mutex_lock(ctx->clientMutexes + i); // obtain mutex for the client in the game session struct
+        if(ctx->session.peers.client_fd[i] > 0){ net_counters_reset(&conn_get(ctx->session.peers.client_fd[i])->counters);}
+        if(ctx->session.peers.server_fd[i] > 0){ net_counters_reset(&conn_get(ctx->session.peers.server_fd[i])->counters);}
+        pthread_mutex_unlock(ctx->clientMutexes + i); // release mutex for the client in the game session struct
+    }
+
+    atomic_store(&ctx->server_queue_high_water, 0);
+    atomic_store(&ctx->server_chats_dropped, 0);
+    atomic_store(&ctx->dgram.retransmits, 0);
+    atomic_store(&ctx->loop->wakeups, 0);
+    atomic_store(&ctx->loop->wait_ns, 0);
+    net_histogram_reset(&ctx->lines_send_latency);
+    net_histogram_reset(&ctx->loop->dispatch_latency);
+}
+
+/* Sets the deadline and retry schedule used by service_peer_connections when connecting to the clients in a game
+ * session (see connect_options); by default, connect_default_options() is used.
+ */
+void set_peer_connect_options(client_ctx* ctx, connect_options opts){
+    ctx->peer_connect_options = opts;
+}
+
+/* Sets the options applied to every TCP socket subsequently opened by the library (see socket_profile), i.e. the socket
+ * connected to the server (and hence must be called before client_init to apply to it), the sockets connected to other
+ * clients and the socket on which P2P connections are accepted. By default, only TCP_NODELAY and close-on-exec are set
+ * (see socket_default_profile).
+ */
+void set_socket_profile(client_ctx* ctx, socket_profile profile){
+    ctx->sock_profile = profile;
+}
+
+/* Sets which clients in a game session are deemed to be on this host, and hence are connected to over a Unix domain
+ * socket rather than TCP (bypassing the TCP/IP stack, whilst messages are framed exactly as over TCP): none
+ * (LOCAL_TRANSPORT_NONE), those with a loopback address (LOCAL_TRANSPORT_LOOPBACK, the default), or also those sharing
+ * our own address as sent by the server (LOCAL_TRANSPORT_SAME_IP, which is only correct if no two hosts share an address
+ * behind NAT). Clients on the same host are expected to use the same setting; any which cannot be connected to locally
+ * are connected to over TCP within what remains of the deadline. Applies from the next game session.
+ */
+void set_local_transport(client_ctx* ctx, int mode){
+    ctx->local_transport = mode;
+}
+
+/* Sets the interval at which the clients in a game session are pinged (HEARTBEAT_INTERVAL_MS by default, 0 to disable),
+ * and the number of intervals without hearing from a client after which it is deemed dead and disconnected, with the
+ * failure reported as LINK_HEARTBEAT_TIMEOUT by get_peer_link_info (HEARTBEAT_MAX_MISSED by default). Only clients which
+ * advertise support for heartbeats are pinged; the round-trip time of each is then reported by get_peer_link_info.
+ */
+void set_peer_heartbeat(client_ctx* ctx, int interval_ms, int max_missed){
+    ctx->heartbeat_interval_ms = interval_ms > 0 ? interval_ms : 0;
+    ctx->heartbeat_max_missed = max_missed > 0 ? max_missed : 1;
+}
+
+/* Sets the minimum interval between the SCORE_UPDATE messages sent to the server as the score changes during a game
+ * session (SCORE_UPDATE_INTERVAL_MS by default), only the latest score being sent once it elapses; 0 disables live score
+ * updates, such that only the final score is sent (by end_game). Either way, the final score is always sent on game end.
+ */
+void set_score_update_interval(client_ctx* ctx, int interval_ms){
+    ctx->score_update_interval_ms = interval_ms > 0 ? interval_ms : 0;
+}
+
+/* Sets whether in-game messages (i.e. LINES_CLEARED) are sent to the clients in a game session as UDP datagrams, with
+ * retransmission of those not acknowledged, rather than on the P2P connections (PEER_TRANSPORT_STREAM, the default). A
+ * message lost on a connection holds back every message after it until retransmitted (with a timeout of at least 200 ms
+ * on Linux), while a lost datagram delays no other, and is retransmitted after a timeout derived from the round-trip time.
+ * Only used with clients which support it, once datagrams are found to get through both ways; the P2P connections are
+ * still set up (and used for the handshake, heartbeats and FINISHED_GAME). Must be called before a game session is joined
+ * for it to take effect in that session.
+ */
+void set_peer_transport(client_ctx* ctx, int transport){
+    ctx->peer_transport = transport == PEER_TRANSPORT_DATAGRAM ? PEER_TRANSPORT_DATAGRAM : PEER_TRANSPORT_STREAM;
+}
+
+// Sets the fraction (in thousandths) of datagrams sent to other clients which are dropped on purpose, to emulate a lossy
+// network (e.g. for benchmarks); 0 (the default) drops none
+void set_peer_datagram_loss(client_ctx* ctx, int loss_permille){
+    dgram_set_loss(&ctx->dgram, loss_permille);
+}
+
+/* Sets a callback to be notified, from within service_peer_connections, as soon as the connection to each client in the
+ * game session is established (connected = 1) or given up on (connected = 0), along with the index of the client in
+ * session.players. Set to NULL to disable.
+ */
+void set_peer_connected_callback(client_ctx* ctx, void (*callback)(int player_idx, int connected, void* arg), void* arg){
+    ctx->peer_connected_callback = callback;
+    ctx->peer_connected_callback_arg = arg;
+}
+
+/* ----------- EVENT NOTIFICATION ----------- */
+
+/* Returns a file descriptor which is readable while any events (see enum ClientEvent) are pending, such that the
+ * front-end may wait on it (e.g. in its own epoll or poll loop, alongside the server socket) rather than polling the
+ * getters; once readable, the events are taken through take_events.
+ */
+int get_event_fd(client_ctx* ctx){
+    return ctx->event_fd;
+}
+
+/* Returns (as a bitmask of enum ClientEvent) and clears the events raised since the last call, leaving the file
+ * descriptor returned by get_event_fd non-readable until the next event. May return 0 on a spurious wake up, e.g. if
+ * an event was raised while the previous events were being taken.
+ */
+int take_events(client_ctx* ctx){
+    eventfd_t n_wakeups;
+    if(ctx->event_fd >= 0){
+        eventfd_read(ctx->event_fd, &n_wakeups); // fails (harmlessly) with EAGAIN if not readable
+    }
+
+    return atomic_exchange(&ctx->pending_events, 0);
+}
+
+/* Sets a callback to be notified of each event (see enum ClientEvent) as it is raised, in addition to the file descriptor
+ * returned by get_event_fd. The callback is called from whichever library thread raises the event (e.g. the P2P event
+ * loop), possibly while holding the mutex of a client, and hence must not block nor call any library function other than
+ * the lock-free getters and setters; typically it merely hands the event over to the front-end. A NULL callback disables
+ * notification.
+ */
+void set_event_callback(client_ctx* ctx, void (*callback)(int event, void* arg), void* arg){
+    ctx->event_callback_arg = arg;
+    ctx->event_callback = callback;
 }
 
 /* ----------- ERROR HANDLING ----------- */
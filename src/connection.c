@@ -0,0 +1,674 @@
+#include "../include/connection.h"
+#include "../include/socket_profile.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define CONN_INT_DIGITS 12 // enough for the sign, 10 digits and the null character
+
+// Two-level table of connection entries indexed by file descriptor; chunks are allocated on first use and never freed,
+// such that look-ups need not take any lock and entries remain valid for the lifetime of the process
+static _Atomic(connection*) conn_chunks[CONN_MAX_CHUNKS];
+
+/* Returns the connection entry associated with the given file descriptor, allocating the chunk holding it if necessary.
+ * Returns NULL if the descriptor is out of range or memory could not be allocated.
+ */
+connection* conn_get(int socket_fd){
+    if(socket_fd < 0 || socket_fd >= CONN_CHUNK_SIZE * CONN_MAX_CHUNKS){
+        return NULL;
+    }
+
+    int chunk_idx = socket_fd / CONN_CHUNK_SIZE;
+    connection* chunk = atomic_load_explicit(conn_chunks + chunk_idx, memory_order_acquire);
+
+    if(chunk == NULL){
+        connection* new_chunk = calloc(CONN_CHUNK_SIZE, sizeof(connection));
+        if(new_chunk == NULL){
+            return NULL;
+        }
+
+        // another thread may have allocated the same chunk in the meantime, in which case we use theirs
+        if(atomic_compare_exchange_strong(conn_chunks + chunk_idx, &chunk, new_chunk)){
+            chunk = new_chunk;
+        }else{
+            free(new_chunk);
+        }
+    }
+
+    return chunk + (socket_fd % CONN_CHUNK_SIZE);
+}
+
+// Counts a call to recv (outbound = 0) or send (outbound = 1) on the connection, transferring n_bytes (if positive)
+static void conn_count_io(connection* conn, ssize_t n_bytes, int outbound){
+    if(net_stats_enabled()){
+        atomic_fetch_add_explicit(outbound ? &conn->counters.send_calls : &conn->counters.recv_calls, 1, memory_order_relaxed);
+        if(n_bytes > 0){
+            atomic_fetch_add_explicit(outbound ? &conn->counters.bytes_out : &conn->counters.bytes_in, (unsigned long long) n_bytes,
+                                      memory_order_relaxed);
+        }
+    }
+}
+
+// Counts a message of the given type as received (outbound = 0) or sent (outbound = 1) on the connection
+static void conn_count_msg(connection* conn, int msg_type, int outbound){
+    if(conn != NULL && net_stats_enabled()){
+        net_counters_add_msg(&conn->counters, msg_type, outbound);
+    }
+}
+
+/* Determines the extent of the frame at the start of the buffered bytes, without consuming it. Frames are self-describing:
+ * an ASCII header always starts with a digit, whereas a binary frame starts with its type byte, which is always less than
+ * '0'. The two formats may hence be freely interleaved on the same connection.
+ *
+ * ASCII: '<msg_len>::<msg_type>::' where msg_len has MSG_LEN_DIGITS digits and counts the trailing null character sent
+ *        along with the data part.
+ * Binary: <msg_type : 1 byte><msg_len : LEB128 varint><payload : msg_len bytes>, see protocol.h for payload layouts.
+ *
+ * Returns 1 if a complete frame is buffered, 0 if more bytes are required, and -1 if the header is malformed. In the
+ * first two cases, header_len and msg_len are set (msg_len possibly to a lower bound, if the header is incomplete).
+ */
+static int conn_frame_len(connection* conn, size_t* header_len, size_t* msg_len){
+    size_t available = conn->end - conn->start;
+    unsigned char* header = (unsigned char*) conn->buffer + conn->start;
+
+    *msg_len = 0;
+
+    if(available == 0 || (header[0] >= '0' && header[0] <= '9')){ // ASCII frame
+        *header_len = HEADER_SIZE - 1;
+        if(available < *header_len){
+            return 0;
+        }
+
+        // decode the data part length with integer arithmetic, validating that it is indeed made up of digits
+        for(int i = 0; i < MSG_LEN_DIGITS; i++){
+            if(header[i] < '0' || header[i] > '9'){
+                return -1;
+            }
+            *msg_len = 10 * *msg_len + (header[i] - '0');
+        }
+    }else if(header[0] < '0'){ // binary frame
+        int i = 1, shift = 0;
+        for(;; i++, shift += 7){
+            if(i > MSG_VARINT_MAX_BYTES){
+                return -1;
+            }else if((size_t) i >= available){ // length not yet fully received
+                *header_len = available + 1;
+                return 0;
+            }
+
+            *msg_len |= (size_t) (header[i] & 0x7F) << shift;
+            if(!(header[i] & 0x80)){
+                break;
+            }
+        }
+
+        *header_len = i + 1;
+        if(*msg_len > MSG_BINARY_MAX_LEN){
+            return -1;
+        }
+    }else{
+        return -1;
+    }
+
+    return available >= *header_len + *msg_len;
+}
+
+// Returns 1 if messages of the given type carry a single 32-bit integer as their binary payload, 0 otherwise
+static int msg_type_is_int(int msg_type){
+    return msg_type == SCORE_UPDATE || msg_type == LINES_CLEARED || msg_type == PEER_HELLO || msg_type == PEER_ACK ||
+           msg_type == PEER_PING || msg_type == PEER_PONG;
+}
+
+// Returns 1 if messages of the given type carry no payload in binary format (their ASCII data part is ignored)
+static int msg_type_is_empty(int msg_type){
+    return msg_type == FINISHED_GAME || msg_type == P2P_READY || msg_type == CLIENTS_CONNECTED || msg_type == START_GAME;
+}
+
+/* Attempts to decode one framed message from the bytes buffered for the connection. On success, the data part is not
+ * copied; rather recvMsg->msg points into the receive buffer. For ASCII frames the data part is always null-terminated;
+ * for binary frames it is laid out as described in protocol.h (see also msg_get_int), i.e. integer types carry exactly
+ * 4 bytes, and any other data part is null-terminated by the sender.
+ *
+ * Returns 1 if a message was decoded, 0 if more bytes are required (with frame_len set to the number of bytes required,
+ * or a lower bound thereof), and -1 if the frame is malformed (including a binary payload not laid out as above, which
+ * would otherwise be read out of bounds).
+ */
+static int conn_decode(connection* conn, msg* recvMsg, size_t* frame_len){
+    size_t header_len, msg_len;
+    int ret = conn_frame_len(conn, &header_len, &msg_len);
+
+    *frame_len = header_len + msg_len;
+    if(ret <= 0){
+        return ret;
+    }
+
+    char* header = conn->buffer + conn->start;
+    recvMsg->msg_alloc = MSG_ALLOC_VIEW; // the data part is a view into the receive buffer
+
+    if(header[0] >= '0'){
+        recvMsg->msg_type = header[MSG_LEN_DIGITS + 2] - '0';
+        recvMsg->msg_format = MSG_FORMAT_ASCII;
+
+        if(msg_len > 0){
+            recvMsg->msg = header + header_len;
+            recvMsg->msg[msg_len - 1] = '\0'; // ensure null terminated, even if the sender misbehaves
+        }else{
+            recvMsg->msg = ""; // an empty data part is still presented as an (empty) string
+        }
+    }else{
+        recvMsg->msg_type = header[0];
+        recvMsg->msg_format = MSG_FORMAT_BINARY;
+        recvMsg->msg = msg_len > 0 ? header + header_len : "";
+
+        if(msg_type_is_int(recvMsg->msg_type) ? msg_len != 4 : (msg_len > 0 && recvMsg->msg[msg_len - 1] != '\0')){
+            return -1;
+        }
+    }
+
+    conn_count_msg(conn, recvMsg->msg_type, 0);
+
+    conn->start += *frame_len;
+    if(conn->start == conn->end){ // if the buffer has been fully consumed, rewind it for free
+        conn->start = conn->end = 0;
+    }
+
+    return 1;
+}
+
+/* Ensures that the receive buffer has space for at least frame_len bytes from conn->start onwards, by first moving any
+ * partially received frame to the beginning of the buffer and then, if still required, growing the buffer. Note that
+ * moving the bytes invalidates any messages previously returned for this connection. Returns 0 on success, -1 otherwise.
+ */
+static int conn_reserve(connection* conn, size_t frame_len){
+    if(conn->start > 0 && conn->capacity - conn->start < frame_len){
+        memmove(conn->buffer, conn->buffer + conn->start, conn->end - conn->start);
+        conn->end -= conn->start;
+        conn->start = 0;
+    }
+
+    if(conn->capacity < frame_len || conn->buffer == NULL){
+        size_t capacity = conn->capacity > 0 ? conn->capacity : CONN_RECV_BUFFER_SIZE;
+        while(capacity < frame_len){ capacity <<= 1;}
+
+        char* buffer = realloc(conn->buffer, capacity);
+        if(buffer == NULL){
+            return -1;
+        }
+
+        conn->buffer = buffer;
+        conn->capacity = capacity;
+    }
+
+    return 0;
+}
+
+/* Fetches the next message from the specified socket. If a complete message is already buffered, no system call is made;
+ * otherwise a single call to recv fills the free space of the receive buffer with as many bytes as are available, which
+ * typically yields several messages at once during bursts of traffic.
+ *
+ * The data part of the returned message is a view into the receive buffer, and hence remains valid only until the next
+ * call for the same socket (or until the connection is released); callers wishing to retain it must copy it.
+ *
+ * Returns 0 on success, -1 on failure (disconnection, socket error or malformed message).
+ */
+int conn_read_msg(int socket_fd, msg* recvMsg){
+    connection* conn = conn_get(socket_fd);
+    if(conn == NULL){
+        return -1;
+    }
+
+    while(1){
+        size_t frame_len;
+        int ret = conn_decode(conn, recvMsg, &frame_len);
+
+        if(ret > 0){
+            return 0;
+        }else if(ret < 0 || conn_reserve(conn, frame_len) < 0){
+            return -1;
+        }
+
+        ssize_t n_bytes = recv(socket_fd, conn->buffer + conn->end, conn->capacity - conn->end, 0);
+        conn_count_io(conn, n_bytes, 0);
+        if(n_bytes > 0){
+            conn->end += n_bytes;
+            if(conn->quick_ack){ socket_rearm_quick_ack(socket_fd);}
+        }else if(n_bytes == 0 || errno != EINTR){ // orderly shutdown by the peer, or socket error
+            return -1;
+        }
+    }
+}
+
+/* Non-blocking variant of conn_read_msg, intended for use with edge-triggered readiness notification: returns 1 if a
+ * message was fetched, 0 if no complete message is available without blocking (in which case the socket has been
+ * drained, i.e. recv reported EAGAIN), and -1 on failure (disconnection, socket error or malformed message). Since
+ * MSG_DONTWAIT is used, the socket itself need not be in non-blocking mode.
+ */
+int conn_poll_msg(int socket_fd, msg* recvMsg){
+    connection* conn = conn_get(socket_fd);
+    if(conn == NULL){
+        return -1;
+    }
+
+    while(1){
+        size_t frame_len;
+        int ret = conn_decode(conn, recvMsg, &frame_len);
+
+        if(ret > 0){
+            return 1;
+        }else if(ret < 0 || conn_reserve(conn, frame_len) < 0){
+            return -1;
+        }
+
+        ssize_t n_bytes = recv(socket_fd, conn->buffer + conn->end, conn->capacity - conn->end, MSG_DONTWAIT);
+        conn_count_io(conn, n_bytes, 0);
+        if(n_bytes > 0){
+            conn->end += n_bytes;
+            if(conn->quick_ack){ socket_rearm_quick_ack(socket_fd);}
+        }else if(n_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            return 0;
+        }else if(n_bytes == 0 || errno != EINTR){ // orderly shutdown by the peer, or socket error
+            return -1;
+        }
+    }
+}
+
+// Returns 1 if a complete message is buffered for the specified socket (i.e. can be read without a system call), else 0
+int conn_has_msg(int socket_fd){
+    connection* conn = conn_get(socket_fd);
+    if(conn == NULL){
+        return 0;
+    }
+
+    size_t header_len, msg_len;
+    return conn_frame_len(conn, &header_len, &msg_len) > 0;
+}
+
+/* Discards any bytes buffered for the specified socket; must be called before the descriptor is closed, since the same
+ * descriptor number may then be re-used by a new socket. The buffer itself is kept for re-use, and the counters of the
+ * socket are reset (callers keeping instrumentation must first take them, see net_counters_merge).
+ */
+void conn_release(int socket_fd){
+    connection* conn = conn_get(socket_fd);
+    if(conn != NULL){
+        net_counters_reset(&conn->counters);
+
+        conn->start = conn->end = 0;
+        conn->out_start = conn->out_end = 0; // any bytes queued but not yet sent are dropped along with the connection
+        conn->format = MSG_FORMAT_ASCII; // new connections always start off in ASCII, until negotiated otherwise
+        conn->quick_ack = 0;
+        reactor_source_clear(&conn->source); // closing the descriptor implicitly removes it from any epoll instance
+    }
+}
+
+/* Sets the format in which messages are sent on the specified socket (MSG_FORMAT_ASCII or MSG_FORMAT_BINARY). Note that
+ * received messages are always accepted in either format; the format should only be set to binary once the peer has
+ * advertised that it supports it (see PEER_HELLO).
+ */
+void conn_set_format(int socket_fd, int format){
+    connection* conn = conn_get(socket_fd);
+    if(conn != NULL){
+        conn->format = format;
+    }
+}
+
+// Sets whether TCP_QUICKACK is re-armed after every read from the specified socket (see socket_rearm_quick_ack)
+void conn_set_quick_ack(int socket_fd, int enabled){
+    connection* conn = conn_get(socket_fd);
+    if(conn != NULL){
+        conn->quick_ack = enabled;
+    }
+}
+
+/* Encodes the fixed-width ASCII header '<msg_len>::<msg_type>::' into header (of at least HEADER_SIZE - 1 bytes), with
+ * msg_len zero-padded to MSG_LEN_DIGITS digits, using integer arithmetic only. Returns -1 if msg_len does not fit in
+ * MSG_LEN_DIGITS digits or the type is not a message type (sent as the single character '0' + msg_type), 0 otherwise.
+ */
+static int conn_encode_header(char* header, size_t msg_len, int msg_type){
+    if(msg_len > MSG_MAX_LEN || msg_type < 0 || msg_type > PEER_PONG){
+        return -1;
+    }
+
+    for(int i = MSG_LEN_DIGITS - 1; i >= 0; i--){ // fill in the digits from least to most significant
+        header[i] = (char) ('0' + msg_len % 10);
+        msg_len /= 10;
+    }
+
+    header[MSG_LEN_DIGITS] = ':'; header[MSG_LEN_DIGITS + 1] = ':';
+    header[MSG_LEN_DIGITS + 2] = (char) ('0' + msg_type);
+    header[MSG_LEN_DIGITS + 3] = ':'; header[MSG_LEN_DIGITS + 4] = ':';
+
+    return 0;
+}
+
+// Encodes value as an unsigned LEB128 varint into buffer (of at least MSG_VARINT_MAX_BYTES bytes); returns the length
+static size_t conn_encode_varint(unsigned char* buffer, size_t value){
+    size_t i = 0;
+    for(; value >= 0x80; value >>= 7){
+        buffer[i++] = (unsigned char) (value | 0x80);
+    }
+    buffer[i++] = (unsigned char) value;
+
+    return i;
+}
+
+// Writes value into buffer as a 32-bit little-endian integer, independent of host byte order
+static void conn_put_le32(unsigned char* buffer, int value){
+    unsigned int v = (unsigned int) value;
+    buffer[0] = (unsigned char) v; buffer[1] = (unsigned char) (v >> 8);
+    buffer[2] = (unsigned char) (v >> 16); buffer[3] = (unsigned char) (v >> 24);
+}
+
+/* Writes the decimal representation of value into digits (of CONN_INT_DIGITS characters), right-aligned and null
+ * terminated, using integer arithmetic only. Returns a pointer to the first character of the representation.
+ */
+static char* conn_format_int(char* digits, int value){
+    char* p = digits + CONN_INT_DIGITS - 1; *p = '\0';
+    unsigned int v = value < 0 ? 0u - (unsigned int) value : (unsigned int) value;
+
+    do{
+        *--p = (char) ('0' + v % 10);
+        v /= 10;
+    }while(v > 0);
+
+    if(value < 0){ *--p = '-';}
+
+    return p;
+}
+
+/* Decodes the integer carried by a message of an integer type (LINES_CLEARED, SCORE_UPDATE, PEER_HELLO, PEER_ACK,
+ * PEER_PING, PEER_PONG), irrespective of the format in which it was received: a decimal string in ASCII, a 32-bit
+ * little-endian integer in binary (of exactly 4 bytes, as checked by conn_decode).
+ */
+int msg_get_int(msg recvMsg){
+    if(recvMsg.msg_format == MSG_FORMAT_BINARY){
+        unsigned char* p = (unsigned char*) recvMsg.msg;
+        return (int) ((unsigned int) p[0] | (unsigned int) p[1] << 8 | (unsigned int) p[2] << 16 | (unsigned int) p[3] << 24);
+    }
+
+    return (int) strtol(recvMsg.msg, NULL, 10);
+}
+
+// Sends the header and payload as a single frame using sendmsg (see conn_send); returns bytes sent, or -1 on failure
+static int conn_sendv(int socket_fd, const void* header, size_t header_len, const void* data, size_t data_len){
+    // any bytes still queued on the socket (see conn_queue_int) are sent first, such that frames are never interleaved
+    connection* queued = conn_get(socket_fd);
+    if(queued != NULL && queued->out_start < queued->out_end && conn_flush(socket_fd, 1) < 0){
+        return -1;
+    }
+
+    connection* conn = net_stats_enabled() ? queued : NULL;
+    struct iovec iov[2] = {{.iov_base = (void*) header, .iov_len = header_len},
+                           {.iov_base = (void*) data, .iov_len = data_len}};
+    struct msghdr msgHdr = {.msg_iov = iov, .msg_iovlen = data_len > 0 ? 2 : 1};
+    size_t to_send = header_len + data_len;
+
+    for(size_t tbs = 0; tbs < to_send;){ // tbs = total bytes sent
+        ssize_t sent_bytes = sendmsg(socket_fd, &msgHdr, MSG_NOSIGNAL);
+        if(conn != NULL){ conn_count_io(conn, sent_bytes, 1);}
+        if(sent_bytes < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+
+        tbs += sent_bytes;
+
+        // on a partial send, skip over the fully sent iovecs and advance within the partially sent one
+        while(msgHdr.msg_iovlen > 0 && (size_t) sent_bytes >= msgHdr.msg_iov->iov_len){
+            sent_bytes -= msgHdr.msg_iov->iov_len;
+            msgHdr.msg_iov++; msgHdr.msg_iovlen--;
+        }
+        if(msgHdr.msg_iovlen > 0){
+            msgHdr.msg_iov->iov_base = (char*) msgHdr.msg_iov->iov_base + sent_bytes;
+            msgHdr.msg_iov->iov_len -= sent_bytes;
+        }
+    }
+
+    return (int) to_send;
+}
+
+// Sends a binary frame with the given (already encoded) payload; returns bytes sent, or -1 on failure
+static int conn_send_binary(int socket_fd, int msg_type, const void* payload, size_t payload_len){
+    unsigned char header[1 + MSG_VARINT_MAX_BYTES];
+    if(msg_type < 0 || msg_type >= '0' || payload_len > MSG_BINARY_MAX_LEN){
+        return -1;
+    }
+
+    header[0] = (unsigned char) msg_type;
+    size_t header_len = 1 + conn_encode_varint(header + 1, payload_len);
+    if(net_stats_enabled()){ conn_count_msg(conn_get(socket_fd), msg_type, 1);}
+
+    return conn_sendv(socket_fd, header, header_len, payload, payload_len);
+}
+
+/* Sends a framed message on the specified socket, where data is a null-terminated string of data_len characters, in the
+ * format negotiated for the socket. In ASCII, the null character is sent along with the data part, as expected by the
+ * receiving end. In binary, the data part of integer types is converted to its fixed-size payload, that of types without
+ * a payload is dropped, and any other data part is sent as is (along with the null character).
+ *
+ * The header is encoded into a small stack buffer and sent together with the data part using a single call to sendmsg
+ * (scatter-gather), such that the data part is never copied. Further calls are only made in the case of a partial send.
+ * MSG_NOSIGNAL ensures that writing to a socket closed by the peer returns an error rather than raising SIGPIPE.
+ *
+ * Returns the total number of bytes sent on success, -1 on failure.
+ */
+int conn_send(int socket_fd, int msg_type, const char* data, size_t data_len){
+    connection* conn = conn_get(socket_fd);
+
+    if(conn != NULL && conn->format == MSG_FORMAT_BINARY){
+        if(msg_type_is_int(msg_type)){
+            return conn_send_int(socket_fd, msg_type, (int) strtol(data, NULL, 10));
+        }else if(msg_type_is_empty(msg_type)){
+            return conn_send_binary(socket_fd, msg_type, NULL, 0);
+        }
+
+        return conn_send_binary(socket_fd, msg_type, data, data_len + 1);
+    }
+
+    char header[HEADER_SIZE];
+    if(conn_encode_header(header, data_len + 1, msg_type) < 0){
+        return -1;
+    }
+    conn_count_msg(conn, msg_type, 1);
+
+    return conn_sendv(socket_fd, header, HEADER_SIZE - 1, data, data_len + 1);
+}
+
+/* Sends a message carrying a single integer on the specified socket, in the format negotiated for the socket, without
+ * going through an intermediate string in the binary case. In the ASCII case, the decimal representation is generated
+ * with integer arithmetic into a stack buffer. Returns the total number of bytes sent on success, -1 on failure.
+ */
+int conn_send_int(int socket_fd, int msg_type, int value){
+    connection* conn = conn_get(socket_fd);
+
+    if(conn != NULL && conn->format == MSG_FORMAT_BINARY){
+        unsigned char payload[4];
+        conn_put_le32(payload, value);
+
+        return conn_send_binary(socket_fd, msg_type, payload, sizeof(payload));
+    }
+
+    char digits[CONN_INT_DIGITS];
+    char* p = conn_format_int(digits, value);
+
+    return conn_send(socket_fd, msg_type, p, digits + CONN_INT_DIGITS - 1 - p);
+}
+
+/* Ensures that the send buffer has space for at least frame_len more bytes, by first moving any bytes not yet sent to
+ * the beginning of the buffer and then, if still required, growing the buffer. Returns 0 on success, -1 otherwise.
+ */
+static int conn_reserve_out(connection* conn, size_t frame_len){
+    if(conn->out_start > 0){
+        memmove(conn->out_buffer, conn->out_buffer + conn->out_start, conn->out_end - conn->out_start);
+        conn->out_end -= conn->out_start;
+        conn->out_start = 0;
+    }
+
+    if(conn->out_capacity - conn->out_end < frame_len || conn->out_buffer == NULL){
+        size_t capacity = conn->out_capacity > 0 ? conn->out_capacity : CONN_SEND_BUFFER_SIZE;
+        while(capacity - conn->out_end < frame_len){ capacity <<= 1;}
+
+        char* buffer = realloc(conn->out_buffer, capacity);
+        if(buffer == NULL){
+            return -1;
+        }
+
+        conn->out_buffer = buffer;
+        conn->out_capacity = capacity;
+    }
+
+    return 0;
+}
+
+/* Queues a message carrying a single integer in the send buffer of the specified socket, in the format negotiated for
+ * the socket, without sending it; queued messages are sent by conn_flush, such that several of them may be written out
+ * with a single system call. Returns 0 on success, -1 on failure.
+ */
+int conn_queue_int(int socket_fd, int msg_type, int value){
+    connection* conn = conn_get(socket_fd);
+    unsigned char frame[HEADER_SIZE + CONN_INT_DIGITS];
+    size_t frame_len;
+
+    if(conn == NULL){
+        return -1;
+    }
+
+    if(conn->format == MSG_FORMAT_BINARY){
+        if(msg_type < 0 || msg_type >= '0'){
+            return -1;
+        }
+
+        frame[0] = (unsigned char) msg_type;
+        frame_len = 1 + conn_encode_varint(frame + 1, 4);
+        conn_put_le32(frame + frame_len, value);
+        frame_len += 4;
+    }else{
+        char digits[CONN_INT_DIGITS];
+        char* p = conn_format_int(digits, value);
+        size_t data_len = digits + CONN_INT_DIGITS - p; // including the null character
+
+        if(conn_encode_header((char*) frame, data_len, msg_type) < 0){
+            return -1;
+        }
+
+        memcpy(frame + HEADER_SIZE - 1, p, data_len);
+        frame_len = HEADER_SIZE - 1 + data_len;
+    }
+
+    if(conn_reserve_out(conn, frame_len) < 0){
+        return -1;
+    }
+
+    memcpy(conn->out_buffer + conn->out_end, frame, frame_len);
+    conn->out_end += frame_len;
+    conn_count_msg(conn, msg_type, 1);
+
+    return 0;
+}
+
+/* Sends as much of the send buffer of the specified socket as possible, with a single call to send unless interrupted
+ * or only partially sent. Unless wait is set, we never block: if the socket cannot take any more bytes, the rest are
+ * kept queued for a later call (typically once the socket is reported writable). Returns 1 if the send buffer has been
+ * fully sent, 0 if some bytes remain queued, -1 on failure.
+ */
+int conn_flush(int socket_fd, int wait){
+    connection* conn = conn_get(socket_fd);
+    if(conn == NULL){
+        return -1;
+    }
+
+    while(conn->out_start < conn->out_end){
+        ssize_t sent_bytes = send(socket_fd, conn->out_buffer + conn->out_start, conn->out_end - conn->out_start,
+                                  MSG_NOSIGNAL | (wait ? 0 : MSG_DONTWAIT));
+        conn_count_io(conn, sent_bytes, 1);
+        if(sent_bytes >= 0){
+            conn->out_start += sent_bytes;
+        }else if(!wait && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            return 0;
+        }else if(errno != EINTR){
+            return -1;
+        }
+    }
+
+    conn->out_start = conn->out_end = 0; // rewind the send buffer for free
+    return 1;
+}
+
+/* Batched variant of conn_flush (without waiting) for the n_fds specified sockets: a send of the bytes queued for each
+ * socket is prepared on the given io_uring instance, and all of them are then submitted (and their completions awaited)
+ * with a single system call, rather than one call to send per socket. Since MSG_DONTWAIT is used, the sends complete
+ * immediately, with -EAGAIN if a socket cannot take any more bytes. The result for each socket, as returned by
+ * conn_flush, is written to results; any socket which cannot be batched (e.g. if the submission queue is full, or after
+ * a partial send) is flushed through conn_flush instead. Returns 0 on success, -1 if the batch could not be submitted
+ * (in which case the result of every socket in the batch is -1).
+ */
+int conn_flush_batch(uring* u, const int* fds, int n_fds, int* results){
+    int n_batched = 0;
+
+    for(int k = 0; k < n_fds; k++){
+        connection* conn = conn_get(fds[k]);
+        results[k] = conn == NULL ? -1 : 1;
+        if(conn == NULL || conn->out_start == conn->out_end){
+            continue;
+        }
+
+        struct io_uring_sqe* sqe = uring_get_sqe(u);
+        if(sqe == NULL){
+            results[k] = conn_flush(fds[k], 0);
+            continue;
+        }
+
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fds[k];
+        sqe->addr = (unsigned long long) (uintptr_t) (conn->out_buffer + conn->out_start);
+        sqe->len = (unsigned) (conn->out_end - conn->out_start);
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+        sqe->user_data = (unsigned long long) k;
+        n_batched++;
+    }
+
+    if(n_batched == 0){
+        return 0;
+    }else if(uring_submit(u, (unsigned) n_batched) < 0){
+        for(int k = 0; k < n_fds; k++){ results[k] = -1;}
+        return -1;
+    }
+
+    struct io_uring_cqe cqe;
+    for(int n_reaped = 0; n_reaped < n_batched; ){
+        if(!uring_reap(u, &cqe)){ // not yet available (should not be the case, since all completions were awaited)
+            if(uring_submit(u, 1) < 0){
+                return -1;
+            }
+            continue;
+        }
+        n_reaped++;
+
+        int k = (int) cqe.user_data;
+        connection* conn = conn_get(fds[k]);
+        conn_count_io(conn, cqe.res, 1);
+
+        if(cqe.res >= 0){
+            conn->out_start += cqe.res;
+            results[k] = conn->out_start < conn->out_end ? conn_flush(fds[k], 0) : 1; // send any remainder directly
+            if(results[k] > 0){
+                conn->out_start = conn->out_end = 0; // rewind the send buffer for free
+            }
+        }else{
+            results[k] = cqe.res == -EAGAIN || cqe.res == -EWOULDBLOCK ? 0 : -1;
+        }
+    }
+
+    return 0;
+}
+
+// Returns 1 if bytes are queued in the send buffer of the specified socket but not yet sent (see conn_flush), else 0
+int conn_has_queued(int socket_fd){
+    connection* conn = conn_get(socket_fd);
+    return conn != NULL && conn->out_end > conn->out_start;
+}
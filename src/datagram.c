@@ -0,0 +1,319 @@
+#include "../include/datagram.h"
+#include "../include/connection.h"
+#include "../include/net_stats.h"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// Encodes value as a 32-bit little-endian integer at p
+static void dgram_put_u32(unsigned char* p, unsigned int value){
+    p[0] = (unsigned char) value; p[1] = (unsigned char) (value >> 8);
+    p[2] = (unsigned char) (value >> 16); p[3] = (unsigned char) (value >> 24);
+}
+
+// Decodes the 32-bit little-endian integer at p
+static unsigned int dgram_get_u32(const unsigned char* p){
+    return (unsigned int) p[0] | (unsigned int) p[1] << 8 | (unsigned int) p[2] << 16 | (unsigned int) p[3] << 24;
+}
+
+// Counts a call to sendto (outbound = 1) or recvfrom (outbound = 0) on the socket, transferring n_bytes (if positive)
+static void dgram_count_io(int fd, ssize_t n_bytes, int outbound){
+    connection* conn = net_stats_enabled() ? conn_get(fd) : NULL;
+    if(conn != NULL){
+        atomic_fetch_add_explicit(outbound ? &conn->counters.send_calls : &conn->counters.recv_calls, 1, memory_order_relaxed);
+        if(n_bytes > 0){
+            atomic_fetch_add_explicit(outbound ? &conn->counters.bytes_out : &conn->counters.bytes_in, (unsigned long long) n_bytes,
+                                      memory_order_relaxed);
+        }
+    }
+}
+
+/* Opens the (non-blocking) datagram socket of the endpoint, bound to the given port on every interface; the port space
+ * of UDP being separate from that of TCP, this is the same port as that on which P2P connections are accepted. Returns 0
+ * on success, -1 on failure.
+ */
+int dgram_open(dgram_endpoint* ep, int port){
+    ep->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(ep->fd < 0){
+        return -1;
+    }
+
+    struct sockaddr_in sockaddrIn = {.sin_family = AF_INET, .sin_addr.s_addr = INADDR_ANY, .sin_port = htons(port)};
+    if(bind(ep->fd, (struct sockaddr*) &sockaddrIn, sizeof(sockaddrIn)) < 0){
+        close(ep->fd);
+        ep->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Discards every datagram already received on the socket of the endpoint (e.g. left over from a previous game session)
+void dgram_drain(dgram_endpoint* ep){
+    char buffer[DGRAM_MAX_SIZE];
+    while(ep->fd >= 0 && recv(ep->fd, buffer, sizeof(buffer), 0) >= 0);
+}
+
+/* Sets the fraction (in thousandths) of datagrams sent on the endpoint which are dropped on purpose, emulating a lossy
+ * network (e.g. for benchmarks, on hosts without netem); 0 (the default) drops none.
+ */
+void dgram_set_loss(dgram_endpoint* ep, int loss_permille){
+    ep->loss_permille = loss_permille < 0 ? 0 : loss_permille > 1000 ? 1000 : loss_permille;
+    ep->loss_seed = (unsigned int) net_stats_now_ns();
+}
+
+// Resets the link for a new game session with the peer whose datagram socket is bound to the given IPv4 address and port
+void dgram_link_reset(dgram_link* link, const char* ip, int port){
+    memset(link, 0, sizeof(dgram_link));
+    link->addr.sin_family = AF_INET;
+    link->addr.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &link->addr.sin_addr);
+    link->next_seq = 1;
+    link->probe_ms = DGRAM_PROBE_MS;
+}
+
+// Returns the current retransmission timeout of the link in nanoseconds, before any backoff (see RFC 6298)
+static long long dgram_rto_ns(dgram_link* link){
+    if(link->srtt_us == 0){
+        return DGRAM_INITIAL_RTO_MS * 1000000LL;
+    }
+
+    long long rto_us = link->srtt_us + 4LL * link->rtt_var_us;
+    if(rto_us < DGRAM_MIN_RTO_MS * 1000LL){ rto_us = DGRAM_MIN_RTO_MS * 1000LL;}
+    if(rto_us > DGRAM_MAX_RTO_MS * 1000LL){ rto_us = DGRAM_MAX_RTO_MS * 1000LL;}
+
+    return rto_us * 1000;
+}
+
+/* Sends a datagram to the peer, carrying the message with the given sequence number (or none if seq is 0) and
+ * acknowledging everything received from the peer so far, which clears any acknowledgement owed to it; flags are set in
+ * addition to those derived from the link (e.g. DGRAM_PROBE). A datagram which cannot be sent (e.g. if the socket buffer
+ * is full) is treated as lost. Returns 0.
+ */
+static int dgram_send(dgram_endpoint* ep, dgram_link* link, int flags, unsigned int seq, int msg_type, int value){
+    unsigned char buffer[DGRAM_MAX_SIZE];
+    size_t len = DGRAM_HEADER_SIZE;
+
+    buffer[0] = DGRAM_MAGIC;
+    buffer[1] = (unsigned char) (flags | (seq > 0 ? DGRAM_DATA : 0) | (link->heard ? DGRAM_HEARD : 0));
+    buffer[2] = (unsigned char) ep->slot; buffer[3] = (unsigned char) (ep->slot >> 8);
+    dgram_put_u32(buffer + 4, ep->session);
+    dgram_put_u32(buffer + 8, seq);
+    dgram_put_u32(buffer + 12, link->recv_seq);
+    dgram_put_u32(buffer + 16, link->recv_bits);
+    if(seq > 0){ // a binary frame (see protocol.h): type, payload length (a single byte varint) and payload
+        buffer[len++] = (unsigned char) msg_type;
+        buffer[len++] = 4;
+        dgram_put_u32(buffer + len, (unsigned int) value); len += 4;
+    }
+    link->ack_pending = 0;
+
+    if(ep->loss_permille > 0 && (unsigned int) rand_r(&ep->loss_seed) % 1000u < (unsigned int) ep->loss_permille){
+        return 0; // dropped on purpose (see dgram_set_loss)
+    }
+
+    ssize_t sent_bytes;
+    do{
+        sent_bytes = sendto(ep->fd, buffer, len, 0, (struct sockaddr*) &link->addr, sizeof(link->addr));
+    }while(sent_bytes < 0 && errno == EINTR);
+    dgram_count_io(ep->fd, sent_bytes, 1);
+
+    if(seq > 0 && sent_bytes > 0 && net_stats_enabled()){
+        net_counters_add_msg(&conn_get(ep->fd)->counters, msg_type, 1);
+    }
+
+    return 0;
+}
+
+// Returns the lowest sequence number sent to the peer but not yet acknowledged, or next_seq if there is none
+static unsigned int dgram_oldest_pending(dgram_link* link){
+    unsigned int oldest = link->next_seq;
+    for(int k = 0; k < DGRAM_WINDOW && link->n_pending > 0; k++){
+        if(link->pending[k].seq != 0 && (int) (oldest - link->pending[k].seq) > 0){
+            oldest = link->pending[k].seq;
+        }
+    }
+    return oldest;
+}
+
+/* Sends a message carrying a single integer (see msg_get_int) to the peer, to be retransmitted until acknowledged (see
+ * dgram_service). Returns 1 if the message was sent, 0 if it would be DGRAM_WINDOW or more sequence numbers ahead of the
+ * oldest message awaiting acknowledgement (in which case it is up to the caller to send it once that is acknowledged).
+ * Bounding the span of sequence numbers in flight, rather than merely their number, keeps every message within reach of
+ * the duplicate suppression (and acknowledgement bitmap) of the peer, however many later ones are acknowledged first.
+ */
+int dgram_send_int(dgram_endpoint* ep, dgram_link* link, int msg_type, int value){
+    if(link->next_seq - dgram_oldest_pending(link) >= DGRAM_WINDOW){
+        return 0;
+    }
+
+    dgram_pending* pending = link->pending;
+    while(pending->seq != 0){ pending++;} // some entry is free, since fewer than DGRAM_WINDOW sequence numbers are in use
+
+    long long now_ns = net_stats_now_ns();
+    *pending = (dgram_pending) {.seq = link->next_seq++, .msg_type = msg_type, .value = value, .sent_ns = now_ns,
+                                .due_ns = now_ns + dgram_rto_ns(link)};
+    link->n_pending++;
+
+    dgram_send(ep, link, 0, pending->seq, msg_type, value);
+
+    return 1;
+}
+
+// Sends a datagram carrying no message to the peer, merely acknowledging everything received from it so far. Returns 0.
+int dgram_send_ack(dgram_endpoint* ep, dgram_link* link){
+    return dgram_send(ep, link, 0, 0, EMPTY, 0);
+}
+
+/* Receives the next datagram on the socket of the endpoint into packet, discarding any which are malformed or from
+ * another game session. Returns 1 if a datagram was received, 0 if none are left (i.e. the socket has been drained).
+ */
+int dgram_recv(dgram_endpoint* ep, dgram_packet* packet){
+    while(1){
+        ssize_t len = recv(ep->fd, packet->buffer, sizeof(packet->buffer), 0);
+        dgram_count_io(ep->fd, len, 0);
+        if(len < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return 0; // EAGAIN, or an error reported for a datagram sent earlier (e.g. port unreachable), i.e. loss
+        }
+
+        unsigned char* p = (unsigned char*) packet->buffer;
+        if(len < DGRAM_HEADER_SIZE || p[0] != DGRAM_MAGIC || dgram_get_u32(p + 4) != ep->session){
+            continue;
+        }
+
+        packet->flags = p[1];
+        packet->slot = p[2] | p[3] << 8;
+        packet->seq = dgram_get_u32(p + 8);
+        packet->ack = dgram_get_u32(p + 12);
+        packet->ack_bits = dgram_get_u32(p + 16);
+        packet->msg = (msg) {.msg_type = EMPTY, .msg = NULL, .msg_format = MSG_FORMAT_BINARY, .msg_alloc = MSG_ALLOC_VIEW};
+
+        if(packet->flags & DGRAM_DATA){
+            if(packet->seq == 0 || len != DGRAM_HEADER_SIZE + 6 || p[DGRAM_HEADER_SIZE] >= '0' || p[DGRAM_HEADER_SIZE + 1] != 4){
+                continue;
+            }
+            packet->msg.msg_type = p[DGRAM_HEADER_SIZE];
+            packet->msg.msg = packet->buffer + DGRAM_HEADER_SIZE + 2;
+            if(net_stats_enabled()){ net_counters_add_msg(&conn_get(ep->fd)->counters, packet->msg.msg_type, 0);}
+        }
+
+        return 1;
+    }
+}
+
+// Updates the round-trip time estimate of the link with a new sample (smoothed as in RFC 6298)
+static void dgram_update_rtt(dgram_link* link, long long sample_ns){
+    int sample_us = sample_ns / 1000 > 0 ? (int) (sample_ns / 1000) : 1;
+
+    if(link->srtt_us == 0){
+        link->srtt_us = sample_us;
+        link->rtt_var_us = sample_us / 2;
+    }else{
+        int deviation = link->srtt_us > sample_us ? link->srtt_us - sample_us : sample_us - link->srtt_us;
+        link->rtt_var_us = (3 * link->rtt_var_us + deviation) / 4;
+        link->srtt_us = (7 * link->srtt_us + sample_us) / 8 > 0 ? (7 * link->srtt_us + sample_us) / 8 : 1;
+    }
+}
+
+/* Handles a datagram received from the peer: releases every message it acknowledges (taking a round-trip time sample
+ * from those never retransmitted, as per Karn's algorithm), and records the message it carries (if any) as received.
+ * Returns 1 if the datagram carries a message not received before, which is then to be delivered, 0 otherwise (i.e. no
+ * message, or a duplicate).
+ */
+int dgram_handle(dgram_link* link, const dgram_packet* packet){
+    long long now_ns = net_stats_now_ns();
+
+    link->heard = 1;
+    if(packet->flags & DGRAM_HEARD){
+        link->confirmed = 1;
+    }
+    if(packet->flags & DGRAM_PROBE){
+        link->ack_pending = 1; // the peer does not yet know that we hear it, hence reply even if only to confirm the link
+    }
+
+    // acknowledgements: the highest sequence number received by the peer, and a bitmap of the DGRAM_WINDOW before it
+    for(int k = 0; k < DGRAM_WINDOW && link->n_pending > 0 && packet->ack > 0; k++){
+        dgram_pending* pending = link->pending + k;
+        unsigned int distance = packet->ack - pending->seq;
+        if(pending->seq == 0 || (int) distance < 0 || distance > DGRAM_WINDOW ||
+           (distance > 0 && !(packet->ack_bits & (1u << (distance - 1))))){
+            continue;
+        }
+
+        if(pending->retransmits == 0){
+            dgram_update_rtt(link, now_ns - pending->sent_ns);
+        }
+        pending->seq = 0;
+        link->n_pending--;
+    }
+
+    if(!(packet->flags & DGRAM_DATA)){
+        return 0;
+    }
+    link->ack_pending = 1;
+
+    // duplicate suppression: the message is new unless it is the highest received so far, or flagged in the bitmap
+    unsigned int seq = packet->seq;
+    if(seq > link->recv_seq){
+        unsigned int shift = seq - link->recv_seq;
+        link->recv_bits = shift >= DGRAM_WINDOW ? 0 : link->recv_bits << shift;
+        if(link->recv_seq > 0 && shift <= DGRAM_WINDOW){
+            link->recv_bits |= 1u << (shift - 1);
+        }
+        link->recv_seq = seq;
+        return 1;
+    }
+
+    unsigned int distance = link->recv_seq - seq;
+    if(distance == 0 || distance > DGRAM_WINDOW || (link->recv_bits & (1u << (distance - 1)))){
+        return 0; // senders keep fewer than DGRAM_WINDOW sequence numbers in flight, hence older ones are duplicates
+    }
+    link->recv_bits |= 1u << (distance - 1);
+
+    return 1;
+}
+
+/* Retransmits every message sent to the peer whose retransmission timeout has expired (backing off exponentially, up to
+ * DGRAM_MAX_RTO_MS), and probes the peer while datagrams are not yet known to get through in both directions. Returns
+ * the time in milliseconds until it is next due, or -1 if there is nothing left to retransmit nor probe.
+ */
+int dgram_service(dgram_endpoint* ep, dgram_link* link, long long now_ns){
+    long long next_ns = -1;
+
+    for(int k = 0; k < DGRAM_WINDOW && link->n_pending > 0; k++){
+        dgram_pending* pending = link->pending + k;
+        if(pending->seq == 0){
+            continue;
+        }
+
+        if(now_ns >= pending->due_ns){
+            pending->retransmits++;
+            long long rto_ns = dgram_rto_ns(link) << (pending->retransmits < 6 ? pending->retransmits : 6);
+            pending->due_ns = now_ns + (rto_ns < DGRAM_MAX_RTO_MS * 1000000LL ? rto_ns : DGRAM_MAX_RTO_MS * 1000000LL);
+            atomic_fetch_add_explicit(&ep->retransmits, 1, memory_order_relaxed);
+            dgram_send(ep, link, 0, pending->seq, pending->msg_type, pending->value);
+        }
+        if(next_ns < 0 || pending->due_ns < next_ns){
+            next_ns = pending->due_ns;
+        }
+    }
+
+    if(!link->confirmed){
+        if(now_ns >= link->probe_due_ns){
+            dgram_send(ep, link, DGRAM_PROBE, 0, EMPTY, 0);
+            link->probe_due_ns = now_ns + link->probe_ms * 1000000LL;
+            link->probe_ms = link->probe_ms * 2 < DGRAM_MAX_RTO_MS ? link->probe_ms * 2 : DGRAM_MAX_RTO_MS;
+        }
+        if(next_ns < 0 || link->probe_due_ns < next_ns){
+            next_ns = link->probe_due_ns;
+        }
+    }
+
+    return next_ns < 0 ? -1 : (int) ((next_ns - now_ns + 999999) / 1000000);
+}
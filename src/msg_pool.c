@@ -0,0 +1,67 @@
+#include "../include/msg_pool.h"
+#include "../include/protocol.h"
+#include <stdlib.h>
+
+/* Initialiser for a pool of n_buffers buffers of buffer_size bytes each, all of which are initially free. Returns 0 on
+ * success, -1 on failure (invalid arguments or failure to allocate memory).
+ */
+int msg_pool_init(msg_pool* pool, size_t n_buffers, size_t buffer_size){
+    if(n_buffers == 0 || buffer_size == 0){
+        return -1;
+    }
+
+    pool->slab = malloc(n_buffers * buffer_size);
+    if(pool->slab == NULL){
+        return -1;
+    }
+
+    // buffers may be released by any thread holding a message, hence multiple producers of free buffers
+    if(ring_queue_init(&pool->free_buffers, n_buffers, sizeof(char*), RING_MPSC) < 0){
+        free(pool->slab);
+        return -1;
+    }
+
+    pool->n_buffers = n_buffers;
+    pool->buffer_size = buffer_size;
+
+    for(size_t i = 0; i < n_buffers; i++){
+        char* buffer = pool->slab + i * buffer_size;
+        ring_queue_try_push(&pool->free_buffers, &buffer);
+    }
+
+    return 0;
+}
+
+/* Acquires a buffer of at least len bytes: a pooled buffer if len fits and one is free, otherwise a heap allocation. The
+ * way in which the buffer was obtained is stored in msg_alloc (MSG_ALLOC_POOL or MSG_ALLOC_HEAP), to be passed back to
+ * msg_pool_release. Must only be called by a single thread at a time. Returns NULL if memory could not be allocated.
+ */
+char* msg_pool_acquire(msg_pool* pool, size_t len, int* msg_alloc){
+    char* buffer;
+
+    if(len <= pool->buffer_size && ring_queue_try_pop(&pool->free_buffers, &buffer)){
+        *msg_alloc = MSG_ALLOC_POOL;
+        return buffer;
+    }
+
+    *msg_alloc = MSG_ALLOC_HEAP;
+    return malloc(len);
+}
+
+/* Releases a buffer obtained through msg_pool_acquire, returning it to the pool or to the heap as indicated by
+ * msg_alloc; buffers which are merely views (MSG_ALLOC_VIEW) are left untouched. Safe to call from any thread.
+ */
+void msg_pool_release(msg_pool* pool, char* buffer, int msg_alloc){
+    if(msg_alloc == MSG_ALLOC_POOL){
+        ring_queue_try_push(&pool->free_buffers, &buffer); // never full, since there are only n_buffers buffers
+    }else if(msg_alloc == MSG_ALLOC_HEAP){
+        free(buffer);
+    }
+}
+
+// Releases the slab and the queue of free buffers; any buffers still acquired from the pool become invalid
+void msg_pool_destroy(msg_pool* pool){
+    ring_queue_destroy(&pool->free_buffers);
+    free(pool->slab);
+    pool->slab = NULL;
+}
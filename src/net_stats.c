@@ -0,0 +1,214 @@
+#include "../include/net_stats.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+// Set if instrumentation is enabled; every update is guarded by it, such that disabled instrumentation costs one load
+atomic_int net_stats_active = 0;
+
+// Enables or disables (the default) the collection of instrumentation (see get_net_stats)
+void set_net_stats_enabled(int enabled){
+    atomic_store(&net_stats_active, enabled != 0);
+}
+
+// Returns the current time of the monotonic clock in nanoseconds
+long long net_stats_now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Counts one message of the given type as received (outbound = 0) or sent (outbound = 1); unknown types are ignored
+void net_counters_add_msg(net_counters* counters, int msg_type, int outbound){
+    if(msg_type >= 0 && msg_type < STATS_N_MSG_TYPES){
+        atomic_fetch_add_explicit((outbound ? counters->msgs_out : counters->msgs_in) + msg_type, 1, memory_order_relaxed);
+    }
+}
+
+// Adds the live counters to the snapshot, such that the counters of several sockets may be summed up
+void net_counters_fold(net_counters* counters, net_conn_stats* stats){
+    stats->bytes_in += atomic_load_explicit(&counters->bytes_in, memory_order_relaxed);
+    stats->bytes_out += atomic_load_explicit(&counters->bytes_out, memory_order_relaxed);
+    stats->recv_calls += atomic_load_explicit(&counters->recv_calls, memory_order_relaxed);
+    stats->send_calls += atomic_load_explicit(&counters->send_calls, memory_order_relaxed);
+
+    for(int i = 0; i < STATS_N_MSG_TYPES; i++){
+        stats->msgs_in[i] += atomic_load_explicit(counters->msgs_in + i, memory_order_relaxed);
+        stats->msgs_out[i] += atomic_load_explicit(counters->msgs_out + i, memory_order_relaxed);
+    }
+}
+
+// Takes a snapshot of the live counters
+void net_counters_read(net_counters* counters, net_conn_stats* stats){
+    *stats = (net_conn_stats) {0};
+    net_counters_fold(counters, stats);
+}
+
+// Adds the live counters src to the live counters dst (e.g. to keep those of a socket about to be closed)
+void net_counters_merge(net_counters* dst, net_counters* src){
+    net_conn_stats stats;
+    net_counters_read(src, &stats);
+
+    atomic_fetch_add_explicit(&dst->bytes_in, stats.bytes_in, memory_order_relaxed);
+    atomic_fetch_add_explicit(&dst->bytes_out, stats.bytes_out, memory_order_relaxed);
+    atomic_fetch_add_explicit(&dst->recv_calls, stats.recv_calls, memory_order_relaxed);
+    atomic_fetch_add_explicit(&dst->send_calls, stats.send_calls, memory_order_relaxed);
+
+    for(int i = 0; i < STATS_N_MSG_TYPES; i++){
+        atomic_fetch_add_explicit(dst->msgs_in + i, stats.msgs_in[i], memory_order_relaxed);
+        atomic_fetch_add_explicit(dst->msgs_out + i, stats.msgs_out[i], memory_order_relaxed);
+    }
+}
+
+// Resets the live counters to 0
+void net_counters_reset(net_counters* counters){
+    atomic_store_explicit(&counters->bytes_in, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->bytes_out, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->recv_calls, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->send_calls, 0, memory_order_relaxed);
+
+    for(int i = 0; i < STATS_N_MSG_TYPES; i++){
+        atomic_store_explicit(counters->msgs_in + i, 0, memory_order_relaxed);
+        atomic_store_explicit(counters->msgs_out + i, 0, memory_order_relaxed);
+    }
+}
+
+// Returns the index of the histogram bucket holding value (see net_histogram)
+static int net_histogram_bucket(unsigned long long value){
+    if(value < (1u << STATS_HIST_SUB_BITS)){
+        return (int) value;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    int idx = (msb - STATS_HIST_SUB_BITS + 1) << STATS_HIST_SUB_BITS;
+    idx += (int) ((value >> (msb - STATS_HIST_SUB_BITS)) & ((1u << STATS_HIST_SUB_BITS) - 1));
+
+    return idx < STATS_HIST_BUCKETS ? idx : STATS_HIST_BUCKETS - 1;
+}
+
+// Returns the highest value held by the histogram bucket at index idx (see net_histogram)
+static unsigned long long net_histogram_bucket_max(int idx){
+    if(idx < (1 << STATS_HIST_SUB_BITS)){
+        return (unsigned long long) idx;
+    }
+
+    int shift = (idx >> STATS_HIST_SUB_BITS) - 1;
+    unsigned long long sub = (unsigned long long) (idx & ((1 << STATS_HIST_SUB_BITS) - 1)) | (1u << STATS_HIST_SUB_BITS);
+
+    return ((sub + 1) << shift) - 1;
+}
+
+// Records a (non-negative) latency in the histogram; safe to call from any thread
+void net_histogram_record(net_histogram* hist, long long value_ns){
+    unsigned long long value = value_ns > 0 ? (unsigned long long) value_ns : 0;
+
+    atomic_fetch_add_explicit(hist->counts + net_histogram_bucket(value), 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum_ns, value, memory_order_relaxed);
+
+    unsigned long long max = atomic_load_explicit(&hist->max_ns, memory_order_relaxed);
+    while(value > max && !atomic_compare_exchange_weak_explicit(&hist->max_ns, &max, value, memory_order_relaxed,
+                                                                 memory_order_relaxed));
+}
+
+/* Summarises the histogram by its count, mean, maximum and a few percentiles. Each percentile is reported as the highest
+ * value of the bucket in which it falls (capped at the maximum recorded), i.e. it is never under-estimated.
+ */
+void net_histogram_read(net_histogram* hist, net_latency_stats* stats){
+    unsigned long long counts[STATS_HIST_BUCKETS], total = 0;
+    for(int i = 0; i < STATS_HIST_BUCKETS; i++){
+        counts[i] = atomic_load_explicit(hist->counts + i, memory_order_relaxed);
+        total += counts[i];
+    }
+
+    *stats = (net_latency_stats) {0};
+    stats->count = total;
+    stats->max_ns = atomic_load_explicit(&hist->max_ns, memory_order_relaxed);
+    if(total == 0){
+        return;
+    }
+    stats->mean_ns = atomic_load_explicit(&hist->sum_ns, memory_order_relaxed) / total;
+
+    const int percentiles[3] = {50, 90, 99};
+    unsigned long long* results[3] = {&stats->p50_ns, &stats->p90_ns, &stats->p99_ns};
+    unsigned long long seen = 0;
+
+    for(int i = 0, p = 0; i < STATS_HIST_BUCKETS && p < 3; i++){
+        seen += counts[i];
+        while(p < 3 && seen * 100 >= total * percentiles[p]){
+            unsigned long long value = net_histogram_bucket_max(i);
+            *results[p++] = value < stats->max_ns ? value : stats->max_ns;
+        }
+    }
+}
+
+// Resets the histogram to contain no values
+void net_histogram_reset(net_histogram* hist){
+    for(int i = 0; i < STATS_HIST_BUCKETS; i++){
+        atomic_store_explicit(hist->counts + i, 0, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&hist->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->sum_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->max_ns, 0, memory_order_relaxed);
+}
+
+// Appends formatted output to buffer at *pos (as far as it fits), advancing *pos by the full length of the output
+static void json_append(char* buffer, size_t buffer_len, size_t* pos, const char* fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+
+    int len = vsnprintf(*pos < buffer_len ? buffer + *pos : NULL, *pos < buffer_len ? buffer_len - *pos : 0, fmt, args);
+    if(len > 0){
+        *pos += len;
+    }
+
+    va_end(args);
+}
+
+static void json_append_conn(char* buffer, size_t buffer_len, size_t* pos, const char* name, const net_conn_stats* stats){
+    json_append(buffer, buffer_len, pos, "\"%s\":{\"bytes_in\":%llu,\"bytes_out\":%llu,\"recv_calls\":%llu,\"send_calls\":%llu",
+                name, stats->bytes_in, stats->bytes_out, stats->recv_calls, stats->send_calls);
+
+    const char* directions[2] = {"msgs_in", "msgs_out"};
+    const unsigned long long* counts[2] = {stats->msgs_in, stats->msgs_out};
+    for(int d = 0; d < 2; d++){
+        json_append(buffer, buffer_len, pos, ",\"%s\":[", directions[d]);
+        for(int i = 0; i < STATS_N_MSG_TYPES; i++){
+            json_append(buffer, buffer_len, pos, i > 0 ? ",%llu" : "%llu", counts[d][i]);
+        }
+        json_append(buffer, buffer_len, pos, "]");
+    }
+
+    json_append(buffer, buffer_len, pos, "}");
+}
+
+static void json_append_latency(char* buffer, size_t buffer_len, size_t* pos, const char* name, const net_latency_stats* stats){
+    json_append(buffer, buffer_len, pos, "\"%s\":{\"count\":%llu,\"mean_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,"
+                "\"p99_ns\":%llu,\"max_ns\":%llu}", name, stats->count, stats->mean_ns, stats->p50_ns, stats->p90_ns,
+                stats->p99_ns, stats->max_ns);
+}
+
+/* Writes the snapshot as a (single-line) JSON object into buffer, in the manner of snprintf: at most buffer_len bytes
+ * are written (including the null character), and the length of the full output is returned, such that the caller may
+ * retry with a larger buffer if the return is >= buffer_len. Message counts are given as arrays indexed by msg_type.
+ */
+int net_stats_to_json(const net_stats* stats, char* buffer, size_t buffer_len){
+    size_t pos = 0;
+
+    json_append(buffer, buffer_len, &pos, "{\"enabled\":%d,", stats->enabled);
+    json_append_conn(buffer, buffer_len, &pos, "server", &stats->server);
+    json_append(buffer, buffer_len, &pos, ",");
+    json_append_conn(buffer, buffer_len, &pos, "peers", &stats->peers);
+    json_append(buffer, buffer_len, &pos, ",\"server_queue_high_water\":%llu,\"server_chats_dropped\":%llu,"
+                "\"peer_retransmits\":%llu,\"reactor_wakeups\":%llu,\"reactor_wait_ns\":%llu,", stats->server_queue_high_water,
+                stats->server_chats_dropped, stats->peer_retransmits, stats->reactor_wakeups, stats->reactor_wait_ns);
+    json_append_latency(buffer, buffer_len, &pos, "lines_send_latency", &stats->lines_send_latency);
+    json_append(buffer, buffer_len, &pos, ",");
+    json_append_latency(buffer, buffer_len, &pos, "peer_dispatch_latency", &stats->peer_dispatch_latency);
+    json_append(buffer, buffer_len, &pos, ",\"mesh_setup_ms\":%lld,\"start_wait_ms\":%lld}", stats->mesh_setup_ms,
+                stats->start_wait_ms);
+
+    return (int) pos;
+}
@@ -0,0 +1,282 @@
+#include "../include/peer_connect.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// Progress of the connection to a single target, along with a copy of the target (such that the batch does not depend on
+// the memory of the caller's targets once started)
+typedef struct connect_state{
+    connect_target target;
+    char ip[INET_ADDRSTRLEN];
+    struct sockaddr_un local_addr;
+    int fd; // socket with a connection in progress, or -1 if none
+    int n_attempts;
+    int done;
+    long long next_attempt_ms; // time at which the next attempt may be started
+    int backoff_ms;
+}connect_state;
+
+// Returns the current time of the monotonic clock in milliseconds
+static long long connect_now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Returns the default connect options
+connect_options connect_default_options(){
+    connect_options opts = {.deadline_ms = CONNECT_DEFAULT_DEADLINE_MS, .initial_backoff_ms = CONNECT_DEFAULT_INITIAL_BACKOFF_MS,
+                            .max_backoff_ms = CONNECT_DEFAULT_MAX_BACKOFF_MS, .max_attempts = CONNECT_DEFAULT_MAX_ATTEMPTS,
+                            .profile = NULL};
+    return opts;
+}
+
+/* Starts a non-blocking connection attempt to the target. Returns 1 if the connection was established immediately, 0
+ * if it is in progress (state->fd is then set), and -1 if the attempt failed outright.
+ */
+static int connect_start(const connect_target* target, connect_state* state, const connect_options* opts){
+    struct sockaddr_in addrIn = {.sin_family = AF_INET, .sin_port = htons(target->port)};
+    const struct sockaddr* addr = (struct sockaddr*) &addrIn;
+    socklen_t addr_len = sizeof(addrIn);
+
+    if(target->local_addr != NULL){ // a client on this host, connected to over a Unix domain socket
+        addr = (const struct sockaddr*) target->local_addr;
+        addr_len = target->local_addr_len;
+    }else if(inet_pton(AF_INET, target->ip, &addrIn.sin_addr) <= 0){
+        return -1;
+    }
+
+    int fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        return -1;
+    }
+
+    // (attempt to) allow port reuse, as in client_connect, and apply the socket profile (if any) before connecting
+    if(addr->sa_family == AF_INET){
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
+    }
+    if(opts->profile != NULL){
+        socket_apply_profile(fd, opts->profile);
+    }
+
+    state->n_attempts++;
+    state->fd = fd;
+
+    // note that a Unix domain socket connects immediately, or fails (e.g. if the client is not yet listening)
+    if(connect(fd, addr, addr_len) == 0){
+        return 1;
+    }else if(errno == EINPROGRESS){
+        return 0;
+    }
+
+    close(fd); state->fd = -1;
+    return -1;
+}
+
+/* Handles the outcome of an attempt: on success the socket is reverted to blocking mode and handed over to the callback;
+ * on failure a retry is scheduled after the current backoff (which is then doubled), unless the target has run out of
+ * attempts, in which case the callback is notified of the failure.
+ */
+static void connect_finish(int idx, connect_state* state, int success, const connect_options* opts, long long now,
+                           connect_callback callback, void* arg){
+    if(success){
+        fcntl(state->fd, F_SETFL, fcntl(state->fd, F_GETFL) & ~O_NONBLOCK);
+        state->done = 1;
+        callback(idx, state->fd, arg);
+    }else{
+        if(state->fd >= 0){ close(state->fd);}
+
+        if(state->n_attempts >= opts->max_attempts){
+            state->done = 1;
+            callback(idx, -1, arg);
+        }else{
+            state->next_attempt_ms = now + state->backoff_ms;
+            state->backoff_ms = state->backoff_ms * 2 < opts->max_backoff_ms ? state->backoff_ms * 2 : opts->max_backoff_ms;
+        }
+    }
+
+    state->fd = -1;
+}
+
+/* Starts connecting to all the given targets in parallel (see connect_batch_step), the targets being copied into the
+ * batch. If opts is NULL, the default options are used. Returns 0 on success, -1 on failure.
+ */
+int connect_batch_start(connect_batch* batch, const connect_target* targets, int n_targets, const connect_options* opts,
+                        connect_callback callback, void* arg){
+    memset(batch, 0, sizeof(connect_batch));
+    batch->opts = opts != NULL ? *opts : connect_default_options();
+    batch->callback = callback;
+    batch->arg = arg;
+
+    batch->states = calloc(n_targets, sizeof(connect_state));
+    batch->pfds = calloc(n_targets, sizeof(struct pollfd));
+    batch->pfd_targets = calloc(n_targets, sizeof(int));
+    if(n_targets > 0 && (batch->states == NULL || batch->pfds == NULL || batch->pfd_targets == NULL)){
+        free(batch->states); free(batch->pfds); free(batch->pfd_targets);
+        return -1;
+    }
+
+    long long now = connect_now_ms();
+    batch->n_targets = n_targets;
+    batch->deadline_ms = now + batch->opts.deadline_ms;
+    for(int i = 0; i < n_targets; i++){
+        connect_state* state = batch->states + i;
+        state->target = targets[i];
+        if(targets[i].ip != NULL){
+            strncpy(state->ip, targets[i].ip, sizeof(state->ip) - 1);
+            state->target.ip = state->ip;
+        }
+        if(targets[i].local_addr != NULL){
+            memcpy(&state->local_addr, targets[i].local_addr, targets[i].local_addr_len);
+            state->target.local_addr = &state->local_addr;
+        }
+
+        state->fd = -1;
+        state->next_attempt_ms = now;
+        state->backoff_ms = batch->opts.initial_backoff_ms;
+    }
+
+    return 0;
+}
+
+/* Advances the connections of the batch: a non-blocking connection attempt is issued to every target which is due one,
+ * and the completion of those in progress is awaited together using poll, for up to timeout_ms milliseconds (-1 to wait
+ * until the next attempt is due, 0 not to wait at all). Failed attempts (e.g. a refused connection, as the target may not
+ * be listening yet) are retried with exponential backoff. The callback is called as soon as each target is connected to
+ * or given up on, and in any case by opts.deadline_ms.
+ *
+ * Returns the time in milliseconds until the batch is next to be stepped, or -1 once every target is done (after which
+ * the batch is to be destroyed). When not waiting, attempts in progress are checked every CONNECT_POLL_INTERVAL_MS.
+ */
+int connect_batch_step(connect_batch* batch, int timeout_ms){
+    long long now = connect_now_ms();
+    long long wake_at = batch->deadline_ms;
+    int n_pfds = 0;
+
+    for(int i = 0; i < batch->n_targets; i++){
+        connect_state* state = batch->states + i;
+        if(state->done){
+            continue;
+        }
+
+        if(now >= batch->deadline_ms){ // out of time: abandon the target
+            if(state->fd >= 0){ close(state->fd); state->fd = -1;}
+            state->done = 1; batch->n_done++;
+            batch->callback(i, -1, batch->arg);
+            continue;
+        }
+
+        // start a new attempt if none is in progress and its backoff has elapsed
+        if(state->fd < 0 && state->next_attempt_ms <= now){
+            int ret = connect_start(&state->target, state, &batch->opts);
+            if(ret != 0){
+                connect_finish(i, state, ret > 0, &batch->opts, now, batch->callback, batch->arg);
+                if(state->done){
+                    batch->n_done++; batch->n_connected += ret > 0;
+                    continue;
+                }
+            }
+        }
+
+        if(state->fd >= 0){ // wait for the attempt in progress to complete
+            batch->pfds[n_pfds].fd = state->fd; batch->pfds[n_pfds].events = POLLOUT; batch->pfds[n_pfds].revents = 0;
+            batch->pfd_targets[n_pfds++] = i;
+        }else if(state->next_attempt_ms < wake_at){ // else wake up in time for the next attempt
+            wake_at = state->next_attempt_ms;
+        }
+    }
+
+    if(batch->n_done == batch->n_targets){
+        return -1;
+    }
+
+    int timeout = wake_at > now ? (int) (wake_at - now) : 0;
+    if(timeout_ms >= 0 && timeout_ms < timeout){
+        timeout = timeout_ms;
+    }
+    if(poll(batch->pfds, n_pfds, timeout) < 0 && errno != EINTR){ // any pending attempt is then abandoned
+        for(int i = 0; i < batch->n_targets; i++){
+            connect_state* state = batch->states + i;
+            if(!state->done){
+                if(state->fd >= 0){ close(state->fd); state->fd = -1;}
+                state->done = 1; batch->n_done++;
+                batch->callback(i, -1, batch->arg);
+            }
+        }
+        return -1;
+    }
+
+    now = connect_now_ms();
+    for(int p = 0; p < n_pfds; p++){
+        if(batch->pfds[p].revents == 0){
+            continue;
+        }
+
+        // the attempt has completed: determine whether it succeeded
+        int i = batch->pfd_targets[p], err = 0;
+        socklen_t err_len = sizeof(err);
+        if(getsockopt(batch->states[i].fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0){
+            err = errno;
+        }
+
+        connect_finish(i, batch->states + i, err == 0, &batch->opts, now, batch->callback, batch->arg);
+        if(batch->states[i].done){
+            batch->n_done++; batch->n_connected += err == 0;
+        }
+    }
+
+    if(batch->n_done == batch->n_targets){
+        return -1;
+    }
+
+    // step again once the next attempt is due, or sooner if attempts in progress are to be checked without waiting
+    int next_ms = wake_at > now ? (int) (wake_at - now) : 0;
+    for(int i = 0; i < batch->n_targets; i++){
+        if(!batch->states[i].done && batch->states[i].fd >= 0 && next_ms > CONNECT_POLL_INTERVAL_MS){
+            next_ms = CONNECT_POLL_INTERVAL_MS;
+        }
+    }
+
+    return next_ms;
+}
+
+// Releases the batch, abandoning any attempt in progress without notifying the callback (e.g. once no longer needed)
+void connect_batch_destroy(connect_batch* batch){
+    for(int i = 0; i < batch->n_targets; i++){
+        if(!batch->states[i].done && batch->states[i].fd >= 0){
+            close(batch->states[i].fd);
+        }
+    }
+
+    free(batch->states); free(batch->pfds); free(batch->pfd_targets);
+    batch->states = NULL; batch->pfds = NULL; batch->pfd_targets = NULL;
+    batch->n_targets = 0;
+}
+
+/* Connects to all the given targets in parallel (see connect_batch_step), returning once every target is connected to
+ * or given up on, such that the total time taken is bounded by the slowest target rather than the sum over all targets,
+ * and in any case by opts->deadline_ms.
+ *
+ * If opts is NULL, the default options are used. Returns the number of targets connected to, or -1 on failure.
+ */
+int connect_all(const connect_target* targets, int n_targets, const connect_options* opts, connect_callback callback,
+                void* arg){
+    connect_batch batch;
+    if(connect_batch_start(&batch, targets, n_targets, opts, callback, arg) < 0){
+        return -1;
+    }
+
+    while(connect_batch_step(&batch, -1) >= 0);
+
+    int n_connected = batch.n_connected;
+    connect_batch_destroy(&batch);
+
+    return n_connected;
+}
@@ -0,0 +1,128 @@
+#include "../include/reactor.h"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+
+/* Initialiser for a reactor, creating the epoll instance and the eventfd used for wake-ups, the latter being registered
+ * with the former. Returns 0 on success, -1 on failure.
+ */
+int reactor_init(reactor* r){
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(r->epoll_fd < 0){
+        return -1;
+    }
+
+    r->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(r->wake_fd < 0){
+        close(r->epoll_fd);
+        return -1;
+    }
+
+    // the wake source has no handler; it is recognised and drained by reactor_run_once itself
+    r->wake_source.fd = r->wake_fd; r->wake_source.handler = NULL; r->wake_source.arg = NULL;
+    r->n_ready = 0;
+    struct epoll_event event = {.events = EPOLLIN | EPOLLET, .data.ptr = &r->wake_source};
+    if(epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->wake_fd, &event) < 0){
+        close(r->wake_fd); close(r->epoll_fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Registers fd with the reactor for the given epoll events (always edge-triggered), such that handler(fd, events, arg)
+ * is called whenever it becomes ready. If src is already registered for fd, the registration is updated instead.
+ * Returns 0 on success, -1 on failure.
+ */
+int reactor_add(reactor* r, reactor_source* src, int fd, unsigned int events, reactor_handler handler, void* arg){
+    src->fd = fd; src->handler = handler; src->arg = arg;
+
+    struct epoll_event event = {.events = events | EPOLLET, .data.ptr = src};
+    if(epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0){
+        if(errno != EEXIST || epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0){
+            reactor_source_clear(src);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* De-registers the source from the reactor. Note that closing a descriptor de-registers it implicitly, in which case it
+ * suffices to call reactor_source_clear. Returns 0 on success, -1 on failure.
+ */
+int reactor_remove(reactor* r, reactor_source* src){
+    int fd = src->fd;
+    reactor_source_clear(src);
+
+    return fd >= 0 ? epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, fd, NULL) : 0;
+}
+
+// Marks the source as no longer registered, such that events still pending for it in the current batch are ignored
+void reactor_source_clear(reactor_source* src){
+    src->fd = -1;
+    src->handler = NULL;
+    src->arg = NULL;
+}
+
+/* Waits for up to timeout_ms milliseconds (-1 to wait indefinitely) for registered descriptors to become ready, keeping
+ * the ready events for a subsequent call to reactor_dispatch. Returns the number of ready events (0 on timeout or if
+ * interrupted by a signal), -1 on failure.
+ */
+int reactor_wait(reactor* r, int timeout_ms){
+    r->n_ready = epoll_wait(r->epoll_fd, r->ready, REACTOR_MAX_EVENTS, timeout_ms);
+    if(r->n_ready < 0){
+        int err = errno;
+        r->n_ready = 0;
+        return err == EINTR ? 0 : -1;
+    }
+
+    return r->n_ready;
+}
+
+/* Dispatches each event returned by the last call to reactor_wait to the handler of its source. Returns the number of
+ * events dispatched (wake-ups are consumed silently).
+ */
+int reactor_dispatch(reactor* r){
+    int n_dispatched = 0;
+
+    for(int i = 0; i < r->n_ready; i++){
+        reactor_source* src = r->ready[i].data.ptr;
+
+        if(src == &r->wake_source){ // drain the eventfd, such that the next wake-up generates a new edge
+            uint64_t n_wakes;
+            while(read(r->wake_fd, &n_wakes, sizeof(n_wakes)) > 0);
+        }else if(src->handler != NULL){ // the source may have been cleared by a handler earlier in this batch
+            src->handler(src->fd, r->ready[i].events, src->arg);
+            n_dispatched++;
+        }
+    }
+
+    r->n_ready = 0;
+    return n_dispatched;
+}
+
+/* Waits for up to timeout_ms milliseconds (-1 to wait indefinitely) for registered descriptors to become ready, and
+ * dispatches each ready descriptor to its handler. Returns the number of events dispatched (0 on timeout, on wake-up or
+ * if interrupted by a signal), -1 on failure.
+ */
+int reactor_run_once(reactor* r, int timeout_ms){
+    if(reactor_wait(r, timeout_ms) < 0){
+        return -1;
+    }
+
+    return reactor_dispatch(r);
+}
+
+// Interrupts a (possibly blocked) call to reactor_run_once; safe to call from any thread
+void reactor_wake(reactor* r){
+    uint64_t one = 1;
+    while(write(r->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+// Releases the epoll instance and eventfd held by the reactor
+void reactor_destroy(reactor* r){
+    close(r->wake_fd);
+    close(r->epoll_fd);
+}
@@ -0,0 +1,151 @@
+#include "../include/ring_queue.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+/* Initialiser for a ring queue holding at most capacity elements of elem_size bytes each. The number of slots is
+ * rounded up to the next power of 2 so that indices may be reduced with a mask rather than a modulo; the semaphores
+ * however are initialised with the requested capacity, such that the bound is exact.
+ *
+ * Returns 0 on success, -1 on failure (invalid arguments or failure to allocate memory).
+ */
+int ring_queue_init(ring_queue* q, size_t capacity, size_t elem_size, int mode){
+    if(capacity == 0 || elem_size == 0 || (mode != RING_SPSC && mode != RING_MPSC)){
+        return -1;
+    }
+
+    size_t n_slots = 1;
+    while(n_slots < capacity){ n_slots <<= 1;} // round up to the next power of 2
+
+    q->slots = malloc(n_slots * elem_size);
+    if(q->slots == NULL){
+        return -1;
+    }
+
+    q->seqs = NULL;
+    if(mode == RING_MPSC){ // sequence numbers are only required when slots may be filled out of order
+        q->seqs = malloc(n_slots * sizeof(atomic_size_t));
+        if(q->seqs == NULL){
+            free(q->slots);
+            return -1;
+        }
+
+        for(size_t i = 0; i < n_slots; i++){
+            atomic_init(q->seqs + i, 0);
+        }
+    }
+
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    q->capacity = capacity;
+    q->mask = n_slots - 1;
+    q->elem_size = elem_size;
+    q->mode = mode;
+
+    if(sem_init(&q->free_slots, 0, capacity) < 0 || sem_init(&q->used_slots, 0, 0) < 0){
+        free(q->slots); free(q->seqs);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Wrapper around sem_wait which restarts the wait if interrupted by a signal handler
+static void ring_sem_wait(sem_t* sem){
+    while(sem_wait(sem) < 0 && errno == EINTR);
+}
+
+/* Copies the element into the slot at the tail of the queue. The caller must have already reserved a slot by
+ * decrementing free_slots; this guarantees that the claimed slot has been consumed, even with multiple producers, since
+ * at most capacity slots may be claimed but not yet dequeued at any time.
+ */
+static void ring_queue_produce(ring_queue* q, const void* elem){
+    if(q->mode == RING_SPSC){
+        size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed); // we are the only writer of tail
+        memcpy(q->slots + (tail & q->mask) * q->elem_size, elem, q->elem_size);
+        atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    }else{
+        size_t tail = atomic_fetch_add_explicit(&q->tail, 1, memory_order_relaxed); // claim a slot
+        memcpy(q->slots + (tail & q->mask) * q->elem_size, elem, q->elem_size);
+        atomic_store_explicit(q->seqs + (tail & q->mask), tail + 1, memory_order_release); // publish the slot
+    }
+
+    sem_post(&q->used_slots); // wake up the consumer, if sleeping
+}
+
+/* Copies the element at the head of the queue into elem. The caller must have already decremented used_slots. With
+ * multiple producers, the slot at the head may have been claimed before, but published after, the slot whose post
+ * woke us up; in this case we yield until the (already running) producer finishes its copy, which is a short wait.
+ */
+static void ring_queue_consume(ring_queue* q, void* elem){
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed); // we are the only writer of head
+
+    if(q->mode == RING_MPSC){
+        while(atomic_load_explicit(q->seqs + (head & q->mask), memory_order_acquire) != head + 1){
+            sched_yield();
+        }
+    }
+
+    memcpy(elem, q->slots + (head & q->mask) * q->elem_size, q->elem_size);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    sem_post(&q->free_slots); // wake up a producer waiting on a full queue, if any
+}
+
+/* Enqueues a copy of elem, blocking (without spinning) while the queue is full. This provides backpressure to the
+ * producer; in the case of a socket reader, TCP flow control then kicks in as the socket is no longer drained.
+ * Returns 0 on success.
+ */
+int ring_queue_push(ring_queue* q, const void* elem){
+    ring_sem_wait(&q->free_slots);
+    ring_queue_produce(q, elem);
+
+    return 0;
+}
+
+// Non-blocking variant of ring_queue_push; returns 1 if the element was enqueued, 0 if the queue is full
+int ring_queue_try_push(ring_queue* q, const void* elem){
+    if(sem_trywait(&q->free_slots) < 0){
+        return 0;
+    }
+
+    ring_queue_produce(q, elem);
+
+    return 1;
+}
+
+// Dequeues the element at the head of the queue into elem, blocking while the queue is empty. Returns 0 on success.
+int ring_queue_pop(ring_queue* q, void* elem){
+    ring_sem_wait(&q->used_slots);
+    ring_queue_consume(q, elem);
+
+    return 0;
+}
+
+// Non-blocking variant of ring_queue_pop; returns 1 if an element was dequeued, 0 if the queue is empty
+int ring_queue_try_pop(ring_queue* q, void* elem){
+    if(sem_trywait(&q->used_slots) < 0){
+        return 0;
+    }
+
+    ring_queue_consume(q, elem);
+
+    return 1;
+}
+
+// Returns the (approximate, if accessed concurrently) number of elements claimed but not yet dequeued
+size_t ring_queue_size(ring_queue* q){
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+    return tail - head;
+}
+
+// Releases any resources held by the queue; the queue must not be accessed concurrently during this call
+void ring_queue_destroy(ring_queue* q){
+    sem_destroy(&q->free_slots);
+    sem_destroy(&q->used_slots);
+    free(q->slots); q->slots = NULL;
+    free(q->seqs); q->seqs = NULL;
+}
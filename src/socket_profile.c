@@ -0,0 +1,71 @@
+#include "../include/socket_profile.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+
+// Returns the default socket profile
+socket_profile socket_default_profile(){
+    socket_profile profile = {.no_delay = SOCKET_DEFAULT_NO_DELAY, .quick_ack = SOCKET_DEFAULT_QUICK_ACK,
+                              .close_on_exec = SOCKET_DEFAULT_CLOSE_ON_EXEC};
+    return profile;
+}
+
+// Sets an integer socket option, returning 0 on success and -1 on failure
+static int socket_set_int(int fd, int level, int option, int value){
+    return setsockopt(fd, level, option, &value, sizeof(value));
+}
+
+/* Applies the profile to the socket fd; options left at 0 are not touched. Buffer sizes are best applied before the
+ * socket is connected (or listens), since the TCP window scale is negotiated on connection. Every option is attempted,
+ * even if some fail (e.g. SO_BUSY_POLL may require privileges); returns 0 if all were applied, -1 otherwise. Only the
+ * buffer sizes and close-on-exec apply to Unix domain sockets.
+ */
+int socket_apply_profile(int fd, const socket_profile* profile){
+    int ret = 0, domain = AF_INET;
+    socklen_t domain_len = sizeof(domain);
+    getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &domain_len);
+    int tcp = domain != AF_UNIX;
+
+    if(tcp && profile->no_delay){
+        ret |= socket_set_int(fd, IPPROTO_TCP, TCP_NODELAY, 1);
+    }
+    if(tcp && profile->quick_ack){
+        ret |= socket_set_int(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+    }
+    if(tcp && profile->busy_poll_us > 0){
+        ret |= socket_set_int(fd, SOL_SOCKET, SO_BUSY_POLL, profile->busy_poll_us);
+    }
+    if(profile->send_buffer > 0){
+        ret |= socket_set_int(fd, SOL_SOCKET, SO_SNDBUF, profile->send_buffer);
+    }
+    if(profile->recv_buffer > 0){
+        ret |= socket_set_int(fd, SOL_SOCKET, SO_RCVBUF, profile->recv_buffer);
+    }
+    if(tcp && profile->keepalive_idle_s > 0){
+        ret |= socket_set_int(fd, SOL_SOCKET, SO_KEEPALIVE, 1);
+        ret |= socket_set_int(fd, IPPROTO_TCP, TCP_KEEPIDLE, profile->keepalive_idle_s);
+        if(profile->keepalive_interval_s > 0){
+            ret |= socket_set_int(fd, IPPROTO_TCP, TCP_KEEPINTVL, profile->keepalive_interval_s);
+        }
+        if(profile->keepalive_count > 0){
+            ret |= socket_set_int(fd, IPPROTO_TCP, TCP_KEEPCNT, profile->keepalive_count);
+        }
+    }
+    if(tcp && profile->user_timeout_ms > 0){
+        ret |= socket_set_int(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, profile->user_timeout_ms);
+    }
+    if(profile->close_on_exec){
+        int flags = fcntl(fd, F_GETFD);
+        ret |= flags < 0 ? -1 : fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+    }
+
+    return ret < 0 ? -1 : 0;
+}
+
+/* Re-arms TCP_QUICKACK on the socket; since the kernel leaves quick ACK mode of its own accord, this is done after every
+ * read on sockets whose profile enables it (see conn_set_quick_ack). Returns 0 on success, -1 on failure.
+ */
+int socket_rearm_quick_ack(int fd){
+    return socket_set_int(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+}
@@ -0,0 +1,129 @@
+#include "../include/uring.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+/* Initialiser for an io_uring instance with (at least) the specified number of submission queue entries, mapping the
+ * submission and completion rings (in a single mapping, if supported by the kernel) and the submission queue entries.
+ * Returns 0 on success, -1 on failure (e.g. if io_uring is not supported or not permitted).
+ */
+int uring_init(uring* u, unsigned entries){
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(u, 0, sizeof(uring));
+
+    u->ring_fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if(u->ring_fd < 0){
+        return -1;
+    }
+
+    u->entries = params.sq_entries;
+    u->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    u->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP){ // both rings share one mapping, of the larger of the two sizes
+        u->sq_ring_len = u->cq_ring_len = u->sq_ring_len > u->cq_ring_len ? u->sq_ring_len : u->cq_ring_len;
+    }
+
+    u->sq_ring = mmap(NULL, u->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+    if(u->sq_ring == MAP_FAILED){
+        close(u->ring_fd); u->ring_fd = -1;
+        return -1;
+    }
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        u->cq_ring = u->sq_ring;
+    }else{
+        u->cq_ring = mmap(NULL, u->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_CQ_RING);
+        if(u->cq_ring == MAP_FAILED){
+            munmap(u->sq_ring, u->sq_ring_len); close(u->ring_fd); u->ring_fd = -1;
+            return -1;
+        }
+    }
+
+    u->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+    if(u->sqes == MAP_FAILED){
+        if(u->cq_ring != u->sq_ring){ munmap(u->cq_ring, u->cq_ring_len);}
+        munmap(u->sq_ring, u->sq_ring_len); close(u->ring_fd); u->ring_fd = -1;
+        return -1;
+    }
+
+    char* sq = u->sq_ring; char* cq = u->cq_ring;
+    u->sq_head = (unsigned*) (sq + params.sq_off.head);
+    u->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+    u->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+    u->sq_array = (unsigned*) (sq + params.sq_off.array);
+    u->cq_head = (unsigned*) (cq + params.cq_off.head);
+    u->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+    u->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    u->sqe_tail = *u->sq_tail;
+
+    return 0;
+}
+
+/* Returns the next (zeroed) submission queue entry to be prepared by the caller, or NULL if the submission queue is full,
+ * in which case the entries prepared so far must first be submitted.
+ */
+struct io_uring_sqe* uring_get_sqe(uring* u){
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE); // advanced by the kernel as entries are consumed
+    if(u->sqe_tail - head >= u->entries){
+        return NULL;
+    }
+
+    unsigned idx = u->sqe_tail & *u->sq_mask;
+    struct io_uring_sqe* sqe = u->sqes + idx;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    u->sq_array[idx] = idx;
+    u->sqe_tail++;
+    u->sq_pending++;
+
+    return sqe;
+}
+
+/* Submits every entry prepared since the last submission, and waits until at least wait_nr completions are available,
+ * all with a single call to io_uring_enter. Returns the number of entries submitted, -1 on failure.
+ */
+int uring_submit(uring* u, unsigned wait_nr){
+    __atomic_store_n(u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE); // publish the prepared entries to the kernel
+
+    int ret;
+    do{
+        ret = (int) syscall(__NR_io_uring_enter, u->ring_fd, u->sq_pending, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0,
+                            NULL, 0);
+    }while(ret < 0 && errno == EINTR);
+
+    if(ret > 0){
+        u->sq_pending -= (unsigned) ret;
+    }
+
+    return ret < 0 ? -1 : ret;
+}
+
+// Takes the next completion (if any) from the completion queue into cqe; returns 1 if a completion was taken, else 0
+int uring_reap(uring* u, struct io_uring_cqe* cqe){
+    unsigned head = *u->cq_head; // only advanced by us
+    if(head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)){
+        return 0;
+    }
+
+    *cqe = u->cqes[head & *u->cq_mask];
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE); // hand the entry back to the kernel
+
+    return 1;
+}
+
+// Unmaps the rings and closes the io_uring instance
+void uring_destroy(uring* u){
+    if(u->ring_fd < 0){
+        return;
+    }
+
+    munmap(u->sqes, u->sqes_len);
+    if(u->cq_ring != u->sq_ring){ munmap(u->cq_ring, u->cq_ring_len);}
+    munmap(u->sq_ring, u->sq_ring_len);
+    close(u->ring_fd);
+    u->ring_fd = -1;
+}